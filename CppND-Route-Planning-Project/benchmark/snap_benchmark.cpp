@@ -0,0 +1,66 @@
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+#include "mapped_file.h"
+#include "route_model.h"
+
+// Measures how many points per second are snapped to their closest road node: one
+// FindClosestNode() call at a time, then the same points as one SnapToNodes() batch on one
+// thread and on all of them.
+//
+// Usage: snap_benchmark [map.osm] [points] [threads]
+int main(int argc, const char **argv)
+{
+    const std::string map_file = argc > 1 ? argv[1] : "../map.osm";
+    const std::size_t count = argc > 2 ? std::strtoull(argv[2], nullptr, 10) : 1'000'000;
+    const std::size_t threads = argc > 3 ? std::strtoull(argv[3], nullptr, 10) : 0;
+
+    const auto data = MappedFile::Open(map_file);
+    if( !data ) {
+        std::cerr << "Failed to read: " << map_file << std::endl;
+        return 1;
+    }
+    RouteModel::LoadOptions options;
+    options.profile = RouteModel::LoadOptions::Profile::Routing;
+    const RouteModel model{data->Data(), data->Size(), options};
+
+    std::mt19937 rng{1};
+    std::uniform_real_distribution<double> coordinate{0., 100.};
+    std::vector<double> x(count), y(count);
+    for( std::size_t i = 0; i < count; ++i ) {
+        x[i] = coordinate(rng);
+        y[i] = coordinate(rng);
+    }
+
+    auto report = [&](const char *name, auto &&snap) {
+        const auto start = std::chrono::steady_clock::now();
+        snap();
+        const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        std::cout << name << ": " << (std::size_t)(count / elapsed.count()) << " points/s" << std::endl;
+    };
+
+    std::vector<int> single(count), batch(count), parallel(count);
+    report("FindClosestNode", [&] {
+        for( std::size_t i = 0; i < count; ++i ) {
+            float px = x[i], py = y[i];
+            px *= 0.01;
+            py *= 0.01;
+            single[i] = model.FindClosestNode(px, py).Index();
+        }
+    });
+    report("SnapToNodes, 1 thread", [&] {
+        model.SnapToNodes(x.data(), y.data(), count, RouteModel::Units::Percent, batch.data(), 1);
+    });
+    report("SnapToNodes, all threads", [&] {
+        model.SnapToNodes(x.data(), y.data(), count, RouteModel::Units::Percent, parallel.data(), threads);
+    });
+
+    if( batch != single || parallel != single ) {
+        std::cerr << "Batch snapping disagrees with FindClosestNode()." << std::endl;
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,191 @@
+#include "binary_map.h"
+#include <algorithm>
+#include <fstream>
+#include <stdexcept>
+
+namespace BinaryMap {
+
+namespace {
+
+constexpr char kMagic[8] = {'O', 'S', 'M', 'R', 'P', 'M', 'A', 'P'};
+constexpr std::uint32_t kByteOrder = 0x01020304;
+constexpr std::byte kPadding[8] = {};
+
+struct Header {
+    char magic[8];
+    std::uint32_t byte_order;
+    std::uint32_t version;
+    std::uint64_t checksum;     // of everything after the header
+    std::uint64_t size;         // of the whole file
+    std::uint32_t section_count;
+    std::uint32_t reserved;
+};
+
+// Word-at-a-time FNV-1a with an extra fold, fast enough to verify large files on every load.
+// Meant to catch truncated or damaged files, not tampering. The total size is a multiple
+// of 8, but a word may be split across Update() calls.
+class Checksum
+{
+public:
+    void Update( const void *data, std::size_t size ) noexcept
+    {
+        auto bytes = static_cast<const std::byte *>(data);
+        while( m_Pending && size ) {
+            m_Word[m_Pending++] = *bytes++;
+            --size;
+            if( m_Pending == 8 ) {
+                Mix(m_Word);
+                m_Pending = 0;
+            }
+        }
+        for( ; size >= 8; bytes += 8, size -= 8 )
+            Mix(bytes);
+        memcpy(m_Word, bytes, size);
+        m_Pending = size;
+    }
+
+    std::uint64_t Value() const noexcept { return m_Hash; }
+
+private:
+    void Mix( const std::byte *bytes ) noexcept
+    {
+        std::uint64_t word;
+        memcpy(&word, bytes, 8);
+        m_Hash = (m_Hash ^ word) * 0x100000001b3ull;
+        m_Hash ^= m_Hash >> 32;
+    }
+
+    std::uint64_t m_Hash = 0xcbf29ce484222325ull;
+    std::byte m_Word[8] = {};
+    std::size_t m_Pending = 0;
+};
+
+}
+
+bool Recognize( const std::byte *data, std::size_t size ) noexcept
+{
+    return data && size >= sizeof(kMagic) && memcmp(data, kMagic, sizeof(kMagic)) == 0;
+}
+
+void Writer::BeginSection( std::uint32_t tag )
+{
+    m_Sections.emplace_back().tag = tag;
+}
+
+void Writer::Append( const void *data, std::size_t size )
+{
+    auto &section = m_Sections.back();
+    if( size )
+        section.chunks.push_back({data, size});
+    if( const auto tail = size % 8 )
+        section.chunks.push_back({kPadding, 8 - tail});
+    section.size += (size + 7) / 8 * 8;
+}
+
+void Writer::Write( const std::string &path ) const
+{
+    Header header{};
+    memcpy(header.magic, kMagic, sizeof(kMagic));
+    header.byte_order = kByteOrder;
+    header.version = kVersion;
+    header.section_count = (std::uint32_t)m_Sections.size();
+
+    struct Entry {
+        std::uint32_t tag;
+        std::uint32_t reserved;
+        std::uint64_t offset;
+        std::uint64_t size;
+    };
+    std::vector<Entry> table;
+    auto offset = (std::uint64_t)(sizeof(Header) + m_Sections.size() * sizeof(Entry));
+    for( const auto &section: m_Sections ) {
+        table.push_back({section.tag, 0, offset, section.size});
+        offset += section.size;
+    }
+    header.size = offset;
+
+    Checksum checksum;
+    checksum.Update(table.data(), table.size() * sizeof(Entry));
+    for( const auto &section: m_Sections )
+        for( const auto &chunk: section.chunks )
+            checksum.Update(chunk.data, chunk.size);
+    header.checksum = checksum.Value();
+
+    std::ofstream os{path, std::ios::binary | std::ios::trunc};
+    os.write((const char*)&header, sizeof(header));
+    os.write((const char*)table.data(), table.size() * sizeof(Entry));
+    for( const auto &section: m_Sections )
+        for( const auto &chunk: section.chunks )
+            os.write((const char*)chunk.data, chunk.size);
+    os.flush();
+    if( !os )
+        throw std::runtime_error("failed to write the map file " + path);
+}
+
+Reader::Reader( const std::byte *data, std::size_t size, bool verify_checksum ) : m_Data(data)
+{
+    Header header;
+    if( !Recognize(data, size) || size < sizeof(header) )
+        throw std::logic_error("not a compiled map file");
+    memcpy(&header, data, sizeof(header));
+    if( header.byte_order != kByteOrder )
+        throw std::logic_error("the compiled map file was written with a different byte order");
+    if( header.version != kVersion )
+        throw std::logic_error("unsupported compiled map version " + std::to_string(header.version));
+    if( header.size != size )
+        throw std::logic_error("the compiled map file is truncated");
+
+    const auto table_size = (std::uint64_t)header.section_count * sizeof(Entry);
+    if( table_size > size - sizeof(Header) )
+        throw std::logic_error("the compiled map file is corrupted");
+    m_Entries.resize(header.section_count);
+    memcpy(m_Entries.data(), data + sizeof(Header), table_size);
+    for( const auto &entry: m_Entries )
+        if( entry.offset > size || entry.size > size - entry.offset || entry.offset % 8 != 0 )
+            throw std::logic_error("the compiled map file is corrupted");
+
+    if( verify_checksum ) {
+        Checksum checksum;
+        checksum.Update(data + sizeof(Header), size - sizeof(Header));
+        if( checksum.Value() != header.checksum )
+            throw std::logic_error("the compiled map file is corrupted");
+    }
+}
+
+bool Reader::Has( std::uint32_t tag ) const noexcept
+{
+    for( const auto &entry: m_Entries )
+        if( entry.tag == tag )
+            return true;
+    return false;
+}
+
+Reader::Cursor Reader::Section( std::uint32_t tag ) const
+{
+    for( const auto &entry: m_Entries )
+        if( entry.tag == tag )
+            return Cursor{m_Data + entry.offset, m_Data + entry.offset + entry.size};
+    throw std::logic_error("the compiled map file has no section " + std::string((const char*)&tag, 4));
+}
+
+std::uint64_t Reader::Cursor::Count()
+{
+    std::uint64_t count;
+    Need(1, sizeof(count));
+    memcpy(&count, m_Pos, sizeof(count));
+    Skip(sizeof(count));
+    return count;
+}
+
+void Reader::Cursor::Need( std::uint64_t count, std::size_t element_size ) const
+{
+    if( count > (std::uint64_t)(m_End - m_Pos) / element_size )
+        throw std::logic_error("the compiled map file is corrupted");
+}
+
+void Reader::Cursor::Skip( std::size_t size )
+{
+    m_Pos += std::min((size + 7) / 8 * 8, (std::size_t)(m_End - m_Pos));
+}
+
+}
@@ -0,0 +1,130 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+// Compiled map files: a fixed header, a table of tagged sections and the sections
+// themselves. A section is a sequence of arrays, each stored as a 64-bit element count
+// followed by the raw elements, padded to 8 bytes so that every array is aligned when
+// the file is memory-mapped. The header carries a format version and a checksum of
+// everything after it. Files use the native byte order and are rejected on a machine
+// with a different one.
+namespace BinaryMap {
+
+constexpr std::uint32_t kVersion = 3;
+
+constexpr std::uint32_t Tag( const char (&name)[5] ) noexcept
+{
+    return (std::uint32_t)(unsigned char)name[0] | (std::uint32_t)(unsigned char)name[1] << 8 |
+           (std::uint32_t)(unsigned char)name[2] << 16 | (std::uint32_t)(unsigned char)name[3] << 24;
+}
+
+// True if the buffer starts like a compiled map, whatever its version.
+bool Recognize( const std::byte *data, std::size_t size ) noexcept;
+
+class Writer
+{
+public:
+    // Starts a new section; the following Array() calls append to it.
+    void BeginSection( std::uint32_t tag );
+
+    // The elements are not copied: they must stay alive until Write() returns.
+    template <typename T>
+    void Array( const T *data, std::size_t count )
+    {
+        static_assert( std::is_trivially_copyable_v<T> );
+        Append(&m_Counts.emplace_back(count), sizeof(std::uint64_t));
+        Append(data, count * sizeof(T));
+    }
+
+    template <typename T>
+    void Array( const std::vector<T> &v ) { Array(v.data(), v.size()); }
+
+    // Temporaries are kept by the writer until it is destroyed.
+    template <typename T>
+    void Array( std::vector<T> &&v )
+    {
+        auto owned = std::make_shared<const std::vector<T>>(std::move(v));
+        m_Owned.emplace_back(owned);
+        Array(*owned);
+    }
+
+    // Throws std::runtime_error if the file can't be written.
+    void Write( const std::string &path ) const;
+
+private:
+    struct Chunk {
+        const void *data;
+        std::size_t size;
+    };
+    struct Section {
+        std::uint32_t tag;
+        std::vector<Chunk> chunks;
+        std::size_t size = 0;
+    };
+
+    void Append( const void *data, std::size_t size );
+
+    std::vector<Section> m_Sections;
+    std::deque<std::uint64_t> m_Counts;
+    std::vector<std::shared_ptr<const void>> m_Owned;
+};
+
+class Reader
+{
+public:
+    // Reads the arrays of one section in the order they were written.
+    class Cursor
+    {
+    public:
+        template <typename T>
+        void Array( std::vector<T> &out )
+        {
+            static_assert( std::is_trivially_copyable_v<T> );
+            const auto count = Count();
+            Need(count, sizeof(T));
+            out.resize(count);
+            if( count )
+                memcpy(out.data(), m_Pos, count * sizeof(T));
+            Skip(count * sizeof(T));
+        }
+
+    private:
+        friend class Reader;
+        Cursor( const std::byte *pos, const std::byte *end ) : m_Pos(pos), m_End(end) {}
+        std::uint64_t Count();
+        void Need( std::uint64_t count, std::size_t element_size ) const;
+        void Skip( std::size_t size );
+
+        const std::byte *m_Pos;
+        const std::byte *m_End;
+    };
+
+    // Validates the header, the section table and (optionally) the checksum.
+    // Throws std::logic_error on a malformed, corrupted or incompatible file.
+    Reader( const std::byte *data, std::size_t size, bool verify_checksum = true );
+
+    bool Has( std::uint32_t tag ) const noexcept;
+
+    // Throws std::logic_error if the section is missing.
+    Cursor Section( std::uint32_t tag ) const;
+
+private:
+    struct Entry {
+        std::uint32_t tag;
+        std::uint32_t reserved;
+        std::uint64_t offset;
+        std::uint64_t size;
+    };
+
+    const std::byte *m_Data;
+    std::vector<Entry> m_Entries;
+};
+
+}
@@ -0,0 +1,167 @@
+#include "coord_store.h"
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <stdexcept>
+#include <tuple>
+#include <utility>
+#include <assert.h>
+
+void CoordStore::Reserve( std::size_t count )
+{
+    m_X.reserve(count);
+    m_Y.reserve(count);
+}
+
+void CoordStore::Add( double x, double y )
+{
+    assert( m_Precision == Precision::Double );
+    m_X.emplace_back(x);
+    m_Y.emplace_back(y);
+    ++m_Size;
+}
+
+void CoordStore::Append( const CoordStore &other )
+{
+    assert( m_Precision == Precision::Double && other.m_Precision == Precision::Double );
+    m_X.insert(m_X.end(), other.m_X.begin(), other.m_X.end());
+    m_Y.insert(m_Y.end(), other.m_Y.begin(), other.m_Y.end());
+    m_Size += other.m_Size;
+}
+
+void CoordStore::Select( const std::vector<int> &indices )
+{
+    assert( m_Precision == Precision::Double );
+    std::vector<double> xs(indices.size()), ys(indices.size());
+    for( std::size_t i = 0; i < indices.size(); ++i ) {
+        xs[i] = m_X[indices[i]];
+        ys[i] = m_Y[indices[i]];
+    }
+    m_X = std::move(xs);
+    m_Y = std::move(ys);
+    m_Size = indices.size();
+}
+
+void CoordStore::Decode()
+{
+    if( m_Precision == Precision::Double )
+        return;
+    m_X.resize(m_Size);
+    m_Y.resize(m_Size);
+    for( std::size_t i = 0; i < m_Size; ++i ) {
+        m_X[i] = X(i);
+        m_Y[i] = Y(i);
+    }
+    m_FloatX = {};
+    m_FloatY = {};
+    m_FixedX = {};
+    m_FixedY = {};
+    m_Precision = Precision::Double;
+}
+
+// Half a float ulp at the largest magnitude in the array: the worst rounding error.
+static double FloatError( const std::vector<double> &values )
+{
+    double max = 0.;
+    for( auto v: values )
+        max = std::max(max, std::abs(v));
+    if( max == 0. )
+        return 0.;
+    int exponent;
+    std::frexp((double)(float)max, &exponent);
+    return std::ldexp(1., exponent - 25);
+}
+
+// Maps values onto [0, 2^32 - 1] and returns the origin and step that decode them.
+static std::pair<double, double> ToFixed( const std::vector<double> &values, std::vector<std::uint32_t> &fixed )
+{
+    fixed.resize(values.size());
+    if( values.empty() )
+        return {0., 0.};
+    const auto [min, max] = std::minmax_element(values.begin(), values.end());
+    const auto origin = *min;
+    const auto step = (*max - *min) / (double)std::numeric_limits<std::uint32_t>::max();
+    const auto top = (long long)std::numeric_limits<std::uint32_t>::max();
+    for( std::size_t i = 0; i < values.size(); ++i )
+        fixed[i] = step > 0. ? (std::uint32_t)std::min(std::llround((values[i] - origin) / step), top) : 0;
+    return {origin, step};
+}
+
+void CoordStore::Quantize( Precision precision )
+{
+    if( precision == m_Precision )
+        return;
+    Decode();
+    if( precision == Precision::Float ) {
+        m_FloatX.assign(m_X.begin(), m_X.end());
+        m_FloatY.assign(m_Y.begin(), m_Y.end());
+        m_ErrorBound += std::hypot(FloatError(m_X), FloatError(m_Y));
+    }
+    else if( precision == Precision::Fixed32 ) {
+        std::tie(m_OriginX, m_StepX) = ToFixed(m_X, m_FixedX);
+        std::tie(m_OriginY, m_StepY) = ToFixed(m_Y, m_FixedY);
+        m_ErrorBound += std::hypot(m_StepX, m_StepY) / 2;
+    }
+    if( precision != Precision::Double ) {
+        m_X = {};
+        m_Y = {};
+    }
+    m_Precision = precision;
+}
+
+std::size_t CoordStore::MemoryUsage() const noexcept
+{
+    return (m_X.capacity() + m_Y.capacity()) * sizeof(double) +
+           (m_FloatX.capacity() + m_FloatY.capacity()) * sizeof(float) +
+           (m_FixedX.capacity() + m_FixedY.capacity()) * sizeof(std::uint32_t);
+}
+
+void CoordStore::Write( BinaryMap::Writer &writer ) const
+{
+    writer.Array(std::vector<std::uint32_t>{(std::uint32_t)m_Precision});
+    writer.Array(std::vector<double>{m_OriginX, m_OriginY, m_StepX, m_StepY, m_ErrorBound});
+    switch( m_Precision ) {
+        case Precision::Float:
+            writer.Array(m_FloatX);
+            writer.Array(m_FloatY);
+            break;
+        case Precision::Fixed32:
+            writer.Array(m_FixedX);
+            writer.Array(m_FixedY);
+            break;
+        default:
+            writer.Array(m_X);
+            writer.Array(m_Y);
+    }
+}
+
+void CoordStore::Read( BinaryMap::Reader::Cursor &cursor )
+{
+    std::vector<std::uint32_t> precision;
+    std::vector<double> params;
+    cursor.Array(precision);
+    cursor.Array(params);
+    if( precision.size() != 1 || precision[0] > (std::uint32_t)Precision::Fixed32 || params.size() != 5 )
+        throw std::logic_error("the compiled map file is corrupted");
+
+    *this = CoordStore{};
+    m_Precision = (Precision)precision[0];
+    m_OriginX = params[0];
+    m_OriginY = params[1];
+    m_StepX = params[2];
+    m_StepY = params[3];
+    m_ErrorBound = params[4];
+
+    auto read = [&](auto &xs, auto &ys) {
+        cursor.Array(xs);
+        cursor.Array(ys);
+        if( xs.size() != ys.size() )
+            throw std::logic_error("the compiled map file is corrupted");
+        m_Size = xs.size();
+    };
+    switch( m_Precision ) {
+        case Precision::Float:   read(m_FloatX, m_FloatY); break;
+        case Precision::Fixed32: read(m_FixedX, m_FixedY); break;
+        default:                 read(m_X, m_Y);
+    }
+}
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "binary_map.h"
+
+// Node coordinates as separate x[] and y[] arrays (structure of arrays), so that scans over
+// many nodes stream through contiguous memory and vectorize.
+//
+// Coordinates are added and transformed as doubles. Quantize() can then shrink them to
+// 32-bit floats, or to 32-bit fixed point spread evenly over the nodes' extent, halving
+// the footprint; ErrorBound() tells how far that may move a node.
+class CoordStore
+{
+public:
+    enum class Precision { Double, Float, Fixed32 };
+
+    void Reserve( std::size_t count );
+    void Add( double x, double y );
+    // Both stores must still be at Double precision.
+    void Append( const CoordStore &other );
+    // Keeps only the coordinates at the listed indices, in that order. Double precision only.
+    void Select( const std::vector<int> &indices );
+
+    std::size_t Size() const noexcept { return m_Size; }
+    Precision GetPrecision() const noexcept { return m_Precision; }
+
+    double X( std::size_t i ) const noexcept
+    {
+        switch( m_Precision ) {
+            case Precision::Float:   return m_FloatX[i];
+            case Precision::Fixed32: return m_OriginX + m_StepX * m_FixedX[i];
+            default:                 return m_X[i];
+        }
+    }
+
+    double Y( std::size_t i ) const noexcept
+    {
+        switch( m_Precision ) {
+            case Precision::Float:   return m_FloatY[i];
+            case Precision::Fixed32: return m_OriginY + m_StepY * m_FixedY[i];
+            default:                 return m_Y[i];
+        }
+    }
+
+    // The double arrays, for filling or transforming coordinates in bulk. Only valid at
+    // Double precision.
+    double *MutableX() noexcept { return m_X.data(); }
+    double *MutableY() noexcept { return m_Y.data(); }
+
+    // Converts the coordinates to `precision`; converting a quantized store decodes it first,
+    // so errors add up.
+    void Quantize( Precision precision );
+
+    // Largest distance, in coordinate units, between a stored position and the one added.
+    double ErrorBound() const noexcept { return m_ErrorBound; }
+
+    std::size_t MemoryUsage() const noexcept;
+
+    void Write( BinaryMap::Writer &writer ) const;
+    // Throws std::logic_error if the arrays are inconsistent.
+    void Read( BinaryMap::Reader::Cursor &cursor );
+
+private:
+    void Decode();
+
+    Precision m_Precision = Precision::Double;
+    std::size_t m_Size = 0;
+    std::vector<double> m_X, m_Y;
+    std::vector<float> m_FloatX, m_FloatY;
+    std::vector<std::uint32_t> m_FixedX, m_FixedY;
+    double m_OriginX = 0., m_OriginY = 0.;
+    double m_StepX = 0., m_StepY = 0.;
+    double m_ErrorBound = 0.;
+};
@@ -0,0 +1,146 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <limits>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+// Read-only view of a contiguous run of T.
+template <typename T>
+class Span
+{
+public:
+    using value_type = T;
+    using iterator = const T *;
+    using reverse_iterator = std::reverse_iterator<const T *>;
+
+    Span() = default;
+    Span( const T *begin, const T *end ) noexcept : m_Begin(begin), m_End(end) {}
+
+    const T *begin() const noexcept { return m_Begin; }
+    const T *end() const noexcept { return m_End; }
+    reverse_iterator rbegin() const noexcept { return reverse_iterator{m_End}; }
+    reverse_iterator rend() const noexcept { return reverse_iterator{m_Begin}; }
+    const T *data() const noexcept { return m_Begin; }
+    std::size_t size() const noexcept { return (std::size_t)(m_End - m_Begin); }
+    bool empty() const noexcept { return m_Begin == m_End; }
+    const T &front() const noexcept { return *m_Begin; }
+    const T &back() const noexcept { return m_End[-1]; }
+    const T &operator[]( std::size_t i ) const noexcept { return m_Begin[i]; }
+
+private:
+    const T *m_Begin = nullptr;
+    const T *m_End = nullptr;
+};
+
+// A list of variable-length rows stored compressed (CSR): all values back to back in one
+// array, plus an array of offsets where row i spans [offsets[i], offsets[i + 1]).
+// One allocation per list instead of one per row, and rows are read without indirection.
+template <typename T>
+class Csr
+{
+public:
+    using Offset = std::uint32_t;
+
+    Csr() = default;
+
+    // Adopts arrays in the layout Offsets()/Values() return; check Valid() before use.
+    Csr( std::vector<Offset> offsets, std::vector<T> values ) :
+        m_Offsets(std::move(offsets)), m_Values(std::move(values)) {}
+
+    // Starts a new, empty last row.
+    void AddRow()
+    {
+        if( m_Values.size() > kMaxValues )
+            TooManyValues();
+        m_Offsets.emplace_back((Offset)m_Values.size());
+    }
+
+    // Values that would overflow the offsets are taken back, with their row, before throwing.
+    template <typename It>
+    void AddRow( It begin, It end )
+    {
+        AddRow();
+        m_Values.insert(m_Values.end(), begin, end);
+        if( m_Values.size() > kMaxValues ) {
+            PopRow();
+            TooManyValues();
+        }
+        m_Offsets.back() = (Offset)m_Values.size();
+    }
+
+    // Appends a value to the last row.
+    void Push( const T &value )
+    {
+        m_Values.emplace_back(value);
+        if( m_Values.size() > kMaxValues ) {
+            m_Values.pop_back();
+            TooManyValues();
+        }
+        ++m_Offsets.back();
+    }
+
+    // Removes the last row and its values.
+    void PopRow()
+    {
+        m_Offsets.pop_back();
+        m_Values.resize(m_Offsets.back());
+    }
+
+    // Adds all rows of another list after the rows of this one.
+    void Append( const Csr &other )
+    {
+        const auto base = (Offset)m_Values.size();
+        if( other.m_Values.size() > kMaxValues - base )
+            TooManyValues();
+        m_Values.insert(m_Values.end(), other.m_Values.begin(), other.m_Values.end());
+        m_Offsets.reserve(m_Offsets.size() + other.Size());
+        for( std::size_t i = 1; i < other.m_Offsets.size(); ++i )
+            m_Offsets.emplace_back(base + other.m_Offsets[i]);
+    }
+
+    std::size_t Size() const noexcept { return m_Offsets.size() - 1; }
+    bool Empty() const noexcept { return Size() == 0; }
+
+    Span<T> operator[]( std::size_t row ) const noexcept
+    {
+        return {m_Values.data() + m_Offsets[row], m_Values.data() + m_Offsets[row + 1]};
+    }
+
+    // False if adopted arrays don't describe a list of rows within the values array.
+    bool Valid() const noexcept
+    {
+        if( m_Offsets.empty() || m_Offsets.front() != 0 || m_Offsets.back() != m_Values.size() )
+            return false;
+        for( std::size_t i = 1; i < m_Offsets.size(); ++i )
+            if( m_Offsets[i - 1] > m_Offsets[i] )
+                return false;
+        return true;
+    }
+
+    const std::vector<Offset> &Offsets() const noexcept { return m_Offsets; }
+    const std::vector<T> &Values() const noexcept { return m_Values; }
+    std::pair<std::vector<Offset>, std::vector<T>> Release() &&
+    {
+        return {std::move(m_Offsets), std::move(m_Values)};
+    }
+
+    std::size_t MemoryUsage() const noexcept
+    {
+        return m_Offsets.capacity() * sizeof(Offset) + m_Values.capacity() * sizeof(T);
+    }
+
+private:
+    static constexpr std::size_t kMaxValues = std::numeric_limits<Offset>::max();
+
+    [[noreturn]] static void TooManyValues()
+    {
+        throw std::length_error("too many values for a compressed list");
+    }
+
+    std::vector<Offset> m_Offsets{0};
+    std::vector<T> m_Values;
+};
@@ -0,0 +1,89 @@
+#include "id_index.h"
+#include <algorithm>
+#include <numeric>
+#include <assert.h>
+
+void IdIndex::Add( std::int64_t id, int num )
+{
+    if( !m_Nums.empty() || num != (int)m_Ids.size() ) {
+        if( m_Nums.empty() ) {
+            m_Nums.resize(m_Ids.size());
+            std::iota(m_Nums.begin(), m_Nums.end(), 0);
+        }
+        m_Nums.emplace_back(num);
+    }
+    if( !m_Ids.empty() && id < m_Ids.back() )
+        m_Sorted = false;
+    m_Ids.emplace_back(id);
+}
+
+void IdIndex::Append( const IdIndex &other, int offset )
+{
+    m_Ids.reserve(m_Ids.size() + other.m_Ids.size());
+    for( std::size_t i = 0; i < other.m_Ids.size(); ++i )
+        Add(other.m_Ids[i], offset + (other.m_Nums.empty() ? (int)i : other.m_Nums[i]));
+}
+
+void IdIndex::Finalize()
+{
+    if( m_Sorted )
+        return;
+
+    if( m_Nums.empty() ) {
+        m_Nums.resize(m_Ids.size());
+        std::iota(m_Nums.begin(), m_Nums.end(), 0);
+    }
+
+    // Stable, so that duplicated ids keep their insertion order and Find() returns the last one.
+    std::vector<std::size_t> order(m_Ids.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(order.begin(), order.end(), [&](auto a, auto b){ return m_Ids[a] < m_Ids[b]; });
+
+    std::vector<std::int64_t> ids(m_Ids.size());
+    std::vector<int> nums(m_Nums.size());
+    for( std::size_t i = 0; i < order.size(); ++i ) {
+        ids[i] = m_Ids[order[i]];
+        nums[i] = m_Nums[order[i]];
+    }
+    m_Ids = std::move(ids);
+    m_Nums = std::move(nums);
+    m_Sorted = true;
+}
+
+int IdIndex::Find( std::int64_t id ) const noexcept
+{
+    assert( m_Sorted );
+    const auto ids = m_Ids.data();
+
+    // Look for the upper bound of id in [lo, hi). OSM ids are dense enough that a couple of
+    // interpolation probes land next to the answer; binary search finishes off the rest
+    // and bounds the cost on skewed id distributions.
+    std::size_t lo = 0, hi = m_Ids.size();
+    for( int probe = 0; probe < 3 && hi - lo > 32; ++probe ) {
+        const auto lo_id = ids[lo], hi_id = ids[hi - 1];
+        if( id < lo_id || id > hi_id || lo_id == hi_id )
+            break;
+        const auto fraction = (double)(id - lo_id) / (double)(hi_id - lo_id);
+        auto pos = lo + (std::size_t)(fraction * (double)(hi - 1 - lo));
+        pos = std::min(pos, hi - 1);
+        if( ids[pos] <= id )
+            lo = pos + 1;
+        else
+            hi = pos;
+    }
+    const auto upper = (std::size_t)(std::upper_bound(ids + lo, ids + hi, id) - ids);
+
+    if( upper == 0 || ids[upper - 1] != id )
+        return -1;
+    return m_Nums.empty() ? (int)(upper - 1) : m_Nums[upper - 1];
+}
+
+std::size_t IdIndex::MemoryUsage() const noexcept
+{
+    return m_Ids.capacity() * sizeof(std::int64_t) + m_Nums.capacity() * sizeof(int);
+}
+
+double IdIndex::BytesPerEntry() const noexcept
+{
+    return m_Ids.empty() ? 0. : (double)MemoryUsage() / (double)m_Ids.size();
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+
+// Maps 64-bit OSM ids to the numbers the model assigned to their elements.
+//
+// OSM exports list every element type in ascending id order and Model numbers elements
+// in file order, so in the common case the index is just the sorted id array: 8 bytes
+// per element, searched by interpolation. Ids added out of order, or numbers that are
+// not the insertion position, fall back to a sorted (id, number) table at 12 bytes per
+// element. Either way there is no per-element allocation or string hashing.
+class IdIndex
+{
+public:
+    void Add( std::int64_t id, int num );
+
+    // Adds all entries of another index, with `offset` added to their numbers.
+    void Append( const IdIndex &other, int offset );
+
+    // Must be called after a batch of Add()s and before the next Find().
+    void Finalize();
+
+    // Number of the element with this id, or -1. Duplicated ids resolve to the last one added.
+    int Find( std::int64_t id ) const noexcept;
+
+    std::size_t Size() const noexcept { return m_Ids.size(); }
+    std::size_t MemoryUsage() const noexcept;
+    double BytesPerEntry() const noexcept;
+
+private:
+    std::vector<std::int64_t> m_Ids;
+    std::vector<int> m_Nums;        // empty while m_Nums[i] would be i
+    bool m_Sorted = true;
+};
@@ -0,0 +1,211 @@
+#include "kd_tree.h"
+#include <algorithm>
+#include <limits>
+#include <numeric>
+#include <stdexcept>
+
+KdTree::KdTree( std::vector<Point> points )
+{
+    if( points.size() > (std::size_t)std::numeric_limits<int>::max() )
+        throw std::length_error("too many points for a k-d tree");
+    m_Positions.resize(points.size());
+    std::iota(m_Positions.begin(), m_Positions.end(), 0);
+    if( points.empty() )
+        return;
+
+    m_Cells.reserve(2 * (points.size() / kLeafSize + 1));
+    Build(points, 0, (std::uint32_t)points.size());
+
+    m_X.resize(points.size());
+    m_Y.resize(points.size());
+    for( std::size_t i = 0; i < points.size(); ++i ) {
+        m_X[i] = points[m_Positions[i]].x;
+        m_Y[i] = points[m_Positions[i]].y;
+    }
+}
+
+// Partitions positions rather than points; the constructor then lays the points out in leaf
+// order.
+void KdTree::Build( std::vector<Point> &points, std::uint32_t begin, std::uint32_t end )
+{
+    const auto cell = (std::uint32_t)m_Cells.size();
+    m_Cells.push_back({0., begin, end, 0, 0});
+    if( end - begin <= kLeafSize )
+        return;
+
+    double min_x = std::numeric_limits<double>::max(), max_x = std::numeric_limits<double>::lowest();
+    double min_y = min_x, max_y = max_x;
+    for( auto i = begin; i < end; ++i ) {
+        const auto &p = points[m_Positions[i]];
+        min_x = std::min(min_x, p.x);
+        max_x = std::max(max_x, p.x);
+        min_y = std::min(min_y, p.y);
+        max_y = std::max(max_y, p.y);
+    }
+    const std::uint8_t axis = max_y - min_y > max_x - min_x;
+    const auto coordinate = [&](int position) { return axis ? points[position].y : points[position].x; };
+
+    const auto mid = begin + (end - begin) / 2;
+    std::nth_element(m_Positions.begin() + begin, m_Positions.begin() + mid, m_Positions.begin() + end,
+                     [&](int a, int b) { return coordinate(a) < coordinate(b); });
+    m_Cells[cell].split = coordinate(m_Positions[mid]);
+    m_Cells[cell].axis = axis;
+
+    Build(points, begin, mid);
+    m_Cells[cell].right = (std::uint32_t)m_Cells.size();
+    Build(points, mid, end);
+}
+
+// The distances to a leaf's points, as one branch-free loop over its coordinate arrays. Built
+// without errno for sqrt (see CMakeLists.txt) so that it vectorizes; the results are the same.
+void KdTree::LeafDistances( const Cell &leaf, double x, double y, float *distances ) const noexcept
+{
+    const double *xs = m_X.data() + leaf.begin;
+    const double *ys = m_Y.data() + leaf.begin;
+    const auto count = leaf.end - leaf.begin;
+    for( std::uint32_t i = 0; i < count; ++i )
+        distances[i] = Distance(x, y, xs[i], ys[i]);
+}
+
+int KdTree::Nearest( double x, double y ) const
+{
+    if( m_Cells.empty() )
+        return -1;
+    Found best{std::numeric_limits<float>::infinity(), -1};
+    Search(0, x, y, best);
+    return best.position;
+}
+
+std::vector<int> KdTree::Nearest( double x, double y, std::size_t k ) const
+{
+    std::vector<Found> heap;
+    if( m_Cells.empty() || k == 0 )
+        return {};
+    heap.reserve(std::min(k, Size()));
+    Search(0, x, y, k, heap);
+
+    std::sort_heap(heap.begin(), heap.end());
+    std::vector<int> positions(heap.size());
+    for( std::size_t i = 0; i < heap.size(); ++i )
+        positions[i] = heap[i].position;
+    return positions;
+}
+
+void KdTree::Nearest( const double *x, const double *y, std::size_t count, int *positions ) const
+{
+    for( std::size_t i = 0; i < count; ++i )
+        positions[i] = Nearest(x[i], y[i]);
+}
+
+// A subtree can't hold a point closer than the distance to its splitting line, and since
+// rounding to float is monotonic, that holds for the rounded distances too. Subtrees exactly
+// as far as the best point are still searched, for a point of lower position.
+void KdTree::Search( std::uint32_t cell, double x, double y, Found &best ) const
+{
+    const auto &c = m_Cells[cell];
+    if( c.right == 0 ) {
+        float distances[kLeafSize];
+        LeafDistances(c, x, y, distances);
+        for( auto i = c.begin; i < c.end; ++i ) {
+            const Found found{distances[i - c.begin], m_Positions[i]};
+            if( found < best )
+                best = found;
+        }
+        return;
+    }
+
+    const double offset = (c.axis ? y : x) - c.split;
+    const auto near = offset < 0 ? cell + 1 : c.right;
+    const auto far = offset < 0 ? c.right : cell + 1;
+    Search(near, x, y, best);
+    if( Distance(offset, 0., 0., 0.) <= best.distance )
+        Search(far, x, y, best);
+}
+
+// `heap` is a max-heap of the best candidates so far, so its front is the one to evict.
+void KdTree::Search( std::uint32_t cell, double x, double y, std::size_t k, std::vector<Found> &heap ) const
+{
+    const auto &c = m_Cells[cell];
+    if( c.right == 0 ) {
+        float distances[kLeafSize];
+        LeafDistances(c, x, y, distances);
+        for( auto i = c.begin; i < c.end; ++i ) {
+            const Found found{distances[i - c.begin], m_Positions[i]};
+            if( heap.size() < k ) {
+                heap.push_back(found);
+                std::push_heap(heap.begin(), heap.end());
+            }
+            else if( found < heap.front() ) {
+                std::pop_heap(heap.begin(), heap.end());
+                heap.back() = found;
+                std::push_heap(heap.begin(), heap.end());
+            }
+        }
+        return;
+    }
+
+    const double offset = (c.axis ? y : x) - c.split;
+    const auto near = offset < 0 ? cell + 1 : c.right;
+    const auto far = offset < 0 ? c.right : cell + 1;
+    Search(near, x, y, k, heap);
+    if( heap.size() < k || Distance(offset, 0., 0., 0.) <= heap.front().distance )
+        Search(far, x, y, k, heap);
+}
+
+std::size_t KdTree::MemoryUsage() const noexcept
+{
+    return (m_X.capacity() + m_Y.capacity()) * sizeof(double) + m_Positions.capacity() * sizeof(int) +
+           m_Cells.capacity() * sizeof(Cell);
+}
+
+// Cells are written field by field, so that their padding doesn't end up in the file.
+void KdTree::Write( BinaryMap::Writer &writer ) const
+{
+    std::vector<double> splits;
+    std::vector<std::uint32_t> ranges;
+    std::vector<std::uint8_t> axes;
+    for( const auto &cell: m_Cells ) {
+        splits.push_back(cell.split);
+        ranges.insert(ranges.end(), {cell.begin, cell.end, cell.right});
+        axes.push_back(cell.axis);
+    }
+    writer.Array(m_X);
+    writer.Array(m_Y);
+    writer.Array(m_Positions);
+    writer.Array(std::move(splits));
+    writer.Array(std::move(ranges));
+    writer.Array(std::move(axes));
+}
+
+void KdTree::Read( BinaryMap::Reader::Cursor &cursor )
+{
+    std::vector<double> splits;
+    std::vector<std::uint32_t> ranges;
+    std::vector<std::uint8_t> axes;
+    *this = KdTree{};
+    cursor.Array(m_X);
+    cursor.Array(m_Y);
+    cursor.Array(m_Positions);
+    cursor.Array(splits);
+    cursor.Array(ranges);
+    cursor.Array(axes);
+
+    // Searches index by these without checking: a leaf must fit a query's distance buffer, and
+    // an inner cell's children must follow it.
+    auto check = [](bool valid) {
+        if( !valid )
+            throw std::logic_error("the compiled map file is corrupted");
+    };
+    const auto count = m_Positions.size();
+    check( m_X.size() == count && m_Y.size() == count && count <= (std::size_t)std::numeric_limits<int>::max() );
+    check( ranges.size() == 3 * splits.size() && axes.size() == splits.size() && splits.empty() == (count == 0) );
+    for( auto position: m_Positions )
+        check( position >= 0 && (std::size_t)position < count );
+    m_Cells.resize(splits.size());
+    for( std::size_t i = 0; i < m_Cells.size(); ++i ) {
+        auto &cell = m_Cells[i];
+        cell = {splits[i], ranges[3 * i], ranges[3 * i + 1], ranges[3 * i + 2], axes[i]};
+        check( cell.begin <= cell.end && cell.end <= count && cell.axis <= 1 );
+        check( cell.right == 0 ? cell.end - cell.begin <= kLeafSize : cell.right > i + 1 && cell.right < m_Cells.size() );
+    }
+}
@@ -0,0 +1,80 @@
+#pragma once
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "binary_map.h"
+
+// A static 2-d tree over points, for exact nearest-neighbor queries.
+//
+// Points are split at the median of the wider axis until at most kLeafSize remain, and each
+// leaf's coordinates are stored together, as x and y arrays, so that a leaf's distances are
+// one vectorized loop. Distances are rounded to float the way RouteModel::Node::distance()
+// rounds them, and equally distant points are ordered by their position in the input, so a
+// query answers exactly what a linear scan over the input keeping the first strict minimum
+// would.
+class KdTree
+{
+public:
+    struct Point {
+        double x;
+        double y;
+    };
+
+    KdTree() = default;
+    explicit KdTree( std::vector<Point> points );
+
+    std::size_t Size() const noexcept { return m_Positions.size(); }
+
+    // Position in the input of the point nearest to (x, y), or -1 if there are no points.
+    int Nearest( double x, double y ) const;
+
+    // Positions of the `k` points nearest to (x, y), nearest first.
+    std::vector<int> Nearest( double x, double y, std::size_t k ) const;
+
+    // Nearest() for `count` points at once, into `positions`.
+    void Nearest( const double *x, const double *y, std::size_t count, int *positions ) const;
+
+    std::size_t MemoryUsage() const noexcept;
+
+    void Write( BinaryMap::Writer &writer ) const;
+    // Throws std::logic_error if the arrays don't describe a tree over their points.
+    void Read( BinaryMap::Reader::Cursor &cursor );
+
+    static float Distance( double x0, double y0, double x1, double y1 ) noexcept
+    {
+        return std::sqrt(std::pow(x0 - x1, 2) + std::pow(y0 - y1, 2));
+    }
+
+private:
+    static constexpr std::uint32_t kLeafSize = 16;
+
+    // A leaf if `right` is 0; otherwise its left child follows it and points in the left
+    // child are at most `split` along `axis`, points in the right at least.
+    struct Cell {
+        double split;
+        std::uint32_t begin, end;
+        std::uint32_t right;
+        std::uint8_t axis;
+    };
+
+    // A candidate: distance, then position in the input.
+    struct Found {
+        float distance;
+        int position;
+        bool operator<( const Found &other ) const noexcept
+        {
+            return distance < other.distance || (distance == other.distance && position < other.position);
+        }
+    };
+
+    void Build( std::vector<Point> &points, std::uint32_t begin, std::uint32_t end );
+    void LeafDistances( const Cell &leaf, double x, double y, float *distances ) const noexcept;
+    void Search( std::uint32_t cell, double x, double y, Found &best ) const;
+    void Search( std::uint32_t cell, double x, double y, std::size_t k, std::vector<Found> &heap ) const;
+
+    std::vector<double> m_X, m_Y;       // in leaf order
+    std::vector<int> m_Positions;       // input position of each point
+    std::vector<Cell> m_Cells;
+};
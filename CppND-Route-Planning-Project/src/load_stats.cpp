@@ -0,0 +1,84 @@
+#include "load_stats.h"
+#include <cmath>
+#include <iomanip>
+
+void LoadStats::BeginPhase( std::string name )
+{
+    EndPhase();
+    m_Running = std::move(name);
+    m_Start = std::chrono::steady_clock::now();
+}
+
+void LoadStats::EndPhase()
+{
+    if( !m_Running )
+        return;
+    const auto elapsed = std::chrono::steady_clock::now() - m_Start;
+    phases.push_back({std::move(*m_Running), std::chrono::duration<double, std::milli>(elapsed).count()});
+    m_Running.reset();
+}
+
+void LoadStats::PrintTable( std::ostream &os ) const
+{
+    const auto flags = os.flags();
+    const auto precision = os.precision();
+    os << std::fixed << std::setprecision(2);
+
+    double total_ms = 0.;
+    os << std::left << std::setw(24) << "phase" << std::right << std::setw(14) << "ms" << "\n";
+    for( const auto &phase: phases ) {
+        os << std::left << std::setw(24) << phase.name << std::right << std::setw(14) << phase.milliseconds << "\n";
+        total_ms += phase.milliseconds;
+    }
+    os << std::left << std::setw(24) << "total" << std::right << std::setw(14) << total_ms << "\n\n";
+
+    std::size_t total_bytes = 0;
+    os << std::left << std::setw(24) << "container" << std::right << std::setw(14) << "count"
+       << std::setw(16) << "bytes" << "\n";
+    for( const auto &container: containers ) {
+        os << std::left << std::setw(24) << container.name << std::right << std::setw(14) << container.count
+           << std::setw(16) << container.bytes << "\n";
+        total_bytes += container.bytes;
+    }
+    os << std::left << std::setw(24) << "total" << std::right << std::setw(30) << total_bytes << "\n";
+
+    if( !counters.empty() ) {
+        os << "\n" << std::left << std::setw(24) << "counter" << std::right << std::setw(14) << "value" << "\n";
+        for( const auto &counter: counters )
+            os << std::left << std::setw(24) << counter.name << std::right << std::setw(14) << counter.value << "\n";
+    }
+
+    os.flags(flags);
+    os.precision(precision);
+}
+
+// Names are fixed identifiers, so they need no escaping. JSON has no infinities or NaNs;
+// such values are written as null.
+void LoadStats::PrintJson( std::ostream &os ) const
+{
+    const auto flags = os.flags();
+    const auto precision = os.precision();
+    os << std::fixed << std::setprecision(3);
+    auto number = [&os](double value) -> std::ostream & {
+        return std::isfinite(value) ? os << value : os << "null";
+    };
+
+    os << "{\"phases\": [";
+    for( std::size_t i = 0; i < phases.size(); ++i ) {
+        os << (i ? ", " : "") << "{\"name\": \"" << phases[i].name << "\", \"ms\": ";
+        number(phases[i].milliseconds) << "}";
+    }
+    os << "], \"containers\": [";
+    for( std::size_t i = 0; i < containers.size(); ++i )
+        os << (i ? ", " : "") << "{\"name\": \"" << containers[i].name << "\", \"count\": " << containers[i].count
+           << ", \"bytes\": " << containers[i].bytes << "}";
+    os << "], \"counters\": [";
+    for( std::size_t i = 0; i < counters.size(); ++i ) {
+        os << (i ? ", " : "") << "{\"name\": \"" << counters[i].name << "\", \"value\": ";
+        number(counters[i].value) << "}";
+    }
+    os << "]}\n";
+
+    os.flags(flags);
+    os.precision(precision);
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <optional>
+#include <ostream>
+#include <string>
+#include <vector>
+
+// Where loading a map spent its time, phase by phase, and what the loaded containers take.
+struct LoadStats {
+    struct Phase {
+        std::string name;
+        double milliseconds;
+    };
+
+    struct Container {
+        std::string name;
+        std::size_t count;      // elements
+        std::size_t bytes;      // heap memory, including what's allocated but unused
+    };
+
+    // Other figures of the load, such as what an index took per element.
+    struct Counter {
+        std::string name;
+        double value;
+    };
+
+    std::vector<Phase> phases;
+    std::vector<Container> containers;
+    std::vector<Counter> counters;
+
+    // Ends the running phase, if any, and starts timing the next one.
+    void BeginPhase( std::string name );
+    void EndPhase();
+
+    // Also counts capacity, not just size.
+    template <typename T>
+    void AddVector( std::string name, const std::vector<T> &v )
+    {
+        containers.push_back({std::move(name), v.size(), v.capacity() * sizeof(T)});
+    }
+
+    // An estimate: a bucket array plus one allocation of key, value and link per entry, plus
+    // `value_bytes` for what the values themselves own.
+    template <typename Map>
+    void AddHashMap( std::string name, const Map &map, std::size_t value_bytes = 0 )
+    {
+        const auto bytes = map.bucket_count() * sizeof(void *) +
+                           map.size() * (sizeof(typename Map::value_type) + sizeof(void *));
+        containers.push_back({std::move(name), map.size(), bytes + value_bytes});
+    }
+
+    void PrintTable( std::ostream &os ) const;
+    void PrintJson( std::ostream &os ) const;
+
+private:
+    std::optional<std::string> m_Running;
+    std::chrono::steady_clock::time_point m_Start;
+};
@@ -1,56 +1,113 @@
 #include <optional>
-#include <fstream>
 #include <iostream>
 #include <vector>
 #include <string>
 #include <io2d.h>
 #include <limits>
+#include <cstdio>
+#include <chrono>
+#include "mapped_file.h"
 #include "route_model.h"
 #include "render.h"
 #include "route_planner.h"
 
 using namespace std::experimental;
 
-static std::optional<std::vector<std::byte>> ReadFile(const std::string &path)
-{   
-    std::ifstream is{path, std::ios::binary | std::ios::ate};
-    if( !is )
-        return std::nullopt;
-    
-    auto size = is.tellg();
-    std::vector<std::byte> contents(size);    
-    
-    is.seekg(0);
-    is.read((char*)contents.data(), size);
-
-    if( contents.empty() )
-        return std::nullopt;
-    return std::move(contents);
-}
-
 int main(int argc, const char **argv)
 {    
     std::string osm_data_file = "";
+    std::string compiled_map_file = "";
+    std::string change_file = "";
+    std::string stats_format = "";
+    RouteModel::LoadOptions load_options;
+    auto snap = RoutePlanner::SnapTo::Node;
     if( argc > 1 ) {
         for( int i = 1; i < argc; ++i )
             if( std::string_view{argv[i]} == "-f" && ++i < argc )
                 osm_data_file = argv[i];
+            else if( std::string_view{argv[i]} == "-p" && ++i < argc )
+                load_options.parser = std::string_view{argv[i]} == "dom" ? RouteModel::LoadOptions::Parser::Dom
+                                                                         : RouteModel::LoadOptions::Parser::Stream;
+            else if( std::string_view{argv[i]} == "-m" && ++i < argc )
+                load_options.dom_memory = std::string_view{argv[i]} == "heap"      ? RouteModel::LoadOptions::DomMemory::Heap :
+                                          std::string_view{argv[i]} == "hugepages" ? RouteModel::LoadOptions::DomMemory::HugePages
+                                                                                   : RouteModel::LoadOptions::DomMemory::Arena;
+            else if( std::string_view{argv[i]} == "-c" && ++i < argc )
+                compiled_map_file = argv[i];
+            else if( std::string_view{argv[i]} == "-q" && ++i < argc )
+                load_options.precision = std::string_view{argv[i]} == "float"   ? CoordStore::Precision::Float :
+                                         std::string_view{argv[i]} == "fixed32" ? CoordStore::Precision::Fixed32
+                                                                                : CoordStore::Precision::Double;
+            else if( std::string_view{argv[i]} == "-b" && ++i < argc ) {
+                RouteModel::LoadOptions::BoundingBox bbox;
+                if( std::sscanf(argv[i], "%lf,%lf,%lf,%lf", &bbox.min_lat, &bbox.min_lon, &bbox.max_lat, &bbox.max_lon) == 4 )
+                    load_options.bbox = bbox;
+                else
+                    std::cout << "Ignoring the bounding box, expected minlat,minlon,maxlat,maxlon: " << argv[i] << std::endl;
+            }
+            else if( std::string_view{argv[i]} == "--stats" )
+                stats_format = i + 1 < argc && std::string_view{argv[i + 1]} == "json"  ? argv[++i] :
+                               i + 1 < argc && std::string_view{argv[i + 1]} == "table" ? argv[++i] : "table";
+            else if( std::string_view{argv[i]} == "-u" && ++i < argc )
+                change_file = argv[i];
+            else if( std::string_view{argv[i]} == "-l" && ++i < argc )
+                load_options.profile = std::string_view{argv[i]} == "routing" ? RouteModel::LoadOptions::Profile::Routing
+                                                                              : RouteModel::LoadOptions::Profile::Full;
+            else if( std::string_view{argv[i]} == "-s" && ++i < argc )
+                snap = std::string_view{argv[i]} == "segment" ? RoutePlanner::SnapTo::Segment : RoutePlanner::SnapTo::Node;
     }
     else {
         std::cout << "To specify a map file use the following format: " << std::endl;
-        std::cout << "Usage: [executable] [-f filename.osm]" << std::endl;
+        std::cout << "Usage: [executable] [-f filename.osm] [-p dom|stream] [-m arena|heap|hugepages] [-c compiled.map] [-q double|float|fixed32] [-l full|routing] [-u changes.osc] [-b minlat,minlon,maxlat,maxlon] [-s node|segment] [--stats [table|json]]" << std::endl;
         osm_data_file = "../map.osm";
     }
     
-    std::vector<std::byte> osm_data;
+    std::optional<MappedFile> osm_data;
+    double read_ms = 0.;
  
-    if( osm_data.empty() && !osm_data_file.empty() ) {
+    if( !osm_data_file.empty() ) {
         std::cout << "Reading OpenStreetMap data from the following file: " <<  osm_data_file << std::endl;
-        auto data = ReadFile(osm_data_file);
-        if( !data )
+        const auto read_start = std::chrono::steady_clock::now();
+        osm_data = MappedFile::Open(osm_data_file);
+        read_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - read_start).count();
+        if( !osm_data )
             std::cout << "Failed to read." << std::endl;
+    }
+
+    std::optional<MappedFile> change_data;
+    if( !change_file.empty() ) {
+        change_data = MappedFile::Open(change_file);
+        if( !change_data )
+            std::cout << "Failed to read the change file: " << change_file << std::endl;
+        load_options.updatable = true;
+    }
+    auto apply_changes = [&](RouteModel &model) {
+        if( change_data )
+            model.ApplyChange(change_data->Data(), change_data->Size());
+    };
+
+    // A memory-mapped file is only read as it is parsed, so "read" is just opening it then.
+    auto print_stats = [&](const RouteModel &model) {
+        if( stats_format.empty() )
+            return;
+        auto stats = model.GetLoadStats();
+        stats.phases.insert(stats.phases.begin(), {"read", read_ms});
+        if( stats_format == "json" )
+            stats.PrintJson(std::cout);
         else
-            osm_data = std::move(*data);
+            stats.PrintTable(std::cout);
+    };
+
+    // Compile the map for faster startup and exit; the compiled file can then be passed to -f.
+    if( !compiled_map_file.empty() ) {
+        RouteModel model{osm_data ? osm_data->Data() : nullptr, osm_data ? osm_data->Size() : 0, load_options};
+        apply_changes(model);
+        print_stats(model);
+        model.SaveBinary(compiled_map_file);
+        if( model.CoordinateError() > 0. )
+            std::cout << "Node positions are off by at most " << model.CoordinateError() << " meters." << std::endl;
+        std::cout << "Compiled map written to: " << compiled_map_file << std::endl;
+        return 0;
     }
     
     //Declare floats 'start_x', 'start_y', 'end_x', 'end_y'
@@ -105,16 +162,23 @@ int main(int argc, const char **argv)
     }
 
     // Build Model.
-    RouteModel model{osm_data};
+    RouteModel model{osm_data ? osm_data->Data() : nullptr, osm_data ? osm_data->Size() : 0, load_options};
+    apply_changes(model);
+    print_stats(model);
+    if( model.CoordinateError() > 0. )
+        std::cout << "Node positions are off by at most " << model.CoordinateError() << " meters." << std::endl;
 
     // Create RoutePlanner object and perform A* search.
-    RoutePlanner route_planner{model, start_x, start_y, end_x, end_y};
+    RoutePlanner route_planner{model, start_x, start_y, end_x, end_y, snap};
     route_planner.AStarSearch();
 
-    std::cout << "Distance: " << route_planner.GetDistance() << " meters. \n";
+    if( route_planner.GetPath().empty() )
+        std::cout << "No route connects the start and end points.\n";
+    else
+        std::cout << "Distance: " << route_planner.GetDistance() << " meters. \n";
 
     // Render results of search.
-    Render render{model};
+    Render render{model, route_planner.GetPath()};
 
     auto display = io2d::output_surface{400, 400, io2d::format::argb32, io2d::scaling::none, io2d::refresh_style::fixed, 30};
     display.size_change_callback([](io2d::output_surface& surface){
@@ -0,0 +1,86 @@
+#include "mapped_file.h"
+#include <fstream>
+#include <utility>
+
+#if !defined(_WIN32)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+std::optional<MappedFile> MappedFile::Open( const std::string &path )
+{
+    MappedFile file;
+
+#if !defined(_WIN32)
+    const auto fd = open(path.c_str(), O_RDONLY);
+    if( fd < 0 )
+        return std::nullopt;
+
+    struct stat st;
+    if( fstat(fd, &st) == 0 && st.st_size > 0 ) {
+        if( auto addr = mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0); addr != MAP_FAILED ) {
+            // The parsers read the file once from start to end: ask for aggressive read-ahead.
+            madvise(addr, (size_t)st.st_size, MADV_SEQUENTIAL);
+            file.m_Data = static_cast<const std::byte *>(addr);
+            file.m_Size = (size_t)st.st_size;
+            file.m_Mapped = true;
+        }
+    }
+    close(fd);
+    if( file.m_Mapped )
+        return file;
+#endif
+
+    std::ifstream is{path, std::ios::binary | std::ios::ate};
+    if( !is )
+        return std::nullopt;
+
+    auto size = is.tellg();
+    if( size <= 0 )
+        return std::nullopt;
+    file.m_Buffer.resize((size_t)size);
+    is.seekg(0);
+    is.read((char*)file.m_Buffer.data(), size);
+
+    file.m_Data = file.m_Buffer.data();
+    file.m_Size = file.m_Buffer.size();
+    return file;
+}
+
+MappedFile::MappedFile( MappedFile &&other ) noexcept
+{
+    *this = std::move(other);
+}
+
+MappedFile &MappedFile::operator=( MappedFile &&other ) noexcept
+{
+    if( this != &other ) {
+        Release();
+        m_Buffer = std::move(other.m_Buffer);
+        m_Data = other.m_Mapped ? other.m_Data : m_Buffer.data();
+        m_Size = other.m_Size;
+        m_Mapped = std::exchange(other.m_Mapped, false);
+        other.m_Data = nullptr;
+        other.m_Size = 0;
+    }
+    return *this;
+}
+
+MappedFile::~MappedFile()
+{
+    Release();
+}
+
+void MappedFile::Release() noexcept
+{
+#if !defined(_WIN32)
+    if( m_Mapped )
+        munmap(const_cast<std::byte *>(m_Data), m_Size);
+#endif
+    m_Mapped = false;
+    m_Data = nullptr;
+    m_Size = 0;
+    m_Buffer.clear();
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <cstddef>
+#include <optional>
+#include <string>
+#include <vector>
+
+// Read-only view of a whole file. On POSIX systems the file is memory-mapped, so nothing
+// is copied and the kernel is told the mapping will be read front to back; elsewhere the
+// contents are read into a buffer.
+class MappedFile
+{
+public:
+    // Returns std::nullopt if the file can't be opened or is empty.
+    static std::optional<MappedFile> Open( const std::string &path );
+
+    MappedFile( MappedFile &&other ) noexcept;
+    MappedFile &operator=( MappedFile &&other ) noexcept;
+    MappedFile( const MappedFile & ) = delete;
+    MappedFile &operator=( const MappedFile & ) = delete;
+    ~MappedFile();
+
+    const std::byte *Data() const noexcept { return m_Data; }
+    std::size_t Size() const noexcept { return m_Size; }
+
+private:
+    MappedFile() = default;
+    void Release() noexcept;
+
+    const std::byte *m_Data = nullptr;
+    std::size_t m_Size = 0;
+    bool m_Mapped = false;
+    std::vector<std::byte> m_Buffer;
+};
@@ -1,277 +1,585 @@
 #include "model.h"
-#include "pugixml.hpp"
+#include "osm_parser.h"
+#include "osm_pbf.h"
+#include "id_index.h"
+#include "parallel.h"
+#include "projection.h"
+#include "ring_assembly.h"
+#include "osm_tags.h"
+#include "xml_arena.h"
 #include <iostream>
+#include <chrono>
+#include <unordered_map>
 #include <string_view>
 #include <cmath>
 #include <algorithm>
+#include <memory>
+#include <numeric>
+#include <optional>
+#include <stdexcept>
+#include <type_traits>
 #include <assert.h>
 
-static Model::Road::Type String2RoadType(std::string_view type)
+// Below this many bytes per thread, starting threads costs more than it saves.
+static constexpr std::size_t kMinParallelChunk = 1 << 20;
+// Likewise for nodes to project.
+static constexpr std::size_t kMinProjectionChunk = 1 << 16;
+// Size of the tiles a bounding box is rounded out to.
+static constexpr double kTileDegrees = 0.05;
+// Ring assembly gives up on a multipolygon relation after this long; broken relations with
+// thousands of members shouldn't stall loading.
+static constexpr auto kRingAssemblyBudget = std::chrono::seconds(2);
+
+Model::Model( const std::vector<std::byte> &xml ) : Model(xml, LoadOptions{})
 {
-    if( type == "motorway" )        return Model::Road::Motorway;
-    if( type == "trunk" )           return Model::Road::Trunk;
-    if( type == "primary" )         return Model::Road::Primary;
-    if( type == "secondary" )       return Model::Road::Secondary;    
-    if( type == "tertiary" )        return Model::Road::Tertiary;
-    if( type == "residential" )     return Model::Road::Residential;
-    if( type == "living_street" )   return Model::Road::Residential;    
-    if( type == "service" )         return Model::Road::Service;
-    if( type == "unclassified" )    return Model::Road::Unclassified;
-    if( type == "footway" )         return Model::Road::Footway;
-    if( type == "bridleway" )       return Model::Road::Footway;
-    if( type == "steps" )           return Model::Road::Footway;
-    if( type == "path" )            return Model::Road::Footway;
-    if( type == "pedestrian" )      return Model::Road::Footway;    
-    return Model::Road::Invalid;    
 }
 
-static Model::Landuse::Type String2LanduseType(std::string_view type)
+Model::Model( const std::vector<std::byte> &xml, const LoadOptions &options ) : Model(xml.data(), xml.size(), options)
 {
-    if( type == "commercial" )      return Model::Landuse::Commercial;
-    if( type == "construction" )    return Model::Landuse::Construction;
-    if( type == "grass" )           return Model::Landuse::Grass;
-    if( type == "forest" )          return Model::Landuse::Forest;
-    if( type == "industrial" )      return Model::Landuse::Industrial;
-    if( type == "railway" )         return Model::Landuse::Railway;
-    if( type == "residential" )     return Model::Landuse::Residential;    
-    return Model::Landuse::Invalid;
 }
 
-Model::Model( const std::vector<std::byte> &xml )
+Model::Model( const std::byte *data, std::size_t size, const LoadOptions &options ) :
+    m_Profile(options.profile)
 {
-    LoadData(xml);
+    if( BinaryMap::Recognize(data, size) ) {
+        m_LoadStats.BeginPhase("compiled map");
+        LoadBinary(BinaryMap::Reader{data, size});
+        if( m_Nodes.GetPrecision() == CoordStore::Precision::Double )
+            m_Nodes.Quantize(options.precision);
+        m_LoadStats.EndPhase();
+        return;
+    }
+
+    if( options.updatable && options.precision != CoordStore::Precision::Double )
+        throw std::logic_error("updatable maps need double precision coordinates");
+    if( options.updatable && options.bbox )
+        throw std::logic_error("updatable maps can't be limited to a bounding box");
 
-    AdjustCoordinates();
+    // The parsers start the node, way and relation phases as they reach them; what comes
+    // before is reading the header or, with the Dom parser, building the document.
+    m_LoadStats.BeginPhase("parse");
+    LoadData(data, size, options);
+    m_WayPieces = {};
+
+    m_LoadStats.BeginPhase("projection");
+    AdjustCoordinates(options.threads);
+    m_LoadStats.BeginPhase("compaction");
+    // Only updatable maps keep the id indexes, but every load needs them while parsing.
+    m_LoadStats.counters.push_back({"node id bytes/node", m_NodeIds.BytesPerEntry()});
+    m_LoadStats.counters.push_back({"way id bytes/way", m_WayIds.BytesPerEntry()});
+    if( options.updatable ) {
+        m_NodeIds.Finalize();
+        m_WayIds.Finalize();
+    }
+    else {
+        m_NodeIds = {};
+        m_WayIds = {};
+        CompactNodes(options.node_order);
+    }
+    m_LoadStats.BeginPhase("quantization");
+    m_Nodes.Quantize(options.precision);
 
+    m_LoadStats.BeginPhase("road sort");
     std::sort(m_Roads.begin(), m_Roads.end(), [](const auto &_1st, const auto &_2nd){
         return (int)_1st.type < (int)_2nd.type; 
     });
+    m_LoadStats.EndPhase();
+
+    if( options.updatable ) {
+        m_Updatable = true;
+        m_WayRoads.assign(m_Ways.Size(), -1);
+        for( std::size_t i = 0; i < m_Roads.size(); ++i )
+            m_WayRoads[m_Roads[i].way] = (int)i;
+    }
 }
 
-void Model::LoadData(const std::vector<std::byte> &xml)
+// The bounding box widened by the margin and rounded out to whole tiles.
+static Model::LoadOptions::BoundingBox TiledArea( const Model::LoadOptions::BoundingBox &bbox, double margin )
 {
-    using namespace pugi;
-    
-    xml_document doc;
-    if( !doc.load_buffer(xml.data(), xml.size()) )
-        throw std::logic_error("failed to parse the xml file");
-    
-    if( auto bounds = doc.select_nodes("/osm/bounds"); !bounds.empty() ) {
-        auto node = bounds.first().node();
-        m_MinLat = atof(node.attribute("minlat").as_string());
-        m_MaxLat = atof(node.attribute("maxlat").as_string());
-        m_MinLon = atof(node.attribute("minlon").as_string());
-        m_MaxLon = atof(node.attribute("maxlon").as_string());
-    }
-    else 
-        throw std::logic_error("map's bounds are not defined");
+    constexpr auto meters_per_degree = 111320., deg_to_rad = 0.017453292519943295;
+    const auto lat_margin = margin / meters_per_degree;
+    // Degrees of longitude shrink towards the poles; widen by the most the box needs.
+    const auto widest_lat = std::min(89., std::max(std::abs(bbox.min_lat), std::abs(bbox.max_lat)) + lat_margin);
+    const auto lon_margin = margin / (meters_per_degree * std::cos(widest_lat * deg_to_rad));
+    auto down = [](double degrees) { return std::floor(degrees / kTileDegrees) * kTileDegrees; };
+    auto up = [](double degrees) { return std::ceil(degrees / kTileDegrees) * kTileDegrees; };
+    return {down(bbox.min_lat - lat_margin), down(bbox.min_lon - lon_margin),
+            up(bbox.max_lat + lat_margin), up(bbox.max_lon + lon_margin)};
+}
+
+// Turns parser events into the model's nodes, ways, roads and multipolygons.
+class Model::Builder : public OsmHandler
+{
+public:
+    // Only a builder fed the whole file in order can time its phases into `stats`.
+    Builder( Model &model, IdIndex &node_ids, IdIndex &way_ids, const LoadOptions &options,
+             LoadStats *stats = nullptr ) :
+        m_Model(model), m_NodeIdToNum(node_ids), m_WayIdToNum(way_ids), m_Stats(stats),
+        m_RoutingOnly(options.profile == LoadOptions::Profile::Routing),
+        m_KeepWayIds(!m_RoutingOnly || options.updatable)
+    {
+        if( options.bbox )
+            m_Area = TiledArea(*options.bbox, options.margin);
+    }
 
-    std::unordered_map<std::string, int> node_id_to_num;
-    for( const auto &node: doc.select_nodes("/osm/node") ) {
-        node_id_to_num[node.node().attribute("id").as_string()] = (int)m_Nodes.size();
-        m_Nodes.emplace_back();        
-        m_Nodes.back().y = atof(node.node().attribute("lat").as_string());
-        m_Nodes.back().x = atof(node.node().attribute("lon").as_string());
+    void Bounds( double min_lat, double min_lon, double max_lat, double max_lon ) override
+    {
+        if( m_Area ) {
+            min_lat = std::max(min_lat, m_Area->min_lat);
+            min_lon = std::max(min_lon, m_Area->min_lon);
+            max_lat = std::min(max_lat, m_Area->max_lat);
+            max_lon = std::min(max_lon, m_Area->max_lon);
+            if( min_lat >= max_lat || min_lon >= max_lon )
+                throw std::logic_error("the bounding box is outside the map");
+        }
+        m_Model.m_MinLat = min_lat;
+        m_Model.m_MinLon = min_lon;
+        m_Model.m_MaxLat = max_lat;
+        m_Model.m_MaxLon = max_lon;
     }
 
-    std::unordered_map<std::string, int> way_id_to_num;    
-    for( const auto &way: doc.select_nodes("/osm/way") ) {
-        auto node = way.node();
-        
-        const auto way_num = (int)m_Ways.size();
-        way_id_to_num[node.attribute("id").as_string()] = way_num;
-        m_Ways.emplace_back();
-        auto &new_way = m_Ways.back();
-        
-        for( auto child: node.children() ) {
-            auto name = std::string_view{child.name()}; 
-            if( name == "nd" ) {
-                auto ref = child.attribute("ref").as_string();
-                if( auto it = node_id_to_num.find(ref); it != end(node_id_to_num) )
-                    new_way.nodes.emplace_back(it->second);
-            }
-            else if( name == "tag" ) {
-                auto category = std::string_view{child.attribute("k").as_string()};
-                auto type = std::string_view{child.attribute("v").as_string()};
-                if( category == "highway" ) {
-                    if( auto road_type = String2RoadType(type); road_type != Road::Invalid ) {
-                        m_Roads.emplace_back();
-                        m_Roads.back().way = way_num;
-                        m_Roads.back().type = road_type;
-                    }
-                }
-                if( category == "railway" ) {
-                    m_Railways.emplace_back();
-                    m_Railways.back().way = way_num;
-                }                
-                else if( category == "building" ) {
-                    m_Buildings.emplace_back();
-                    m_Buildings.back().outer = {way_num};
-                }
-                else if( category == "leisure" ||
-                        (category == "natural" && (type == "wood"  || type == "tree_row" || type == "scrub" || type == "grassland")) ||
-                        (category == "landcover" && type == "grass" ) ) {
-                    m_Leisures.emplace_back();
-                    m_Leisures.back().outer = {way_num};
+    void Node( std::int64_t id, double lat, double lon ) override
+    {
+        if( m_Area && (lat < m_Area->min_lat || lat > m_Area->max_lat ||
+                       lon < m_Area->min_lon || lon > m_Area->max_lon) )
+            return;
+        EnterPass(Pass::Nodes);
+        m_NodeIdToNum.Add(id, (int)m_Model.m_Nodes.Size());
+        m_Model.m_Nodes.Add(lon, lat);
+    }
+
+    void BeginWay( std::int64_t id ) override
+    {
+        EnterPass(Pass::Ways);
+        m_NodeIdToNum.Finalize();
+        m_WayNum = (int)m_Model.m_Ways.Size();
+        m_WayId = id;
+        m_Model.m_Ways.AddRow();
+        m_WayPieces = 1;
+        m_WayGap = false;
+        m_Parent = Parent::Way;
+        m_WayUsed = !m_RoutingOnly;
+    }
+
+    // A way that leaves the area and comes back is split into one row per run of nodes
+    // inside it, rather than joined straight across the part that wasn't loaded. Without an
+    // area, nodes missing from the file are skipped as they always were.
+    void WayNode( std::int64_t ref ) override
+    {
+        const auto num = m_NodeIdToNum.Find(ref);
+        if( num < 0 ) {
+            m_WayGap = m_Area && !m_Model.m_Ways[m_Model.m_Ways.Size() - 1].empty();
+            return;
+        }
+        if( m_WayGap ) {
+            m_Model.m_Ways.AddRow();
+            ++m_WayPieces;
+            m_WayGap = false;
+        }
+        m_Model.m_Ways.Push(num);
+    }
+
+    void EndWay() override
+    {
+        // Tags follow the node list, so an unused way is only known once it's complete.
+        if( !m_WayUsed || (m_Area && m_Model.m_Ways[m_WayNum].empty()) ) {
+            for( int i = 0; i < m_WayPieces; ++i )
+                m_Model.m_Ways.PopRow();
+        }
+        else {
+            // Without relations nothing looks ways up by id, unless the model is updatable.
+            if( m_KeepWayIds )
+                m_WayIdToNum.Add(m_WayId, m_WayNum);
+            if( m_WayPieces > 1 )
+                m_Model.m_WayPieces[m_WayNum] = m_WayPieces;
+        }
+        m_Parent = Parent::None;
+    }
+
+    void BeginRelation( std::int64_t ) override
+    {
+        EnterPass(Pass::Relations);
+        m_WayIdToNum.Finalize();
+        m_Outer.clear();
+        m_Inner.clear();
+        m_Parent = Parent::Relation;
+        m_RelationDone = false;
+    }
+
+    void Member( std::string_view type, std::int64_t ref, std::string_view role ) override
+    {
+        if( m_RelationDone || m_RoutingOnly || type != "way" )
+            return;
+        const auto num = m_WayIdToNum.Find(ref);
+        if( num < 0 )
+            return;
+        const auto pieces = m_Model.m_WayPieces.find(num);
+        const auto count = pieces == m_Model.m_WayPieces.end() ? 1 : pieces->second;
+        for( int i = 0; i < count; ++i )
+            (role == "outer" ? m_Outer : m_Inner).emplace_back(num + i);
+    }
+
+    void EndRelation() override
+    {
+        m_Parent = Parent::None;
+    }
+
+    void Tag( std::string_view key, std::string_view value ) override
+    {
+        if( m_Parent == Parent::Way )
+            WayTag(key, value);
+        else if( m_Parent == Parent::Relation && !m_RelationDone && !m_RoutingOnly )
+            RelationTag(key, value);
+    }
+
+private:
+    enum class Parent { None, Way, Relation };
+    enum class Pass { None, Nodes, Ways, Relations };
+
+    void EnterPass( Pass pass )
+    {
+        if( !m_Stats || pass == m_Pass )
+            return;
+        m_Pass = pass;
+        m_Stats->BeginPhase(pass == Pass::Nodes ? "nodes" : pass == Pass::Ways ? "ways" : "relations");
+    }
+
+    void WayTag( std::string_view category, std::string_view type )
+    {
+        auto &m = m_Model;
+        const auto tag = kTags.Find(category, type);
+        if( !tag || (m_Area && m.m_Ways[m_WayNum].empty()) )
+            return;
+        if( m_RoutingOnly ) {
+            if( tag->kind != TagClass::Road || tag->type == Road::Footway )
+                return;
+            m_WayUsed = true;
+        }
+        // Every piece of a way split at the area's edge is a road or railway of its own, and
+        // an outer ring of an area.
+        const auto first = m_WayNum, end = m_WayNum + m_WayPieces;
+        auto pieces = [&] {
+            std::vector<int> rows(m_WayPieces);
+            std::iota(rows.begin(), rows.end(), first);
+            return rows;
+        };
+        switch( tag->kind ) {
+            case TagClass::Road:
+                for( auto way_num = first; way_num < end; ++way_num ) {
+                    m.m_Roads.emplace_back();
+                    m.m_Roads.back().way = way_num;
+                    m.m_Roads.back().type = (Road::Type)tag->type;
                 }
-                else if( category == "natural" && type == "water" ) {
-                    m_Waters.emplace_back();
-                    m_Waters.back().outer = {way_num};
+                break;
+            case TagClass::Railway:
+                for( auto way_num = first; way_num < end; ++way_num ) {
+                    m.m_Railways.emplace_back();
+                    m.m_Railways.back().way = way_num;
                 }
-                else if( category == "landuse" ) {
-                    if( auto landuse_type = String2LanduseType(type); landuse_type != Landuse::Invalid ) {
-                        m_Landuses.emplace_back();
-                        m_Landuses.back().outer = {way_num};
-                        m_Landuses.back().type = landuse_type;
-                    }                    
+                break;
+            case TagClass::Building:
+                m.m_Buildings.emplace_back();
+                m.m_Buildings.back().outer = pieces();
+                break;
+            case TagClass::Leisure:
+                m.m_Leisures.emplace_back();
+                m.m_Leisures.back().outer = pieces();
+                break;
+            case TagClass::Water:
+                m.m_Waters.emplace_back();
+                m.m_Waters.back().outer = pieces();
+                break;
+            case TagClass::Landuse:
+                if( tag->type != Landuse::Invalid ) {
+                    m.m_Landuses.emplace_back();
+                    m.m_Landuses.back().outer = pieces();
+                    m.m_Landuses.back().type = (Landuse::Type)tag->type;
                 }
-            }
+                break;
         }
     }
-    
-    for( const auto &relation: doc.select_nodes("/osm/relation") ) {
-        auto node = relation.node();
-        auto noode_id = std::string_view{node.attribute("id").as_string()};
-        std::vector<int> outer, inner;
+
+    // The first tag that classifies the relation commits the members seen so far.
+    void RelationTag( std::string_view category, std::string_view type )
+    {
+        auto &m = m_Model;
         auto commit = [&](Multipolygon &mp) {
-            mp.outer = std::move(outer);
-            mp.inner = std::move(inner);
+            mp.outer = std::move(m_Outer);
+            mp.inner = std::move(m_Inner);
+            m_RelationDone = true;
         };
-        for( auto child: node.children() ) {
-            auto name = std::string_view{child.name()}; 
-            if( name == "member" ) {
-                if( std::string_view{child.attribute("type").as_string()} == "way" ) {
-                    if( !way_id_to_num.count(child.attribute("ref").as_string()) )
-                        continue;
-                    auto way_num = way_id_to_num[child.attribute("ref").as_string()];
-                    if( std::string_view{child.attribute("role").as_string()} == "outer" )
-                        outer.emplace_back(way_num);
-                    else
-                        inner.emplace_back(way_num);
-                }
+        const auto tag = kTags.Find(category, type);
+        if( !tag )
+            return;
+        if( tag->kind == TagClass::Building ) {
+            commit( m.m_Buildings.emplace_back() );
+        }
+        else if( tag->kind == TagClass::Water ) {
+            commit( m.m_Waters.emplace_back() );
+            m.BuildRings(m.m_Waters.back());
+        }
+        else if( tag->kind == TagClass::Landuse ) {
+            if( tag->type != Landuse::Invalid ) {
+                commit( m.m_Landuses.emplace_back() );
+                m.m_Landuses.back().type = (Landuse::Type)tag->type;
+                m.BuildRings(m.m_Landuses.back());
             }
-            else if( name == "tag" ) { 
-                auto category = std::string_view{child.attribute("k").as_string()};
-                auto type = std::string_view{child.attribute("v").as_string()};
-                if( category == "building" ) {
-                    commit( m_Buildings.emplace_back() );
-                    break;
-                }
-                if( category == "natural" && type == "water" ) {
-                    commit( m_Waters.emplace_back() );
-                    BuildRings(m_Waters.back());
-                    break;
-                }
-                if( category == "landuse" ) {
-                    if( auto landuse_type = String2LanduseType(type); landuse_type != Landuse::Invalid ) {
-                        commit( m_Landuses.emplace_back() );
-                        m_Landuses.back().type = landuse_type;
-                        BuildRings(m_Landuses.back());
-                    }
-                    break;
-                }
+            m_RelationDone = true;
+        }
+    }
+
+    Model &m_Model;
+    IdIndex &m_NodeIdToNum;
+    IdIndex &m_WayIdToNum;
+    LoadStats *m_Stats;
+    Pass m_Pass = Pass::None;
+    Parent m_Parent = Parent::None;
+    int m_WayNum = -1;
+    std::vector<int> m_Outer, m_Inner;
+    bool m_RelationDone = false;
+    const bool m_RoutingOnly;
+    const bool m_KeepWayIds;
+    std::optional<LoadOptions::BoundingBox> m_Area;
+    std::int64_t m_WayId = 0;
+    int m_WayPieces = 1;
+    bool m_WayGap = false;
+    bool m_WayUsed = true;
+};
+
+void Model::LoadData(const std::byte *data, std::size_t size, const LoadOptions &options)
+{
+    if( IsOsmPbf(data, size) ) {
+        Builder builder{*this, m_NodeIds, m_WayIds, options, &m_LoadStats};
+        ParseOsmPbf(data, size, builder, options.threads);
+        return;
+    }
+
+    if( options.parser == LoadOptions::Parser::Stream ) {
+        const auto threads = std::min(WorkerCount(options.threads), size / kMinParallelChunk);
+        if( threads > 1 )
+            if( auto sections = FindOsmSections(data, size) ) {
+                LoadDataParallel(data, *sections, options, threads);
+                return;
             }
+    }
+
+    Builder builder{*this, m_NodeIds, m_WayIds, options, &m_LoadStats};
+    if( options.parser == LoadOptions::Parser::Dom ) {
+        // Counted with or without an arena, so that the two can be compared.
+        XmlArena::Install();
+        const auto before = XmlArena::Totals();
+        {
+            std::optional<XmlArena> arena;
+            if( options.dom_memory != LoadOptions::DomMemory::Heap )
+                arena.emplace(size, options.dom_memory == LoadOptions::DomMemory::HugePages);
+            ParseOsmDom(data, size, builder);
         }
+        const auto after = XmlArena::Totals();
+        m_LoadStats.counters.push_back({"xml allocations", (double)(after.allocations - before.allocations)});
+        m_LoadStats.counters.push_back({"xml system allocations",
+                                        (double)(after.system_allocations - before.system_allocations)});
+        m_LoadStats.counters.push_back({"xml bytes", (double)(after.bytes - before.bytes)});
     }
+    else
+        ParseOsmStream(data, size, builder);
 }
 
-void Model::AdjustCoordinates()
-{    
-    const auto pi = 3.14159265358979323846264338327950288;
-    const auto deg_to_rad = 2. * pi / 360.;
-    const auto earth_radius = 6378137.;
-    const auto lat2ym = [&](double lat) { return log(tan(lat * deg_to_rad / 2 +  pi/4)) / 2 * earth_radius; };
-    const auto lon2xm = [&](double lon) { return lon * deg_to_rad / 2 * earth_radius; };     
-    const auto dx = lon2xm(m_MaxLon) - lon2xm(m_MinLon);
-    const auto dy = lat2ym(m_MaxLat) - lat2ym(m_MinLat);
-    const auto min_y = lat2ym(m_MinLat);
-    const auto min_x = lon2xm(m_MinLon);
-    m_MetricScale = std::min(dx, dy);
-    for( auto &node: m_Nodes ) {
-        node.x = (lon2xm(node.x) - min_x) / m_MetricScale;
-        node.y = (lat2ym(node.y) - min_y) / m_MetricScale;        
+// Nodes and ways are split into chunks that are parsed on separate threads into partial
+// models, which are then appended in file order so elements get the same numbers as with
+// a sequential parse.
+void Model::LoadDataParallel(const std::byte *data, const OsmSections &sections, const LoadOptions &options,
+                             std::size_t threads)
+{
+    auto &node_ids = m_NodeIds, &way_ids = m_WayIds;
+    Builder builder{*this, node_ids, way_ids, options, &m_LoadStats};
+    if( !ParseOsmFragment(data, sections.nodes, builder) )
+        throw std::logic_error("map's bounds are not defined");
+
+    auto parse_chunks = [&](std::size_t begin, std::size_t end, std::string_view element, auto &&make_builder) {
+        const auto bounds = SplitOsmSection(data, begin, end, element, threads);
+        std::vector<std::unique_ptr<Model>> parts;
+        std::vector<IdIndex> ids(bounds.size() - 1);
+        for( std::size_t i = 0; i + 1 < bounds.size(); ++i )
+            parts.emplace_back(new Model);
+        RunInParallel(parts.size(), [&](std::size_t i) {
+            auto part_builder = make_builder(*parts[i], ids[i]);
+            ParseOsmFragment(data + bounds[i], bounds[i + 1] - bounds[i], part_builder);
+        });
+        return std::make_pair(std::move(parts), std::move(ids));
+    };
+
+    // Chunks finish in any order: time the passes as a whole.
+    m_LoadStats.BeginPhase("nodes");
+    IdIndex unused;
+    auto [node_parts, node_part_ids] = parse_chunks(sections.nodes, sections.ways, "node", [&](Model &part, IdIndex &ids) {
+        return Builder{part, ids, unused, options};
+    });
+    for( std::size_t i = 0; i < node_parts.size(); ++i ) {
+        node_ids.Append(node_part_ids[i], (int)m_Nodes.Size());
+        Append(std::move(*node_parts[i]));
+    }
+    node_parts.clear();
+    node_ids.Finalize();
+
+    // From here on the node index is only read, so the way chunks can share it.
+    m_LoadStats.BeginPhase("ways");
+    auto [way_parts, way_part_ids] = parse_chunks(sections.ways, sections.relations, "way", [&](Model &part, IdIndex &ids) {
+        return Builder{part, node_ids, ids, options};
+    });
+    for( std::size_t i = 0; i < way_parts.size(); ++i ) {
+        way_ids.Append(way_part_ids[i], (int)m_Ways.Size());
+        Append(std::move(*way_parts[i]));
     }
+    way_parts.clear();
+
+    // Relations are few and their rings are built from ways of any chunk: parse them here.
+    if( m_Profile != LoadOptions::Profile::Routing )
+        ParseOsmFragment(data + sections.relations, sections.end - sections.relations, builder);
 }
 
-static bool TrackRec(const std::vector<int> &open_ways,
-                     const Model::Way *ways,
-                     std::vector<bool> &used,
-                     std::vector<int> &nodes) 
+// Moves a partial model's elements to the end of this one. Way numbers are shifted;
+// node numbers are not, since parts resolve their ways against the full node index.
+void Model::Append( Model &&part )
 {
-    if( nodes.empty() ) {
-        for( int i = 0; i < open_ways.size(); ++i )
-            if( !used[i] ) {
-                used[i] = true;
-                const auto &way_nodes = ways[open_ways[i]].nodes;
-                nodes = way_nodes;
-                if( TrackRec(open_ways, ways, used, nodes) )
-                    return true;
-                nodes.clear();
-                used[i] = false;
-            }
-        return false;
+    const auto way_offset = (int)m_Ways.Size();
+    auto shift = [&](Multipolygon &mp) {
+        for( auto &way: mp.outer )
+            way += way_offset;
+        for( auto &way: mp.inner )
+            way += way_offset;
+    };
+
+    m_Nodes.Append(part.m_Nodes);
+    m_Ways.Append(part.m_Ways);
+    for( auto [way, pieces]: part.m_WayPieces )
+        m_WayPieces[way + way_offset] = pieces;
+    for( auto road: part.m_Roads ) {
+        road.way += way_offset;
+        m_Roads.emplace_back(road);
     }
-    else {
-        const auto head = nodes.front();
-        const auto tail = nodes.back();
-        if( head == tail && nodes.size() > 1 )
-            return true;
-        for( int i = 0; i < open_ways.size(); ++i )
-            if( !used[i] ) {
-                const auto &way_nodes = ways[open_ways[i]].nodes;
-                const auto way_head = way_nodes.front();
-                const auto way_tail = way_nodes.back();
-                if( way_head == tail || way_tail == tail ) {
-                    used[i] = true;
-                    const auto len = nodes.size();
-                    if( way_head == tail ) 
-                        nodes.insert(nodes.end(), way_nodes.begin(), way_nodes.end());
-                    else
-                        nodes.insert(nodes.end(), way_nodes.rbegin(), way_nodes.rend());
-                    if( TrackRec(open_ways, ways, used, nodes) )
-                        return true;
-                    nodes.resize(len);                    
-                    used[i] = false;
-                }
+    for( auto railway: part.m_Railways ) {
+        railway.way += way_offset;
+        m_Railways.emplace_back(railway);
+    }
+    auto append = [&](auto &to, auto &from) {
+        for( auto &mp: from ) {
+            shift(mp);
+            to.emplace_back(std::move(mp));
+        }
+    };
+    append(m_Buildings, part.m_Buildings);
+    append(m_Leisures, part.m_Leisures);
+    append(m_Waters, part.m_Waters);
+    append(m_Landuses, part.m_Landuses);
+}
+
+void Model::AdjustCoordinates( std::size_t threads )
+{    
+    const auto dx = MercatorX(m_MaxLon) - MercatorX(m_MinLon);
+    const auto dy = MercatorY(m_MaxLat) - MercatorY(m_MinLat);
+    const auto min_y = MercatorY(m_MinLat);
+    const auto min_x = MercatorX(m_MinLon);
+    m_MetricScale = std::min(dx, dy);
+
+    const auto xs = m_Nodes.MutableX(), ys = m_Nodes.MutableY();
+    const auto count = m_Nodes.Size();
+    const auto chunks = std::max<std::size_t>(1, std::min(WorkerCount(threads), count / kMinProjectionChunk));
+    RunInParallel(chunks, [&](std::size_t chunk) {
+        const auto begin = count * chunk / chunks, end = count * (chunk + 1) / chunks;
+        MercatorYBatch(ys + begin, end - begin);
+        for( auto i = begin; i < end; ++i ) {
+            xs[i] = (MercatorX(xs[i]) - min_x) / m_MetricScale;
+            ys[i] = (ys[i] - min_y) / m_MetricScale;
+        }
+    });
+}
+
+// Position of cell (x, y) of a 2^16 x 2^16 grid along the Hilbert curve that fills it.
+static std::uint32_t HilbertIndex( std::uint32_t x, std::uint32_t y ) noexcept
+{
+    std::uint32_t index = 0;
+    for( std::uint32_t s = 1u << 15; s > 0; s /= 2 ) {
+        const auto rx = (x & s) ? 1u : 0u;
+        const auto ry = (y & s) ? 1u : 0u;
+        index += s * s * ((3 * rx) ^ ry);
+        if( ry == 0 ) {
+            if( rx == 1 ) {
+                x = s - 1 - x;
+                y = s - 1 - y;
             }
-        return false;
+            std::swap(x, y);
+        }
     }
+    return index;
 }
 
-static std::vector<int> Track(std::vector<int> &open_ways, const Model::Way *ways)
+// Drops the nodes no way refers to, such as points of interest and the nodes of ways the
+// profile skipped, and numbers the rest densely, either in file order or along a Hilbert
+// curve over the kept nodes' extent.
+void Model::CompactNodes( LoadOptions::NodeOrder order )
 {
-    assert( !open_ways.empty() );
-    std::vector<bool> used(open_ways.size(), false);
-    std::vector<int> nodes;    
-    if( TrackRec(open_ways, ways, used, nodes) )
-        for( int i = 0; i < open_ways.size(); ++i )
-            if( used[i] )
-                open_ways[i] = -1;
-    return nodes;
+    const auto count = m_Nodes.Size();
+    std::vector<bool> referenced(count, false);
+    for( auto node: m_Ways.Values() )
+        referenced[node] = true;
+
+    std::vector<int> kept;
+    for( std::size_t i = 0; i < count; ++i )
+        if( referenced[i] )
+            kept.emplace_back((int)i);
+
+    if( order == LoadOptions::NodeOrder::Hilbert && !kept.empty() ) {
+        double min_x = m_Nodes.X(kept[0]), max_x = min_x, min_y = m_Nodes.Y(kept[0]), max_y = min_y;
+        for( auto i: kept ) {
+            min_x = std::min(min_x, m_Nodes.X(i));
+            max_x = std::max(max_x, m_Nodes.X(i));
+            min_y = std::min(min_y, m_Nodes.Y(i));
+            max_y = std::max(max_y, m_Nodes.Y(i));
+        }
+        const auto cells = 65535.;
+        const auto scale_x = max_x > min_x ? cells / (max_x - min_x) : 0.;
+        const auto scale_y = max_y > min_y ? cells / (max_y - min_y) : 0.;
+        // The key in the high half and the file position in the low one keep the sort stable.
+        std::vector<std::uint64_t> keys(kept.size());
+        for( std::size_t i = 0; i < kept.size(); ++i ) {
+            const auto x = (std::uint32_t)((m_Nodes.X(kept[i]) - min_x) * scale_x);
+            const auto y = (std::uint32_t)((m_Nodes.Y(kept[i]) - min_y) * scale_y);
+            keys[i] = (std::uint64_t)HilbertIndex(x, y) << 32 | (std::uint32_t)kept[i];
+        }
+        std::sort(keys.begin(), keys.end());
+        for( std::size_t i = 0; i < kept.size(); ++i )
+            kept[i] = (int)(std::uint32_t)keys[i];
+    }
+
+    if( kept.size() == count && order == LoadOptions::NodeOrder::File )
+        return;
+
+    std::vector<int> renumbered(count, -1);
+    for( std::size_t i = 0; i < kept.size(); ++i )
+        renumbered[kept[i]] = (int)i;
+    auto [offsets, values] = std::move(m_Ways).Release();
+    for( auto &node: values )
+        node = renumbered[node];
+    m_Ways = Csr<int>{std::move(offsets), std::move(values)};
+    m_Nodes.Select(kept);
 }
 
 void Model::BuildRings( Multipolygon &mp )
 {
-    auto is_closed = []( const Model::Way &way ) {
-        return way.nodes.size() > 1 && way.nodes.front() == way.nodes.back();    
+    auto is_closed = []( Span<int> nodes ) {
+        return nodes.size() > 1 && nodes.front() == nodes.back();    
     };
 
+    const auto deadline = std::chrono::steady_clock::now() + kRingAssemblyBudget;
     auto process = [&]( std::vector<int> &ways_nums ) {
-        auto ways = m_Ways.data();
         std::vector<int> closed, open;
         
         for( auto &way_num: ways_nums )
-            (is_closed(ways[way_num]) ? closed : open).emplace_back(way_num);  
+            (is_closed(m_Ways[way_num]) ? closed : open).emplace_back(way_num);  
         
-        while( !open.empty() ) {            
-            auto new_nodes = Track(open, ways);
-            if( new_nodes.empty() )
-                break;
-            open.erase(std::remove_if(open.begin(), open.end(), [](auto v){return v < 0;}), open.end() );
-            closed.emplace_back( (int)m_Ways.size() );
-            Model::Way new_way;
-            new_way.nodes = std::move(new_nodes);
-            m_Ways.emplace_back(new_way);
+        for( auto &ring: AssembleRings(m_Ways, open, deadline) ) {
+            closed.emplace_back( (int)m_Ways.Size() );
+            m_Ways.AddRow(ring.begin(), ring.end());
         }        
         std::swap(ways_nums, closed);        
     };
@@ -279,3 +587,331 @@ void Model::BuildRings( Multipolygon &mp )
     process(mp.outer);
     process(mp.inner);
 }
+
+static int FindId( const IdIndex &index, const std::unordered_map<std::int64_t, int> &changes, std::int64_t id )
+{
+    if( auto it = changes.find(id); it != changes.end() )
+        return it->second;
+    return index.Find(id);
+}
+
+// Applies the elements of a change file as they are parsed. Created and modified elements
+// are handled alike: whatever the id refers to now is replaced.
+class Model::Updater : public OsmHandler
+{
+public:
+    explicit Updater( Model &model ) :
+        m_Model(model), m_MinX(MercatorX(model.m_MinLon)), m_MinY(MercatorY(model.m_MinLat)) {}
+
+    void Action( OsmAction action ) override
+    {
+        m_Action = action;
+    }
+
+    void Bounds( double, double, double, double ) override {}
+
+    // A deleted node keeps its coordinates for the ways still using it until they change too.
+    void Node( std::int64_t id, double lat, double lon ) override
+    {
+        auto &m = m_Model;
+        if( m_Action == OsmAction::Delete ) {
+            m.m_NodeIdChanges[id] = -1;
+            return;
+        }
+        const auto x = (MercatorX(lon) - m_MinX) / m.m_MetricScale;
+        const auto y = (MercatorY(lat) - m_MinY) / m.m_MetricScale;
+        auto num = FindId(m.m_NodeIds, m.m_NodeIdChanges, id);
+        if( num < 0 ) {
+            num = (int)m.m_Nodes.Size();
+            m.m_Nodes.Add(x, y);
+            m.m_NodeIdChanges[id] = num;
+        }
+        else {
+            m.m_Nodes.MutableX()[num] = x;
+            m.m_Nodes.MutableY()[num] = y;
+        }
+        m.OnNodeChanged(num);
+    }
+
+    void BeginWay( std::int64_t id ) override
+    {
+        m_WayId = id;
+        m_WayNodes.clear();
+        m_RoadType = Road::Invalid;
+        m_InWay = true;
+    }
+
+    void WayNode( std::int64_t ref ) override
+    {
+        if( auto num = FindId(m_Model.m_NodeIds, m_Model.m_NodeIdChanges, ref); num >= 0 )
+            m_WayNodes.emplace_back(num);
+    }
+
+    void Tag( std::string_view key, std::string_view value ) override
+    {
+        if( !m_InWay || m_RoadType != Road::Invalid )
+            return;
+        if( const auto tag = kTags.Find(key, value); tag && tag->kind == TagClass::Road )
+            m_RoadType = (Road::Type)tag->type;
+        if( m_RoadType == Road::Footway && m_Model.m_Profile == LoadOptions::Profile::Routing )
+            m_RoadType = Road::Invalid;
+    }
+
+    void EndWay() override
+    {
+        auto &m = m_Model;
+        m_InWay = false;
+        const auto old_way = FindId(m.m_WayIds, m.m_WayIdChanges, m_WayId);
+        auto road = old_way >= 0 ? m.m_WayRoads[old_way] : -1;
+        const auto was_road = road >= 0;
+
+        // Routing models only keep the ways of roads.
+        auto way = -1;
+        if( m_Action != OsmAction::Delete &&
+            (m_RoadType != Road::Invalid || m.m_Profile != LoadOptions::Profile::Routing) ) {
+            way = (int)m.m_Ways.Size();
+            m.m_Ways.AddRow(m_WayNodes.begin(), m_WayNodes.end());
+            m.m_WayRoads.emplace_back(-1);
+        }
+        m.m_WayIdChanges[m_WayId] = way;
+        if( way < 0 )
+            m_RoadType = Road::Invalid;
+
+        if( !was_road && m_RoadType == Road::Invalid )
+            return;
+        if( !was_road ) {
+            road = (int)m.m_Roads.size();
+            m.m_Roads.emplace_back();
+        }
+        else
+            m.m_WayRoads[old_way] = -1;
+        if( m_RoadType != Road::Invalid ) {
+            m.m_Roads[road].way = way;
+            m.m_WayRoads[way] = road;
+        }
+        m.m_Roads[road].type = m_RoadType;
+        m.OnRoadChanged(road, was_road ? old_way : -1);
+    }
+
+    void BeginRelation( std::int64_t ) override {}
+    void Member( std::string_view, std::int64_t, std::string_view ) override {}
+    void EndRelation() override {}
+
+private:
+    Model &m_Model;
+    const double m_MinX, m_MinY;
+    OsmAction m_Action = OsmAction::Modify;
+    std::int64_t m_WayId = 0;
+    std::vector<int> m_WayNodes;
+    Road::Type m_RoadType = Road::Invalid;
+    bool m_InWay = false;
+};
+
+void Model::ApplyChange( const std::byte *data, std::size_t size )
+{
+    if( !m_Updatable )
+        throw std::logic_error("the map was not loaded as updatable");
+    m_LoadStats.BeginPhase("change");
+    Updater updater{*this};
+    try {
+        ParseOsmChange(data, size, updater);
+    }
+    catch( ... ) {
+        OnChangeApplied();
+        m_LoadStats.EndPhase();
+        throw;
+    }
+    OnChangeApplied();
+    m_LoadStats.EndPhase();
+}
+
+LoadStats Model::GetLoadStats() const
+{
+    auto stats = m_LoadStats;
+    AddMemoryUsage(stats);
+    return stats;
+}
+
+void Model::AddMemoryUsage( LoadStats &stats ) const
+{
+    stats.containers.push_back({"nodes", m_Nodes.Size(), m_Nodes.MemoryUsage()});
+    stats.containers.push_back({"ways", m_Ways.Size(), m_Ways.MemoryUsage()});
+    stats.AddVector("roads", m_Roads);
+    stats.AddVector("railways", m_Railways);
+    auto add_multipolygons = [&](const char *name, const auto &mps) {
+        auto bytes = mps.capacity() * sizeof(mps[0]);
+        for( const auto &mp: mps )
+            bytes += (mp.outer.capacity() + mp.inner.capacity()) * sizeof(int);
+        stats.containers.push_back({name, mps.size(), bytes});
+    };
+    add_multipolygons("buildings", m_Buildings);
+    add_multipolygons("leisures", m_Leisures);
+    add_multipolygons("waters", m_Waters);
+    add_multipolygons("landuses", m_Landuses);
+    if( m_Updatable ) {
+        stats.containers.push_back({"node ids", m_NodeIds.Size(), m_NodeIds.MemoryUsage()});
+        stats.containers.push_back({"way ids", m_WayIds.Size(), m_WayIds.MemoryUsage()});
+        stats.AddHashMap("changed node ids", m_NodeIdChanges);
+        stats.AddHashMap("changed way ids", m_WayIdChanges);
+        stats.AddVector("way roads", m_WayRoads);
+    }
+}
+
+namespace {
+
+constexpr auto kBoundsSection    = BinaryMap::Tag("BNDS");
+constexpr auto kNodesSection     = BinaryMap::Tag("NODE");
+constexpr auto kWaysSection      = BinaryMap::Tag("WAYS");
+constexpr auto kRoadsSection     = BinaryMap::Tag("ROAD");
+constexpr auto kRailwaysSection  = BinaryMap::Tag("RAIL");
+constexpr auto kBuildingsSection = BinaryMap::Tag("BLDG");
+constexpr auto kLeisuresSection  = BinaryMap::Tag("LEIS");
+constexpr auto kWatersSection    = BinaryMap::Tag("WATR");
+constexpr auto kLandusesSection  = BinaryMap::Tag("LAND");
+
+// Lists of int lists are stored as their offsets array followed by their values array.
+Csr<int> ReadLists( BinaryMap::Reader::Cursor &cursor )
+{
+    std::vector<Csr<int>::Offset> offsets;
+    std::vector<int> values;
+    cursor.Array(offsets);
+    cursor.Array(values);
+    Csr<int> lists{std::move(offsets), std::move(values)};
+    if( !lists.Valid() )
+        throw std::logic_error("the compiled map file is corrupted");
+    return lists;
+}
+
+template <typename MP>
+void WriteMultipolygons( BinaryMap::Writer &writer, std::uint32_t tag, const std::vector<MP> &mps )
+{
+    Csr<int> rings;
+    for( const auto &mp: mps ) {
+        rings.AddRow(mp.outer.begin(), mp.outer.end());
+        rings.AddRow(mp.inner.begin(), mp.inner.end());
+    }
+    auto [offsets, values] = std::move(rings).Release();
+    writer.BeginSection(tag);
+    writer.Array(std::move(offsets));
+    writer.Array(std::move(values));
+}
+
+template <typename MP>
+void ReadMultipolygons( BinaryMap::Reader::Cursor &cursor, std::vector<MP> &mps )
+{
+    const auto rings = ReadLists(cursor);
+    mps.resize(rings.Size() / 2);
+    for( std::size_t i = 0; i < mps.size(); ++i ) {
+        const auto outer = rings[2 * i], inner = rings[2 * i + 1];
+        mps[i].outer.assign(outer.begin(), outer.end());
+        mps[i].inner.assign(inner.begin(), inner.end());
+    }
+}
+
+}
+
+void Model::SaveBinary( const std::string &path ) const
+{
+    BinaryMap::Writer writer;
+    WriteSections(writer);
+    writer.Write(path);
+}
+
+void Model::WriteSections( BinaryMap::Writer &writer ) const
+{
+    static_assert( std::is_trivially_copyable_v<Road> &&
+                   std::is_trivially_copyable_v<Railway> );
+
+    writer.BeginSection(kBoundsSection);
+    writer.Array(std::vector<double>{m_MinLat, m_MaxLat, m_MinLon, m_MaxLon, m_MetricScale});
+
+    writer.BeginSection(kNodesSection);
+    m_Nodes.Write(writer);
+
+    writer.BeginSection(kWaysSection);
+    writer.Array(m_Ways.Offsets());
+    writer.Array(m_Ways.Values());
+
+    writer.BeginSection(kRoadsSection);
+    writer.Array(m_Roads);
+    writer.BeginSection(kRailwaysSection);
+    writer.Array(m_Railways);
+
+    WriteMultipolygons(writer, kBuildingsSection, m_Buildings);
+    WriteMultipolygons(writer, kLeisuresSection, m_Leisures);
+    WriteMultipolygons(writer, kWatersSection, m_Waters);
+    WriteMultipolygons(writer, kLandusesSection, m_Landuses);
+    std::vector<int> types;
+    for( const auto &landuse: m_Landuses )
+        types.emplace_back((int)landuse.type);
+    writer.Array(std::move(types));
+}
+
+void Model::LoadBinary( const BinaryMap::Reader &reader )
+{
+    std::vector<double> bounds;
+    reader.Section(kBoundsSection).Array(bounds);
+    if( bounds.size() != 5 )
+        throw std::logic_error("the compiled map file is corrupted");
+    m_MinLat = bounds[0];
+    m_MaxLat = bounds[1];
+    m_MinLon = bounds[2];
+    m_MaxLon = bounds[3];
+    m_MetricScale = bounds[4];
+
+    auto nodes = reader.Section(kNodesSection);
+    m_Nodes.Read(nodes);
+
+    auto ways = reader.Section(kWaysSection);
+    m_Ways = ReadLists(ways);
+
+    reader.Section(kRoadsSection).Array(m_Roads);
+    if( m_Profile != LoadOptions::Profile::Routing )
+        LoadRenderLayers(reader);
+
+    // The checksum catches damaged files; this keeps a well-formed but inconsistent one from
+    // sending the renderer or the planner out of bounds.
+    auto check = [](bool valid) {
+        if( !valid )
+            throw std::logic_error("the compiled map file is corrupted");
+    };
+    auto valid_way = [&](int way) { return way >= 0 && way < (int)m_Ways.Size(); };
+    for( auto node: m_Ways.Values() )
+        check( node >= 0 && node < (int)m_Nodes.Size() );
+    for( const auto &road: m_Roads )
+        check( valid_way(road.way) && road.type >= Road::Invalid && road.type <= Road::Footway );
+    for( const auto &railway: m_Railways )
+        check( valid_way(railway.way) );
+    auto check_mps = [&](const auto &mps) {
+        for( const auto &mp: mps )
+            check( std::all_of(mp.outer.begin(), mp.outer.end(), valid_way) &&
+                   std::all_of(mp.inner.begin(), mp.inner.end(), valid_way) );
+    };
+    check_mps(m_Buildings);
+    check_mps(m_Leisures);
+    check_mps(m_Waters);
+    check_mps(m_Landuses);
+}
+
+void Model::LoadRenderLayers( const BinaryMap::Reader &reader )
+{
+    reader.Section(kRailwaysSection).Array(m_Railways);
+
+    auto buildings = reader.Section(kBuildingsSection);
+    ReadMultipolygons(buildings, m_Buildings);
+    auto leisures = reader.Section(kLeisuresSection);
+    ReadMultipolygons(leisures, m_Leisures);
+    auto waters = reader.Section(kWatersSection);
+    ReadMultipolygons(waters, m_Waters);
+    auto landuses = reader.Section(kLandusesSection);
+    ReadMultipolygons(landuses, m_Landuses);
+    std::vector<int> types;
+    landuses.Array(types);
+    if( types.size() != m_Landuses.size() )
+        throw std::logic_error("the compiled map file is corrupted");
+    for( std::size_t i = 0; i < types.size(); ++i ) {
+        if( types[i] < Landuse::Invalid || types[i] > Landuse::Residential )
+            throw std::logic_error("the compiled map file is corrupted");
+        m_Landuses[i].type = (Landuse::Type)types[i];
+    }
+}
@@ -2,8 +2,16 @@
 
 #include <vector>
 #include <unordered_map>
+#include <optional>
 #include <string>
 #include <cstddef>
+#include "binary_map.h"
+#include "csr.h"
+#include "coord_store.h"
+#include "id_index.h"
+#include "load_stats.h"
+
+struct OsmSections;
 
 class Model
 {
@@ -13,8 +21,34 @@ public:
         double y = 0.f;
     };
     
+    // Coordinates live in a CoordStore; this reads them back as Nodes.
+    class NodeList
+    {
+    public:
+        explicit NodeList( const CoordStore &coords ) noexcept : m_Coords(&coords) {}
+        Node operator[]( std::size_t i ) const noexcept { return {m_Coords->X(i), m_Coords->Y(i)}; }
+        std::size_t size() const noexcept { return m_Coords->Size(); }
+        bool empty() const noexcept { return m_Coords->Size() == 0; }
+
+    private:
+        const CoordStore *m_Coords;
+    };
+
     struct Way {
-        std::vector<int> nodes;
+        Span<int> nodes;
+    };
+
+    // All ways' node lists live in one array; this indexes it without copying.
+    class WayList
+    {
+    public:
+        explicit WayList( const Csr<int> &ways ) noexcept : m_Ways(&ways) {}
+        Way operator[]( std::size_t i ) const noexcept { return {(*m_Ways)[i]}; }
+        std::size_t size() const noexcept { return m_Ways->Size(); }
+        bool empty() const noexcept { return m_Ways->Empty(); }
+
+    private:
+        const Csr<int> *m_Ways;
     };
     
     struct Road {
@@ -44,26 +78,123 @@ public:
         Type type;
     };
     
+    struct LoadOptions {
+        // Dom keeps the whole pugixml document in memory, Stream parses in a single pass.
+        enum class Parser { Dom, Stream };
+        Parser parser = Parser::Stream;
+
+        // Memory for the Dom parser's document: Heap allocates it page by page, Arena from a
+        // few large regions released at once, HugePages likewise but from huge pages where
+        // the system has them.
+        enum class DomMemory { Heap, Arena, HugePages };
+        DomMemory dom_memory = DomMemory::Arena;
+
+        // Threads loading may use on large files; 0 means one per core.
+        std::size_t threads = 0;
+
+        // Storage for node coordinates. Float and Fixed32 halve it at the cost of moving nodes
+        // by up to CoordinateError() meters. Compiled maps keep the precision they were
+        // compiled with, unless that was Double.
+        CoordStore::Precision precision = CoordStore::Precision::Double;
+
+        // Layers to load. Routing keeps only the ways of roads the planner uses and skips
+        // relations; Render skips RouteModel's routing index, so it can't plan routes.
+        enum class Profile { Full, Routing, Render };
+        Profile profile = Profile::Full;
+
+        // Order of the nodes kept after loading. Hilbert sorts them along a Hilbert curve so
+        // that nodes close on the map are close in memory too.
+        enum class NodeOrder { File, Hilbert };
+        NodeOrder node_order = NodeOrder::File;
+
+        // Keeps what ApplyChange() needs: the id indices, and every node in file order, since
+        // a change may route a way through nodes no way used before. Needs Double precision;
+        // doesn't apply to compiled maps, which store no ids.
+        bool updatable = false;
+
+        // Loads only the nodes inside this box, widened by `margin` meters on every side and
+        // then out to a grid of 0.05 degree tiles, so that nearby requests load the same
+        // area. Ways keep the nodes they have inside, split into a way per run of them where
+        // they leave the area and come back; ways without any are dropped. MetricScale() and
+        // the 0-1 coordinate range then span the loaded area rather than the whole map.
+        // Doesn't apply to compiled maps, and updatable maps can't have one.
+        struct BoundingBox {
+            double min_lat, min_lon, max_lat, max_lon;
+        };
+        std::optional<BoundingBox> bbox;
+        double margin = 1000.;
+    };
+
     Model( const std::vector<std::byte> &xml );
+    Model( const std::vector<std::byte> &xml, const LoadOptions &options );
+    // Accepts OSM XML, .osm.pbf or a map compiled with SaveBinary(); the parser option only
+    // applies to XML.
+    Model( const std::byte *data, std::size_t size, const LoadOptions &options );
+    virtual ~Model() = default;
+
+    // Writes the finished model to a compiled map file that loads without any parsing.
+    void SaveBinary( const std::string &path ) const;
+
+    // Applies an OsmChange document (.osc) in place: nodes are added or moved, changed ways
+    // get new rows in Ways() (their old rows stay, unused), and roads are added, re-pointed
+    // or, when deleted or no longer roads, left in Roads() with type Invalid. Railways and
+    // areas keep the geometry they were loaded with; relations are ignored.
+    // Throws std::logic_error if the model isn't updatable or the document can't be parsed;
+    // the elements before the error stay applied.
+    void ApplyChange( const std::byte *data, std::size_t size );
+
+    // Time taken by each phase of loading (and of applying changes), and the memory each
+    // container holds now.
+    LoadStats GetLoadStats() const;
     
     auto MetricScale() const noexcept { return m_MetricScale; }    
+    auto GetProfile() const noexcept { return m_Profile; }
+    auto GetPrecision() const noexcept { return m_Nodes.GetPrecision(); }
+    // Largest distance in meters between a node's stored position and its position in the map file.
+    double CoordinateError() const noexcept { return m_Nodes.ErrorBound() * m_MetricScale; }
     
-    auto &Nodes() const noexcept { return m_Nodes; }
-    auto &Ways() const noexcept { return m_Ways; }
+    auto Nodes() const noexcept { return NodeList{m_Nodes}; }
+    auto Ways() const noexcept { return WayList{m_Ways}; }
     auto &Roads() const noexcept { return m_Roads; }
     auto &Buildings() const noexcept { return m_Buildings; }
     auto &Leisures() const noexcept { return m_Leisures; }
     auto &Waters() const noexcept { return m_Waters; }
     auto &Landuses() const noexcept { return m_Landuses; }
     auto &Railways() const noexcept { return m_Railways; }
-    
+
+protected:
+    virtual void WriteSections( BinaryMap::Writer &writer ) const;
+
+    // Called by ApplyChange() for each node it adds (the last one) or moves.
+    virtual void OnNodeChanged( int /*node*/ ) {}
+    // Called by ApplyChange() for each road it adds, re-points or invalidates, with the way
+    // the road used before, or -1 for a new road.
+    virtual void OnRoadChanged( int /*road*/, int /*old_way*/ ) {}
+    // Called by ApplyChange() once all changes are in.
+    virtual void OnChangeApplied() {}
+
+    virtual void AddMemoryUsage( LoadStats &stats ) const;
+
+    LoadStats m_LoadStats;
+
 private:
-    void AdjustCoordinates();
+    class Builder;
+    class Updater;
+
+    Model() = default;
+    void Append( Model &&part );
+
+    void AdjustCoordinates( std::size_t threads );
+    void CompactNodes( LoadOptions::NodeOrder order );
     void BuildRings( Multipolygon &mp );
-    void LoadData(const std::vector<std::byte> &xml);
+    void LoadData(const std::byte *data, std::size_t size, const LoadOptions &options);
+    void LoadDataParallel(const std::byte *data, const OsmSections &sections, const LoadOptions &options,
+                          std::size_t threads);
+    void LoadBinary(const BinaryMap::Reader &reader);
+    void LoadRenderLayers(const BinaryMap::Reader &reader);
     
-    std::vector<Node> m_Nodes;
-    std::vector<Way> m_Ways;
+    CoordStore m_Nodes;
+    Csr<int> m_Ways;
     std::vector<Road> m_Roads;
     std::vector<Railway> m_Railways;
     std::vector<Building> m_Buildings;
@@ -76,4 +207,16 @@ private:
     double m_MinLon = 0.;
     double m_MaxLon = 0.;
     double m_MetricScale = 1.f;
+    LoadOptions::Profile m_Profile = LoadOptions::Profile::Full;
+
+    // Only kept by updatable models. Ids ApplyChange() added, moved or deleted (-1) go to
+    // the overlays rather than re-sorting the indices.
+    bool m_Updatable = false;
+    IdIndex m_NodeIds, m_WayIds;
+    std::unordered_map<std::int64_t, int> m_NodeIdChanges, m_WayIdChanges;
+    std::vector<int> m_WayRoads;    // per way, the road using it or -1
+
+    // Only while loading a bounding box: ways split at its edge, by their first row, and
+    // the number of rows they were split into.
+    std::unordered_map<int, int> m_WayPieces;
 };
@@ -0,0 +1,357 @@
+#include "osm_parser.h"
+#include "pugixml.hpp"
+#include <charconv>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+void ParseOsmDom( const std::byte *data, std::size_t size, OsmHandler &handler )
+{
+    using namespace pugi;
+
+    xml_document doc;
+    if( !doc.load_buffer(data, size) )
+        throw std::logic_error("failed to parse the xml file");
+
+    if( auto bounds = doc.select_nodes("/osm/bounds"); !bounds.empty() ) {
+        auto node = bounds.first().node();
+        handler.Bounds(atof(node.attribute("minlat").as_string()),
+                       atof(node.attribute("minlon").as_string()),
+                       atof(node.attribute("maxlat").as_string()),
+                       atof(node.attribute("maxlon").as_string()));
+    }
+    else
+        throw std::logic_error("map's bounds are not defined");
+
+    for( const auto &node: doc.select_nodes("/osm/node") )
+        handler.Node(node.node().attribute("id").as_llong(),
+                     atof(node.node().attribute("lat").as_string()),
+                     atof(node.node().attribute("lon").as_string()));
+
+    for( const auto &way: doc.select_nodes("/osm/way") ) {
+        auto node = way.node();
+        handler.BeginWay(node.attribute("id").as_llong());
+        for( auto child: node.children() ) {
+            auto name = std::string_view{child.name()};
+            if( name == "nd" )
+                handler.WayNode(child.attribute("ref").as_llong());
+            else if( name == "tag" )
+                handler.Tag(child.attribute("k").as_string(), child.attribute("v").as_string());
+        }
+        handler.EndWay();
+    }
+
+    for( const auto &relation: doc.select_nodes("/osm/relation") ) {
+        auto node = relation.node();
+        handler.BeginRelation(node.attribute("id").as_llong());
+        for( auto child: node.children() ) {
+            auto name = std::string_view{child.name()};
+            if( name == "member" )
+                handler.Member(child.attribute("type").as_string(),
+                               child.attribute("ref").as_llong(),
+                               child.attribute("role").as_string());
+            else if( name == "tag" )
+                handler.Tag(child.attribute("k").as_string(), child.attribute("v").as_string());
+        }
+        handler.EndRelation();
+    }
+}
+
+namespace {
+
+// Minimal pull scanner for the subset of XML that OSM files use: a prolog, comments,
+// and elements with quoted attributes. Text content is skipped.
+class XmlScanner
+{
+public:
+    struct Attribute {
+        std::string_view name;
+        std::string_view value;
+    };
+
+    enum class Event { StartElement, EmptyElement, EndElement, Done };
+
+    XmlScanner( const char *begin, const char *end ) : m_Pos(begin), m_End(end) {}
+
+    Event Next()
+    {
+        for(;;) {
+            if( m_Pos == m_End )
+                return Event::Done;
+            m_Pos = static_cast<const char *>(memchr(m_Pos, '<', m_End - m_Pos));
+            if( !m_Pos ) {
+                m_Pos = m_End;
+                return Event::Done;
+            }
+            ++m_Pos;
+            if( m_Pos == m_End )
+                throw std::logic_error("failed to parse the xml file");
+            if( *m_Pos == '?' )
+                SkipPast("?>");
+            else if( StartsWith("!--") )
+                SkipPast("-->");
+            else if( StartsWith("![CDATA[") )
+                SkipPast("]]>");
+            else if( *m_Pos == '!' )
+                SkipPast(">");
+            else if( *m_Pos == '/' ) {
+                ++m_Pos;
+                m_Name = ReadName();
+                SkipPast(">");
+                return Event::EndElement;
+            }
+            else
+                return ReadStartTag();
+        }
+    }
+
+    std::string_view Name() const noexcept { return m_Name; }
+
+    std::string_view Attr( std::string_view name ) const noexcept
+    {
+        for( const auto &attr: m_Attributes )
+            if( attr.name == name )
+                return attr.value;
+        return {};
+    }
+
+private:
+    static bool IsSpace( char c ) noexcept { return c == ' ' || c == '\t' || c == '\n' || c == '\r'; }
+
+    bool StartsWith( std::string_view s ) const noexcept
+    {
+        return size_t(m_End - m_Pos) >= s.size() && memcmp(m_Pos, s.data(), s.size()) == 0;
+    }
+
+    void SkipSpaces() noexcept
+    {
+        while( m_Pos != m_End && IsSpace(*m_Pos) )
+            ++m_Pos;
+    }
+
+    void SkipPast( std::string_view terminator )
+    {
+        auto found = std::string_view{m_Pos, size_t(m_End - m_Pos)}.find(terminator);
+        if( found == std::string_view::npos )
+            throw std::logic_error("failed to parse the xml file");
+        m_Pos += found + terminator.size();
+    }
+
+    std::string_view ReadName() noexcept
+    {
+        auto begin = m_Pos;
+        while( m_Pos != m_End && !IsSpace(*m_Pos) && *m_Pos != '/' && *m_Pos != '>' && *m_Pos != '=' )
+            ++m_Pos;
+        return {begin, size_t(m_Pos - begin)};
+    }
+
+    Event ReadStartTag()
+    {
+        m_Name = ReadName();
+        m_Attributes.clear();
+        for(;;) {
+            SkipSpaces();
+            if( m_Pos == m_End )
+                throw std::logic_error("failed to parse the xml file");
+            if( *m_Pos == '>' ) {
+                ++m_Pos;
+                return Event::StartElement;
+            }
+            if( *m_Pos == '/' ) {
+                SkipPast(">");
+                return Event::EmptyElement;
+            }
+            auto name = ReadName();
+            SkipSpaces();
+            if( m_Pos == m_End || *m_Pos != '=' )
+                throw std::logic_error("failed to parse the xml file");
+            ++m_Pos;
+            SkipSpaces();
+            if( m_Pos == m_End || (*m_Pos != '"' && *m_Pos != '\'') )
+                throw std::logic_error("failed to parse the xml file");
+            const auto quote = *m_Pos++;
+            auto value_end = static_cast<const char *>(memchr(m_Pos, quote, m_End - m_Pos));
+            if( !value_end )
+                throw std::logic_error("failed to parse the xml file");
+            m_Attributes.push_back({name, {m_Pos, size_t(value_end - m_Pos)}});
+            m_Pos = value_end + 1;
+        }
+    }
+
+    const char *m_Pos;
+    const char *m_End;
+    std::string_view m_Name;
+    std::vector<Attribute> m_Attributes;
+};
+
+double ToDouble( std::string_view s ) noexcept
+{
+    double value = 0.;
+    std::from_chars(s.data(), s.data() + s.size(), value);
+    return value;
+}
+
+std::int64_t ToInt64( std::string_view s ) noexcept
+{
+    std::int64_t value = 0;
+    std::from_chars(s.data(), s.data() + s.size(), value);
+    return value;
+}
+
+}
+
+bool ParseOsmFragment( const std::byte *data, std::size_t size, OsmHandler &handler )
+{
+    enum class Parent { None, Way, Relation };
+
+    auto begin = reinterpret_cast<const char *>(data);
+    XmlScanner scanner{begin, begin + size};
+    auto parent = Parent::None;
+    bool has_bounds = false;
+
+    for( auto event = scanner.Next(); event != XmlScanner::Event::Done; event = scanner.Next() ) {
+        const auto name = scanner.Name();
+        if( event == XmlScanner::Event::EndElement ) {
+            if( name == "way" && parent == Parent::Way )
+                handler.EndWay();
+            else if( name == "relation" && parent == Parent::Relation )
+                handler.EndRelation();
+            else
+                continue;
+            parent = Parent::None;
+            continue;
+        }
+
+        const bool empty = event == XmlScanner::Event::EmptyElement;
+        if( parent == Parent::Way ) {
+            if( name == "nd" )
+                handler.WayNode(ToInt64(scanner.Attr("ref")));
+            else if( name == "tag" )
+                handler.Tag(scanner.Attr("k"), scanner.Attr("v"));
+        }
+        else if( parent == Parent::Relation ) {
+            if( name == "member" )
+                handler.Member(scanner.Attr("type"), ToInt64(scanner.Attr("ref")), scanner.Attr("role"));
+            else if( name == "tag" )
+                handler.Tag(scanner.Attr("k"), scanner.Attr("v"));
+        }
+        else if( name == "node" )
+            handler.Node(ToInt64(scanner.Attr("id")), ToDouble(scanner.Attr("lat")), ToDouble(scanner.Attr("lon")));
+        else if( name == "way" ) {
+            handler.BeginWay(ToInt64(scanner.Attr("id")));
+            if( empty )
+                handler.EndWay();
+            else
+                parent = Parent::Way;
+        }
+        else if( name == "relation" ) {
+            handler.BeginRelation(ToInt64(scanner.Attr("id")));
+            if( empty )
+                handler.EndRelation();
+            else
+                parent = Parent::Relation;
+        }
+        else if( name == "create" )
+            handler.Action(OsmAction::Create);
+        else if( name == "modify" )
+            handler.Action(OsmAction::Modify);
+        else if( name == "delete" )
+            handler.Action(OsmAction::Delete);
+        else if( name == "bounds" && !has_bounds ) {
+            handler.Bounds(ToDouble(scanner.Attr("minlat")), ToDouble(scanner.Attr("minlon")),
+                           ToDouble(scanner.Attr("maxlat")), ToDouble(scanner.Attr("maxlon")));
+            has_bounds = true;
+        }
+    }
+
+    return has_bounds;
+}
+
+void ParseOsmStream( const std::byte *data, std::size_t size, OsmHandler &handler )
+{
+    if( !ParseOsmFragment(data, size, handler) )
+        throw std::logic_error("map's bounds are not defined");
+}
+
+void ParseOsmChange( const std::byte *data, std::size_t size, OsmHandler &handler )
+{
+    const auto begin = reinterpret_cast<const char *>(data);
+    XmlScanner scanner{begin, begin + size};
+    const auto root = scanner.Next();
+    if( (root != XmlScanner::Event::StartElement && root != XmlScanner::Event::EmptyElement) ||
+        scanner.Name() != "osmChange" )
+        throw std::logic_error("not an OsmChange document");
+    ParseOsmFragment(data, size, handler);
+}
+
+// True if the "<element" found at `pos` is a tag of exactly that name.
+static bool IsElementAt( std::string_view text, std::size_t pos, std::size_t length )
+{
+    const auto next = pos + length;
+    return next < text.size() && (text[next] == ' ' || text[next] == '\t' || text[next] == '\n' ||
+                                  text[next] == '\r' || text[next] == '>' || text[next] == '/');
+}
+
+// Position of the first "<element" tag at or after `from`, or npos.
+static std::size_t FindElement( std::string_view text, std::string_view element, std::size_t from )
+{
+    const auto tag = "<" + std::string{element};
+    for( auto pos = text.find(tag, from); pos != std::string_view::npos; pos = text.find(tag, pos + 1) )
+        if( IsElementAt(text, pos, tag.size()) )
+            return pos;
+    return std::string_view::npos;
+}
+
+// Position of the last "<element" tag, or npos.
+static std::size_t FindLastElement( std::string_view text, std::string_view element )
+{
+    const auto tag = "<" + std::string{element};
+    for( auto pos = text.rfind(tag); pos != std::string_view::npos; pos = pos ? text.rfind(tag, pos - 1) : std::string_view::npos )
+        if( IsElementAt(text, pos, tag.size()) )
+            return pos;
+    return std::string_view::npos;
+}
+
+std::optional<OsmSections> FindOsmSections( const std::byte *data, std::size_t size )
+{
+    const auto text = std::string_view{reinterpret_cast<const char *>(data), size};
+    const auto first = [&](std::string_view element, std::size_t fallback) {
+        auto pos = FindElement(text, element, 0);
+        return pos == std::string_view::npos ? fallback : pos;
+    };
+
+    OsmSections sections;
+    sections.end = size;
+    sections.relations = first("relation", size);
+    sections.ways = first("way", sections.relations);
+    sections.nodes = first("node", sections.ways);
+
+    const auto last_node = FindLastElement(text, "node");
+    const auto last_way = FindLastElement(text, "way");
+    if( (last_node != std::string_view::npos && last_node > sections.ways) ||
+        (last_way != std::string_view::npos && last_way > sections.relations) ||
+        sections.ways > sections.relations )
+        return std::nullopt;
+    return sections;
+}
+
+std::vector<std::size_t> SplitOsmSection( const std::byte *data, std::size_t begin, std::size_t end,
+                                          std::string_view element, std::size_t parts )
+{
+    const auto text = std::string_view{reinterpret_cast<const char *>(data), end};
+    std::vector<std::size_t> bounds{begin};
+    for( std::size_t i = 1; i < parts; ++i ) {
+        const auto target = begin + (end - begin) / parts * i;
+        if( target <= bounds.back() )
+            continue;
+        const auto pos = FindElement(text, element, target + 1);
+        if( pos == std::string_view::npos )
+            break;
+        if( pos > bounds.back() )
+            bounds.push_back(pos);
+    }
+    bounds.push_back(end);
+    return bounds;
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string_view>
+#include <vector>
+
+enum class OsmAction { Create, Modify, Delete };
+
+// Receives the OSM elements the parsers below find, in document order.
+// Tag() is reported for the way or relation currently open; node tags are skipped.
+// Ids are parsed once by the parser; an id that is not a number is reported as 0.
+class OsmHandler
+{
+public:
+    virtual ~OsmHandler() = default;
+
+    // Only reported in change files, before the elements of each <create>, <modify> or
+    // <delete> block.
+    virtual void Action( OsmAction ) {}
+
+    virtual void Bounds( double min_lat, double min_lon, double max_lat, double max_lon ) = 0;
+    virtual void Node( std::int64_t id, double lat, double lon ) = 0;
+    virtual void BeginWay( std::int64_t id ) = 0;
+    virtual void WayNode( std::int64_t ref ) = 0;
+    virtual void EndWay() = 0;
+    virtual void BeginRelation( std::int64_t id ) = 0;
+    virtual void Member( std::string_view type, std::int64_t ref, std::string_view role ) = 0;
+    virtual void EndRelation() = 0;
+    virtual void Tag( std::string_view key, std::string_view value ) = 0;
+};
+
+// Builds a pugixml DOM and walks it with XPath queries: all nodes, then all ways, then all relations.
+void ParseOsmDom( const std::byte *data, std::size_t size, OsmHandler &handler );
+
+// Single forward pass over the buffer without building a DOM, so memory use does not grow
+// with the file size. Elements are reported in file order, which for OSM exports is
+// nodes, then ways, then relations. Attribute values are reported raw: entity references
+// are not expanded, which never matters for the ids, coordinates and tag keywords Model uses.
+void ParseOsmStream( const std::byte *data, std::size_t size, OsmHandler &handler );
+
+// Offsets of the first node, way and relation of a file that lists all nodes, then all ways,
+// then all relations, as OSM exports do. A missing kind of element gets an empty section.
+struct OsmSections {
+    std::size_t nodes;
+    std::size_t ways;
+    std::size_t relations;
+    std::size_t end;
+};
+
+// std::nullopt if elements of different kinds are interleaved.
+std::optional<OsmSections> FindOsmSections( const std::byte *data, std::size_t size );
+
+// Splits [begin, end) into at most `parts` ranges that each start with an `element` tag.
+// Returns the boundaries: begin, the start of every range after the first, end.
+std::vector<std::size_t> SplitOsmSection( const std::byte *data, std::size_t begin, std::size_t end,
+                                          std::string_view element, std::size_t parts );
+
+// Parses a range of whole elements, such as one produced by SplitOsmSection().
+// Returns whether the range held the map bounds.
+bool ParseOsmFragment( const std::byte *data, std::size_t size, OsmHandler &handler );
+
+// Parses an OsmChange document (.osc), which has no bounds. Deleted elements may come
+// without coordinates, tags or members.
+void ParseOsmChange( const std::byte *data, std::size_t size, OsmHandler &handler );
@@ -0,0 +1,485 @@
+#include "osm_pbf.h"
+#include "parallel.h"
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <zlib.h>
+
+namespace {
+
+// The format caps a blob's uncompressed size at 32 MiB; anything claiming more is corrupt.
+constexpr std::uint64_t kMaxBlobSize = 32 << 20;
+
+[[noreturn]] void Malformed()
+{
+    throw std::logic_error("failed to parse the pbf file");
+}
+
+std::int64_t Zigzag( std::uint64_t value ) noexcept
+{
+    return (std::int64_t)(value >> 1) ^ -(std::int64_t)(value & 1);
+}
+
+// Reads protobuf wire format fields one at a time.
+class ProtoReader
+{
+public:
+    ProtoReader( std::string_view bytes ) :
+        m_Pos(reinterpret_cast<const std::uint8_t *>(bytes.data())), m_End(m_Pos + bytes.size()) {}
+
+    // Advances to the next field; false at the end of the message.
+    bool Next()
+    {
+        if( m_Pos == m_End )
+            return false;
+        const auto key = Varint();
+        m_Field = (std::uint32_t)(key >> 3);
+        m_Wire = (std::uint32_t)(key & 7);
+        return true;
+    }
+
+    std::uint32_t Field() const noexcept { return m_Field; }
+
+    std::uint64_t Varint()
+    {
+        std::uint64_t value = 0;
+        for( int shift = 0; shift < 64; shift += 7 ) {
+            if( m_Pos == m_End )
+                Malformed();
+            const auto byte = *m_Pos++;
+            value |= (std::uint64_t)(byte & 0x7f) << shift;
+            if( !(byte & 0x80) )
+                return value;
+        }
+        Malformed();
+    }
+
+    std::int64_t Sint() { return Zigzag(Varint()); }
+
+    std::string_view Bytes()
+    {
+        if( m_Wire != 2 )
+            Malformed();
+        const auto size = Varint();
+        if( size > (std::uint64_t)(m_End - m_Pos) )
+            Malformed();
+        auto bytes = std::string_view{reinterpret_cast<const char *>(m_Pos), (std::size_t)size};
+        m_Pos += size;
+        return bytes;
+    }
+
+    // Calls f(value) for every element of a repeated varint field, packed or not.
+    template <typename F>
+    void Varints( F &&f )
+    {
+        if( m_Wire == 0 ) {
+            f(Varint());
+            return;
+        }
+        ProtoReader packed{Bytes()};
+        while( packed.m_Pos != packed.m_End )
+            f(packed.Varint());
+    }
+
+    void Skip()
+    {
+        switch( m_Wire ) {
+            case 0: Varint(); break;
+            case 1: Advance(8); break;
+            case 2: Bytes(); break;
+            case 5: Advance(4); break;
+            default: Malformed();
+        }
+    }
+
+private:
+    void Advance( std::size_t size )
+    {
+        if( size > (std::size_t)(m_End - m_Pos) )
+            Malformed();
+        m_Pos += size;
+    }
+
+    const std::uint8_t *m_Pos;
+    const std::uint8_t *m_End;
+    std::uint32_t m_Field = 0;
+    std::uint32_t m_Wire = 0;
+};
+
+struct BlobRef {
+    std::string type;
+    std::string_view blob;
+};
+
+// Walks the (length, BlobHeader, Blob) frames of the file without decoding the blobs.
+std::vector<BlobRef> IndexBlobs( const std::byte *data, std::size_t size )
+{
+    std::vector<BlobRef> blobs;
+    std::size_t pos = 0;
+    while( pos < size ) {
+        if( size - pos < 4 )
+            Malformed();
+        const auto p = reinterpret_cast<const std::uint8_t *>(data + pos);
+        const std::size_t header_size = (std::size_t)p[0] << 24 | (std::size_t)p[1] << 16 | (std::size_t)p[2] << 8 | p[3];
+        pos += 4;
+        if( header_size > size - pos )
+            Malformed();
+
+        BlobRef ref;
+        std::uint64_t blob_size = 0;
+        ProtoReader header{{reinterpret_cast<const char *>(data + pos), header_size}};
+        while( header.Next() ) {
+            if( header.Field() == 1 )
+                ref.type = std::string{header.Bytes()};
+            else if( header.Field() == 3 )
+                blob_size = header.Varint();
+            else
+                header.Skip();
+        }
+        pos += header_size;
+        if( blob_size > size - pos )
+            Malformed();
+        ref.blob = {reinterpret_cast<const char *>(data + pos), (std::size_t)blob_size};
+        pos += blob_size;
+        blobs.emplace_back(std::move(ref));
+    }
+    return blobs;
+}
+
+// Returns the uncompressed contents of a Blob message, inflating into `buffer` if needed.
+std::string_view Unpack( std::string_view blob, std::vector<char> &buffer )
+{
+    std::string_view raw, zlib_data;
+    std::uint64_t raw_size = 0;
+    ProtoReader reader{blob};
+    while( reader.Next() ) {
+        switch( reader.Field() ) {
+            case 1: raw = reader.Bytes(); break;
+            case 2: raw_size = reader.Varint(); break;
+            case 3: zlib_data = reader.Bytes(); break;
+            case 4: case 5: case 6: case 7:
+                throw std::logic_error("unsupported pbf blob compression");
+            default: reader.Skip();
+        }
+    }
+    if( raw.data() )
+        return raw;
+    if( !zlib_data.data() || raw_size > kMaxBlobSize )
+        Malformed();
+
+    buffer.resize((std::size_t)raw_size);
+    auto out_size = (uLongf)raw_size;
+    if( uncompress(reinterpret_cast<Bytef *>(buffer.data()), &out_size,
+                   reinterpret_cast<const Bytef *>(zlib_data.data()), (uLong)zlib_data.size()) != Z_OK ||
+        out_size != raw_size )
+        Malformed();
+    return {buffer.data(), buffer.size()};
+}
+
+// One PrimitiveBlock, decoded into flat arrays that are cheap to replay into a handler.
+struct Block {
+    struct Node { std::int64_t id; double lat, lon; };
+    struct Element { std::int64_t id; std::size_t first_ref, refs, first_tag, tags; };
+    struct Member { std::int64_t ref; std::uint32_t type, role; };
+
+    std::vector<char> buffer;
+    std::vector<std::string_view> strings;
+    std::vector<Node> nodes;
+    std::vector<Element> ways, relations;
+    std::vector<std::int64_t> refs;
+    std::vector<Member> members;
+    std::vector<std::pair<std::uint32_t, std::uint32_t>> tags;
+
+    std::string_view String( std::uint32_t i ) const
+    {
+        if( i >= strings.size() )
+            Malformed();
+        return strings[i];
+    }
+};
+
+struct Coordinates {
+    std::int64_t granularity = 100, lat_offset = 0, lon_offset = 0;
+
+    double Lat( std::int64_t lat ) const noexcept { return (double)(lat_offset + granularity * lat) / 1e9; }
+    double Lon( std::int64_t lon ) const noexcept { return (double)(lon_offset + granularity * lon) / 1e9; }
+};
+
+void DecodeTags( ProtoReader &reader, std::vector<std::uint32_t> &keys, std::vector<std::uint32_t> &values )
+{
+    if( reader.Field() == 2 )
+        reader.Varints([&](auto v){ keys.emplace_back((std::uint32_t)v); });
+    else
+        reader.Varints([&](auto v){ values.emplace_back((std::uint32_t)v); });
+}
+
+void AddTags( Block &block, Block::Element &element, const std::vector<std::uint32_t> &keys,
+              const std::vector<std::uint32_t> &values )
+{
+    if( keys.size() != values.size() )
+        Malformed();
+    element.first_tag = block.tags.size();
+    element.tags = keys.size();
+    for( std::size_t i = 0; i < keys.size(); ++i )
+        block.tags.emplace_back(keys[i], values[i]);
+}
+
+void DecodeNode( Block &block, std::string_view message, const Coordinates &coords )
+{
+    ProtoReader reader{message};
+    std::int64_t id = 0, lat = 0, lon = 0;
+    while( reader.Next() ) {
+        switch( reader.Field() ) {
+            case 1: id = reader.Sint(); break;
+            case 8: lat = reader.Sint(); break;
+            case 9: lon = reader.Sint(); break;
+            default: reader.Skip();
+        }
+    }
+    block.nodes.push_back({id, coords.Lat(lat), coords.Lon(lon)});
+}
+
+void DecodeDenseNodes( Block &block, std::string_view message, const Coordinates &coords )
+{
+    std::vector<std::int64_t> ids, lats, lons;
+    ProtoReader reader{message};
+    while( reader.Next() ) {
+        switch( reader.Field() ) {
+            case 1: reader.Varints([&](auto v){ ids.emplace_back(Zigzag(v)); }); break;
+            case 8: reader.Varints([&](auto v){ lats.emplace_back(Zigzag(v)); }); break;
+            case 9: reader.Varints([&](auto v){ lons.emplace_back(Zigzag(v)); }); break;
+            default: reader.Skip();
+        }
+    }
+    if( ids.size() != lats.size() || ids.size() != lons.size() )
+        Malformed();
+
+    std::int64_t id = 0, lat = 0, lon = 0;
+    for( std::size_t i = 0; i < ids.size(); ++i ) {
+        id += ids[i];
+        lat += lats[i];
+        lon += lons[i];
+        block.nodes.push_back({id, coords.Lat(lat), coords.Lon(lon)});
+    }
+}
+
+void DecodeWay( Block &block, std::string_view message )
+{
+    Block::Element way{};
+    std::vector<std::uint32_t> keys, values;
+    way.first_ref = block.refs.size();
+    ProtoReader reader{message};
+    while( reader.Next() ) {
+        switch( reader.Field() ) {
+            case 1: way.id = (std::int64_t)reader.Varint(); break;
+            case 2: case 3: DecodeTags(reader, keys, values); break;
+            case 8: {
+                std::int64_t ref = 0;
+                reader.Varints([&](auto v){ block.refs.emplace_back(ref += Zigzag(v)); });
+                break;
+            }
+            default: reader.Skip();
+        }
+    }
+    way.refs = block.refs.size() - way.first_ref;
+    AddTags(block, way, keys, values);
+    block.ways.push_back(way);
+}
+
+void DecodeRelation( Block &block, std::string_view message )
+{
+    Block::Element relation{};
+    std::vector<std::uint32_t> keys, values, roles, types;
+    std::vector<std::int64_t> ids;
+    ProtoReader reader{message};
+    while( reader.Next() ) {
+        switch( reader.Field() ) {
+            case 1: relation.id = (std::int64_t)reader.Varint(); break;
+            case 2: case 3: DecodeTags(reader, keys, values); break;
+            case 8: reader.Varints([&](auto v){ roles.emplace_back((std::uint32_t)v); }); break;
+            case 9: {
+                std::int64_t ref = 0;
+                reader.Varints([&](auto v){ ids.emplace_back(ref += Zigzag(v)); });
+                break;
+            }
+            case 10: reader.Varints([&](auto v){ types.emplace_back((std::uint32_t)v); }); break;
+            default: reader.Skip();
+        }
+    }
+    if( roles.size() != ids.size() || types.size() != ids.size() )
+        Malformed();
+    relation.first_ref = block.members.size();
+    relation.refs = ids.size();
+    for( std::size_t i = 0; i < ids.size(); ++i )
+        block.members.push_back({ids[i], types[i], roles[i]});
+    AddTags(block, relation, keys, values);
+    block.relations.push_back(relation);
+}
+
+void DecodeBlock( std::string_view blob, Block &block )
+{
+    const auto data = Unpack(blob, block.buffer);
+
+    // The string table and the coordinate encoding may follow the groups, so find them first.
+    Coordinates coords;
+    std::vector<std::string_view> groups;
+    ProtoReader reader{data};
+    while( reader.Next() ) {
+        switch( reader.Field() ) {
+            case 1: {
+                ProtoReader table{reader.Bytes()};
+                while( table.Next() )
+                    if( table.Field() == 1 )
+                        block.strings.emplace_back(table.Bytes());
+                    else
+                        table.Skip();
+                break;
+            }
+            case 2: groups.emplace_back(reader.Bytes()); break;
+            case 17: coords.granularity = (std::int64_t)reader.Varint(); break;
+            case 19: coords.lat_offset = (std::int64_t)reader.Varint(); break;
+            case 20: coords.lon_offset = (std::int64_t)reader.Varint(); break;
+            default: reader.Skip();
+        }
+    }
+
+    for( auto group: groups ) {
+        ProtoReader elements{group};
+        while( elements.Next() ) {
+            switch( elements.Field() ) {
+                case 1: DecodeNode(block, elements.Bytes(), coords); break;
+                case 2: DecodeDenseNodes(block, elements.Bytes(), coords); break;
+                case 3: DecodeWay(block, elements.Bytes()); break;
+                case 4: DecodeRelation(block, elements.Bytes()); break;
+                default: elements.Skip();
+            }
+        }
+    }
+}
+
+void Replay( const Block &block, OsmHandler &handler )
+{
+    for( const auto &node: block.nodes )
+        handler.Node(node.id, node.lat, node.lon);
+
+    for( const auto &way: block.ways ) {
+        handler.BeginWay(way.id);
+        for( std::size_t i = 0; i < way.refs; ++i )
+            handler.WayNode(block.refs[way.first_ref + i]);
+        for( std::size_t i = 0; i < way.tags; ++i ) {
+            const auto &tag = block.tags[way.first_tag + i];
+            handler.Tag(block.String(tag.first), block.String(tag.second));
+        }
+        handler.EndWay();
+    }
+
+    static constexpr std::string_view member_types[] = {"node", "way", "relation"};
+    for( const auto &relation: block.relations ) {
+        handler.BeginRelation(relation.id);
+        for( std::size_t i = 0; i < relation.refs; ++i ) {
+            const auto &member = block.members[relation.first_ref + i];
+            handler.Member(member.type < 3 ? member_types[member.type] : std::string_view{},
+                           member.ref, block.String(member.role));
+        }
+        for( std::size_t i = 0; i < relation.tags; ++i ) {
+            const auto &tag = block.tags[relation.first_tag + i];
+            handler.Tag(block.String(tag.first), block.String(tag.second));
+        }
+        handler.EndRelation();
+    }
+}
+
+// Reads the bounding box and rejects files that need features this reader lacks.
+bool DecodeHeader( std::string_view blob, OsmHandler &handler )
+{
+    std::vector<char> buffer;
+    bool has_bounds = false;
+    ProtoReader reader{Unpack(blob, buffer)};
+    while( reader.Next() ) {
+        if( reader.Field() == 1 ) {
+            std::int64_t left = 0, right = 0, top = 0, bottom = 0;
+            ProtoReader bbox{reader.Bytes()};
+            while( bbox.Next() ) {
+                switch( bbox.Field() ) {
+                    case 1: left = bbox.Sint(); break;
+                    case 2: right = bbox.Sint(); break;
+                    case 3: top = bbox.Sint(); break;
+                    case 4: bottom = bbox.Sint(); break;
+                    default: bbox.Skip();
+                }
+            }
+            handler.Bounds((double)bottom / 1e9, (double)left / 1e9, (double)top / 1e9, (double)right / 1e9);
+            has_bounds = true;
+        }
+        else if( reader.Field() == 4 ) {
+            const auto feature = reader.Bytes();
+            if( feature != "OsmSchema-V0.6" && feature != "DenseNodes" )
+                throw std::logic_error("unsupported pbf feature: " + std::string{feature});
+        }
+        else
+            reader.Skip();
+    }
+    return has_bounds;
+}
+
+}
+
+bool IsOsmPbf( const std::byte *data, std::size_t size ) noexcept
+{
+    static constexpr char header_type[] = "\x0a\x09OSMHeader";
+    return data && size > 4 + sizeof(header_type) - 1 &&
+           memcmp(data + 4, header_type, sizeof(header_type) - 1) == 0;
+}
+
+void ParseOsmPbf( const std::byte *data, std::size_t size, OsmHandler &handler, std::size_t threads )
+{
+    const auto blobs = IndexBlobs(data, size);
+    threads = WorkerCount(threads);
+
+    bool has_bounds = false;
+    double min_lat = 90., min_lon = 180., max_lat = -90., max_lon = -180.;
+
+    // Blocks are decoded a window at a time, in parallel, and replayed in order.
+    std::vector<Block> window(threads);
+    std::vector<std::string_view> pending;
+    auto flush = [&] {
+        RunInParallel(pending.size(), [&](std::size_t i) {
+            window[i] = Block{};
+            DecodeBlock(pending[i], window[i]);
+        });
+        for( std::size_t i = 0; i < pending.size(); ++i ) {
+            if( !has_bounds )
+                for( const auto &node: window[i].nodes ) {
+                    min_lat = std::min(min_lat, node.lat);
+                    max_lat = std::max(max_lat, node.lat);
+                    min_lon = std::min(min_lon, node.lon);
+                    max_lon = std::max(max_lon, node.lon);
+                }
+            Replay(window[i], handler);
+            window[i] = Block{};
+        }
+        pending.clear();
+    };
+
+    for( const auto &blob: blobs ) {
+        if( blob.type == "OSMHeader" )
+            has_bounds = DecodeHeader(blob.blob, handler) || has_bounds;
+        else if( blob.type == "OSMData" ) {
+            pending.emplace_back(blob.blob);
+            if( pending.size() == threads )
+                flush();
+        }
+    }
+    flush();
+
+    // The header's bounding box is optional; fall back to the extent of the nodes.
+    if( !has_bounds ) {
+        if( min_lat > max_lat )
+            throw std::logic_error("map's bounds are not defined");
+        handler.Bounds(min_lat, min_lon, max_lat, max_lon);
+    }
+}
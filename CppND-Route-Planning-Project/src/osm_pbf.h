@@ -0,0 +1,13 @@
+#pragma once
+
+#include <cstddef>
+#include "osm_parser.h"
+
+// True if the buffer starts like an .osm.pbf file.
+bool IsOsmPbf( const std::byte *data, std::size_t size ) noexcept;
+
+// Reads an .osm.pbf file: a sequence of zlib-compressed (or raw) protobuf blocks. Blocks are
+// inflated and decoded on up to `threads` threads (0 means one per core) a window at a time,
+// so memory stays bounded, and are then reported to the handler in file order.
+// Throws std::logic_error on malformed input or on features this reader doesn't support.
+void ParseOsmPbf( const std::byte *data, std::size_t size, OsmHandler &handler, std::size_t threads );
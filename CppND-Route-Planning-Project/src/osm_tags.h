@@ -0,0 +1,50 @@
+#pragma once
+
+#include <cstdint>
+#include "model.h"
+#include "tag_table.h"
+
+// What a tag makes of the way or relation carrying it.
+struct TagClass {
+    enum Kind : std::uint8_t { Road, Railway, Building, Leisure, Water, Landuse };
+    Kind kind;
+    int type = 0;   // the Road::Type or Landuse::Type, for those kinds
+};
+
+// All tags the model classifies. Roads and landuses whose value isn't listed are ignored,
+// except that any landuse tag still settles what a relation is.
+inline constexpr TagEntry<TagClass> kTagEntries[] = {
+    {"highway",   "motorway",       {TagClass::Road, Model::Road::Motorway}},
+    {"highway",   "trunk",          {TagClass::Road, Model::Road::Trunk}},
+    {"highway",   "primary",        {TagClass::Road, Model::Road::Primary}},
+    {"highway",   "secondary",      {TagClass::Road, Model::Road::Secondary}},
+    {"highway",   "tertiary",       {TagClass::Road, Model::Road::Tertiary}},
+    {"highway",   "residential",    {TagClass::Road, Model::Road::Residential}},
+    {"highway",   "living_street",  {TagClass::Road, Model::Road::Residential}},
+    {"highway",   "service",        {TagClass::Road, Model::Road::Service}},
+    {"highway",   "unclassified",   {TagClass::Road, Model::Road::Unclassified}},
+    {"highway",   "footway",        {TagClass::Road, Model::Road::Footway}},
+    {"highway",   "bridleway",      {TagClass::Road, Model::Road::Footway}},
+    {"highway",   "steps",          {TagClass::Road, Model::Road::Footway}},
+    {"highway",   "path",           {TagClass::Road, Model::Road::Footway}},
+    {"highway",   "pedestrian",     {TagClass::Road, Model::Road::Footway}},
+    {"railway",   "*",              {TagClass::Railway}},
+    {"building",  "*",              {TagClass::Building}},
+    {"leisure",   "*",              {TagClass::Leisure}},
+    {"natural",   "wood",           {TagClass::Leisure}},
+    {"natural",   "tree_row",       {TagClass::Leisure}},
+    {"natural",   "scrub",          {TagClass::Leisure}},
+    {"natural",   "grassland",      {TagClass::Leisure}},
+    {"landcover", "grass",          {TagClass::Leisure}},
+    {"natural",   "water",          {TagClass::Water}},
+    {"landuse",   "commercial",     {TagClass::Landuse, Model::Landuse::Commercial}},
+    {"landuse",   "construction",   {TagClass::Landuse, Model::Landuse::Construction}},
+    {"landuse",   "grass",          {TagClass::Landuse, Model::Landuse::Grass}},
+    {"landuse",   "forest",         {TagClass::Landuse, Model::Landuse::Forest}},
+    {"landuse",   "industrial",     {TagClass::Landuse, Model::Landuse::Industrial}},
+    {"landuse",   "railway",        {TagClass::Landuse, Model::Landuse::Railway}},
+    {"landuse",   "residential",    {TagClass::Landuse, Model::Landuse::Residential}},
+    {"landuse",   "*",              {TagClass::Landuse, Model::Landuse::Invalid}},
+};
+
+inline constexpr TagTable kTags{kTagEntries};
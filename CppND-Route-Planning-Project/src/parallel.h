@@ -0,0 +1,46 @@
+#pragma once
+
+#include <cstddef>
+#include <exception>
+#include <thread>
+#include <vector>
+
+// Number of worker threads to use when the caller asked for `requested` (0 means one per core).
+inline std::size_t WorkerCount( std::size_t requested ) noexcept
+{
+    if( requested )
+        return requested;
+    const auto cores = std::thread::hardware_concurrency();
+    return cores ? cores : 1;
+}
+
+// Runs task(i) for every i in [0, count), each on its own thread (the last one on the calling
+// thread), waits for all of them and rethrows the first exception any of them threw.
+template <typename Task>
+void RunInParallel( std::size_t count, Task &&task )
+{
+    if( count == 0 )
+        return;
+
+    std::vector<std::exception_ptr> errors(count);
+    auto run = [&](std::size_t i) {
+        try {
+            task(i);
+        }
+        catch( ... ) {
+            errors[i] = std::current_exception();
+        }
+    };
+
+    std::vector<std::thread> threads;
+    threads.reserve(count - 1);
+    for( std::size_t i = 0; i + 1 < count; ++i )
+        threads.emplace_back(run, i);
+    run(count - 1);
+    for( auto &thread: threads )
+        thread.join();
+
+    for( auto &error: errors )
+        if( error )
+            std::rethrow_exception(error);
+}
@@ -0,0 +1,109 @@
+#include "projection.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+
+static constexpr double kPi = 3.14159265358979323846264338327950288;
+static constexpr double kDegToRad = 2. * kPi / 360.;
+static constexpr double kEarthRadius = 6378137.;
+
+double MercatorX( double lon ) noexcept
+{
+    return lon * kDegToRad / 2 * kEarthRadius;
+}
+
+double MercatorY( double lat ) noexcept
+{
+    return std::log(std::tan(lat * kDegToRad / 2 + kPi / 4)) / 2 * kEarthRadius;
+}
+
+// Taylor series of sin through x^21; below 1e-16 absolute error on [-pi/2, pi/2].
+static inline double Sin( double x ) noexcept
+{
+    const auto x2 = x * x;
+    auto p = -1. / 51090942171709440000.;
+    p = p * x2 + 1. / 121645100408832000.;
+    p = p * x2 - 1. / 355687428096000.;
+    p = p * x2 + 1. / 1307674368000.;
+    p = p * x2 - 1. / 6227020800.;
+    p = p * x2 + 1. / 39916800.;
+    p = p * x2 - 1. / 362880.;
+    p = p * x2 + 1. / 5040.;
+    p = p * x2 - 1. / 120.;
+    p = p * x2 + 1. / 6.;
+    return x - x * x2 * p;
+}
+
+// Natural log of t = (1 + s) / (1 - s) for t >= 1, i.e. 2 atanh(s). The exponent is taken from
+// t's bits, and the mantissa, scaled into [sqrt(1/2), sqrt(2)), goes through
+// log(m) = 2 atanh((m - 1) / (m + 1)), whose series converges fast there (|z| < 0.172).
+// When t needs no scaling, (m - 1) / (m + 1) is s itself, which is used as is: computing it
+// from t would cancel most of its digits for small s.
+static inline double Log( double t, double s ) noexcept
+{
+    std::uint64_t bits;
+    std::memcpy(&bits, &t, sizeof(bits));
+
+    // The exponent field converted to double with integer and float ops only, which vectorize
+    // without 64-bit integer conversions: 2^52 + field, minus 2^52.
+    std::uint64_t exponent_bits = (bits >> 52) | 0x4330000000000000ull;
+    double exponent;
+    std::memcpy(&exponent, &exponent_bits, sizeof(exponent));
+    exponent -= 4503599627370496. + 1023.;
+
+    bits = (bits & 0x000fffffffffffffull) | 0x3ff0000000000000ull;
+    double m;
+    std::memcpy(&m, &bits, sizeof(m));
+    // Selects rather than branches throughout, so the loop can be if-converted.
+    const auto high = m > 1.41421356237309504880;
+    m *= high ? 0.5 : 1.;
+    exponent += high ? 1. : 0.;
+
+    // The division must not depend on the select, or it gets sunk into a branch.
+    const auto unscaled = exponent == 0.;
+    const auto z = (unscaled ? s : m - 1.) / (unscaled ? 1. : m + 1.);
+    const auto z2 = z * z;
+    auto p = 1. / 23.;
+    p = p * z2 + 1. / 21.;
+    p = p * z2 + 1. / 19.;
+    p = p * z2 + 1. / 17.;
+    p = p * z2 + 1. / 15.;
+    p = p * z2 + 1. / 13.;
+    p = p * z2 + 1. / 11.;
+    p = p * z2 + 1. / 9.;
+    p = p * z2 + 1. / 7.;
+    p = p * z2 + 1. / 5.;
+    p = p * z2 + 1. / 3.;
+    const auto log_m = 2. * z + 2. * z * z2 * p;
+
+    // ln(2) split so that exponent * high part is exact.
+    constexpr auto ln2_high = 6.93147180369123816490e-01, ln2_low = 1.90821492927058770002e-10;
+    return exponent * ln2_high + (exponent * ln2_low + log_m);
+}
+
+// log(tan(pi/4 + phi/2)) == atanh(sin(phi)), odd in phi, and for a = |phi| and
+// psi = pi/4 - a/2: 1 - sin(a) = 2 sin(psi)^2 and 1 + sin(a) = 2 cos(psi)^2. Taking the
+// ratio from sin(psi) keeps full relative precision near the poles, where 1 - sin(a)
+// would cancel, and avoids tan altogether.
+void MercatorYBatch( double *lat_to_y, std::size_t count ) noexcept
+{
+    // Clamping happens in a pass of its own: folded into the main loop, the compiler would
+    // specialize the clamped case into a branch and give up on vectorizing it.
+    constexpr std::size_t block = 256;
+    constexpr auto max_a = 89.999999 * kDegToRad;
+    double a[block];
+    for( std::size_t begin = 0; begin < count; begin += block ) {
+        const auto lat = lat_to_y + begin;
+        const auto n = std::min(block, count - begin);
+        for( std::size_t i = 0; i < n; ++i )
+            a[i] = std::min(std::abs(lat[i]) * kDegToRad, max_a);
+        for( std::size_t i = 0; i < n; ++i ) {
+            const auto s = Sin(a[i]);
+            const auto u = Sin(kPi / 4 - a[i] / 2);
+            const auto u2 = u * u;
+            const auto y = Log((1. - u2) / u2, s) / 4 * kEarthRadius;
+            lat[i] = std::copysign(y, lat[i]);
+        }
+    }
+}
@@ -0,0 +1,15 @@
+#pragma once
+
+#include <cstddef>
+
+// Mercator projection of degrees to the model's metric units (half the usual Web Mercator
+// meters; Model only uses ratios of these).
+//
+// The scalar functions are the reference. MercatorYBatch() projects latitudes in place with
+// polynomial sin and log kernels written for auto-vectorization, accurate to 1e-14 relative
+// for |lat| <= 85.06 (the Web Mercator limit). The reference's log(tan()) loses relative
+// precision near the equator, so the two agree to 1e-7 m absolute rather than relative.
+// Latitudes beyond +-89.999999 are clamped there to keep results finite.
+double MercatorX( double lon ) noexcept;
+double MercatorY( double lat ) noexcept;
+void MercatorYBatch( double *lat_to_y, std::size_t count ) noexcept;
@@ -9,7 +9,7 @@ using namespace std::experimental;
 class Render
 {
 public:
-    Render(RouteModel &model );
+    Render(const RouteModel &model, std::vector<RouteModel::Node> path );
     void Display( io2d::output_surface &surface );
     
 private:
@@ -30,7 +30,8 @@ private:
     io2d::interpreted_path PathLine() const;
 
     
-    RouteModel &m_Model;
+    const RouteModel &m_Model;
+    std::vector<RouteModel::Node> m_Path;
     float m_Scale = 1.f;
     float m_PixelsInMeter = 1.f;
     io2d::matrix_2d m_Matrix;
@@ -0,0 +1,113 @@
+#include "ring_assembly.h"
+#include <unordered_map>
+
+std::vector<std::vector<int>> AssembleRings( const Csr<int> &ways, const std::vector<int> &open_ways,
+                                             std::chrono::steady_clock::time_point deadline )
+{
+    const auto count = open_ways.size();
+    std::vector<bool> used(count, false);   // in the current chain, or retired for good
+    std::vector<bool> retired(count, false);
+    std::unordered_map<int, std::vector<int>> ends;
+    std::unordered_map<int, int> degrees;
+    for( std::size_t i = 0; i < count; ++i ) {
+        const auto nodes = ways[open_ways[i]];
+        if( nodes.size() < 2 || nodes.front() == nodes.back() ) {
+            used[i] = retired[i] = true;
+            continue;
+        }
+        for( auto node: {nodes.front(), nodes.back()} ) {
+            ends[node].emplace_back((int)i);
+            ++degrees[node];
+        }
+    }
+
+    std::vector<int> dead_ends;
+    for( auto [node, degree]: degrees )
+        if( degree == 1 )
+            dead_ends.emplace_back(node);
+    auto retire = [&](int way) {
+        used[way] = retired[way] = true;
+        const auto nodes = ways[open_ways[way]];
+        for( auto node: {nodes.front(), nodes.back()} )
+            if( --degrees[node] == 1 )
+                dead_ends.emplace_back(node);
+    };
+    auto prune = [&] {
+        while( !dead_ends.empty() ) {
+            const auto node = dead_ends.back();
+            dead_ends.pop_back();
+            if( degrees[node] != 1 )
+                continue;
+            for( auto way: ends[node] )
+                if( !retired[way] ) {
+                    retire(way);
+                    break;
+                }
+        }
+    };
+    auto next_way = [&](int node) {
+        if( auto it = ends.find(node); it != ends.end() )
+            for( auto i: it->second )
+                if( !used[i] )
+                    return i;
+        return -1;
+    };
+
+    struct Link { int way; bool reversed; };
+    std::vector<std::vector<int>> rings;
+    std::vector<Link> chain;
+    std::unordered_map<int, std::size_t> entries;   // node -> first link entered there
+    std::size_t steps = 0;
+    prune();
+    for( std::size_t start = 0; start < count; ) {
+        if( used[start] ) {
+            ++start;
+            continue;
+        }
+        chain.assign(1, Link{(int)start, false});
+        entries.clear();
+        used[start] = true;
+        const auto first = ways[open_ways[start]];
+        entries.emplace(first.front(), 0);
+        auto tail = first.back();
+
+        while( true ) {
+            if( ++steps % 1024 == 0 && std::chrono::steady_clock::now() > deadline )
+                return rings;
+
+            if( auto entry = entries.find(tail); entry != entries.end() ) {
+                std::vector<int> ring;
+                for( auto link = chain.begin() + entry->second; link != chain.end(); ++link ) {
+                    const auto nodes = ways[open_ways[link->way]];
+                    if( link->reversed )
+                        ring.insert(ring.end(), nodes.rbegin(), nodes.rend());
+                    else
+                        ring.insert(ring.end(), nodes.begin(), nodes.end());
+                    retire(link->way);
+                }
+                for( std::size_t i = 0; i < entry->second; ++i )
+                    used[chain[i].way] = false;
+                rings.emplace_back(std::move(ring));
+                prune();
+                break;
+            }
+
+            const auto next = next_way(tail);
+            if( next < 0 ) {
+                // Only reachable if pruning missed something; drop the start and move on.
+                for( std::size_t i = 1; i < chain.size(); ++i )
+                    used[chain[i].way] = false;
+                retire(chain.front().way);
+                prune();
+                break;
+            }
+            const auto nodes = ways[open_ways[next]];
+            const auto reversed = nodes.front() != tail;
+            used[next] = true;
+            entries.emplace(tail, chain.size());
+            chain.push_back({next, reversed});
+            tail = reversed ? nodes.front() : nodes.back();
+        }
+    }
+    return rings;
+}
@@ -0,0 +1,20 @@
+#pragma once
+
+#include <chrono>
+#include <vector>
+#include "csr.h"
+
+// Joins open ways, given as their rows in `ways`, into rings. A hash of the ways' endpoints
+// finds each next way in O(1) instead of scanning all of them. Ways are taken in order: a
+// ring starts at the first unused way and always continues with the first unused way that
+// shares its current end, just like an exhaustive search would on well-formed data. Rings
+// keep the shared node of each joint twice.
+//
+// Broken data is handled without backtracking. Ways hanging off an endpoint that no other
+// way shares can't be part of any ring, so they are pruned up front, and again whenever
+// taking out a ring leaves new dead ends. A chain then can't get stuck; if it loops back
+// into itself rather than to its start, the loop is the ring and the ways leading into it
+// are put back. Whatever can't be joined is dropped, and assembly stops with the rings it
+// has once `deadline` passes.
+std::vector<std::vector<int>> AssembleRings( const Csr<int> &ways, const std::vector<int> &open_ways,
+                                             std::chrono::steady_clock::time_point deadline );
@@ -1,77 +1,788 @@
 #include "route_model.h"
+#include "parallel.h"
+#include <algorithm>
 #include <iostream>
+#include <optional>
+#include <stdexcept>
+#include <type_traits>
 
-RouteModel::RouteModel(const std::vector<std::byte> &xml) : Model(xml) {
-    // Create RouteModel nodes.
-    std::vector<Model::Node> vectorForthisNode = this->Nodes();
+static constexpr auto kNodeToRoadSection = BinaryMap::Tag("N2RD");
+static constexpr auto kAdjacencySection = BinaryMap::Tag("ADJC");
+static constexpr auto kSnapIndexSection = BinaryMap::Tag("SNAP");
+// Below this many nodes per thread, building the adjacency graph isn't worth a thread.
+static constexpr std::size_t kMinAdjacencyChunk = 1 << 14;
+// Likewise for points per thread when snapping a batch.
+static constexpr std::size_t kMinSnapChunk = 1 << 12;
+// Queries scan the nodes, or segments, that changes added or moved besides the k-d tree, or
+// the segment index; past this many changes, that is rebuilt instead.
+static constexpr std::size_t kMaxSnapChanges = 1 << 10;
 
-    for (int count = 0; count < vectorForthisNode.size(); count++) {
-        m_Nodes.push_back(Node(count, this, vectorForthisNode[count]));
+static bool IsRoutable(const Model::Road &road) {
+    return road.type != Model::Road::Type::Footway && road.type != Model::Road::Type::Invalid;
+}
+
+RouteModel::RouteModel(const std::vector<std::byte> &xml) : RouteModel(xml, LoadOptions{}) {}
+
+RouteModel::RouteModel(const std::vector<std::byte> &xml, const LoadOptions &options) : RouteModel(xml.data(), xml.size(), options) {}
+
+RouteModel::RouteModel(const std::byte *data, std::size_t size, const LoadOptions &options) : Model(data, size, options) {
+    if (GetProfile() == LoadOptions::Profile::Render) {
+        return;
+    }
+
+    // A compiled map carries the routing index; its checksum was already verified by Model.
+    std::optional<BinaryMap::Reader> compiled;
+    if (BinaryMap::Recognize(data, size)) {
+        compiled.emplace(data, size, false);
+    }
+    m_LoadStats.BeginPhase("node-to-road index");
+    if (compiled && compiled->Has(kNodeToRoadSection)) {
+        LoadNodeToRoadIndex(*compiled);
+    } else {
+        CreateNodeToRoadIndex();
+    }
+
+    m_LoadStats.BeginPhase("adjacency");
+    if (!compiled || !LoadAdjacency(*compiled)) {
+        BuildAdjacency(options.threads);
+    }
+    m_LoadStats.BeginPhase("snap indices");
+    if (!compiled || !LoadSnapIndex(*compiled)) {
+        BuildSnapIndex();
+    }
+    m_LoadStats.EndPhase();
+}
+
+
+void RouteModel::BuildAdjacency(std::size_t threads) {
+    const auto count = Nodes().size();
+    const auto chunks = std::max<std::size_t>(1, std::min(WorkerCount(threads), count / kMinAdjacencyChunk));
+    std::vector<Adjacency> parts(chunks);
+    RunInParallel(chunks, [&](std::size_t chunk) {
+        for (auto node = count * chunk / chunks; node < count * (chunk + 1) / chunks; node++) {
+            AddAdjacency((int)node, parts[chunk]);
+        }
+    });
+
+    m_Adjacency = std::move(parts[0]);
+    for (std::size_t i = 1; i < parts.size(); i++) {
+        m_Adjacency.ways.Append(parts[i].ways);
+        m_Adjacency.candidates.Append(parts[i].candidates);
+    }
+}
+
+
+// Adds the node's row to the graph. Candidates are ordered by distance, then by position in
+// the way, which is the order in which FindNeighbor() prefers them.
+void RouteModel::AddAdjacency(int node, Adjacency &adjacency) const {
+    adjacency.ways.AddRow();
+    const auto nodes = SNodes();
+    const auto from = nodes[node];
+    std::vector<std::pair<float, int>> by_distance;
+    for (int road : RoadsOf(node)) {
+        const auto way = Roads()[road].way;
+        const auto way_nodes = Ways()[way].nodes;
+        by_distance.clear();
+        for (int i = 0; i < (int)way_nodes.size(); i++) {
+            if (float d = from.distance(nodes[way_nodes[i]]); d != 0) {
+                by_distance.emplace_back(d, i);
+            }
+        }
+        const auto kept = std::min(kNeighborCandidates, by_distance.size());
+        std::partial_sort(by_distance.begin(), by_distance.begin() + kept, by_distance.end());
+
+        adjacency.ways.Push(way);
+        adjacency.candidates.AddRow();
+        for (std::size_t i = 0; i < kept; i++) {
+            adjacency.candidates.Push({way_nodes[by_distance[i].second], by_distance[i].first});
+        }
+    }
+}
+
+
+void RouteModel::BuildSnapIndex() {
+    BuildNodeSnapIndex();
+    BuildSegmentIndex();
+}
+
+
+void RouteModel::BuildNodeSnapIndex() {
+    const auto nodes = Nodes();
+    std::vector<bool> seen(nodes.size());
+    std::vector<KdTree::Point> points;
+    m_SnapNodes.clear();
+    for (int road = 0; road < (int)Roads().size(); road++) {
+        if (!IsRoutable(Roads()[road])) {
+            continue;
+        }
+        for (int node_idx : Ways()[Roads()[road].way].nodes) {
+            if (!seen[node_idx]) {
+                seen[node_idx] = true;
+                m_SnapNodes.push_back(node_idx);
+                points.push_back({nodes[node_idx].x, nodes[node_idx].y});
+            }
+        }
     }
-    CreateNodeToRoadHashmap();
+    m_SnapIndex = KdTree(std::move(points));
+    m_SnapPositions.clear();
+    m_SnapRemoved.clear();
+    m_SnapRemovedCount = 0;
+    m_SnapAdded.clear();
 }
 
 
-void RouteModel::CreateNodeToRoadHashmap() {
+void RouteModel::BuildSegmentIndex() {
+    std::vector<SegmentIndex::Segment> segments;
+    m_SnapSegments.clear();
+    for (int road = 0; road < (int)Roads().size(); road++) {
+        if (!IsRoutable(Roads()[road])) {
+            continue;
+        }
+        for (int i = 0; i + 1 < (int)Ways()[Roads()[road].way].nodes.size(); i++) {
+            m_SnapSegments.emplace_back(road, i);
+            segments.push_back(SegmentAt(road, i));
+        }
+    }
+    m_SegmentIndex = SegmentIndex(std::move(segments));
+    m_SegmentRemoved.clear();
+    m_SegmentRemovedCount = 0;
+    m_SegmentsAdded.clear();
+}
+
+
+// Segments are indexed in road order, so a road's segments are one run of m_SnapSegments. A
+// changed road's segments all leave the index, and those of a moved node's roads that end at
+// it; those still on a routable road are checked besides the index, at their current position.
+void RouteModel::UpdateSegmentIndex() {
+    std::sort(m_SegmentRoadsChanged.begin(), m_SegmentRoadsChanged.end());
+    m_SegmentRoadsChanged.erase(std::unique(m_SegmentRoadsChanged.begin(), m_SegmentRoadsChanged.end()),
+                                m_SegmentRoadsChanged.end());
+    std::sort(m_SegmentsMoved.begin(), m_SegmentsMoved.end());
+    m_SegmentsMoved.erase(std::unique(m_SegmentsMoved.begin(), m_SegmentsMoved.end()), m_SegmentsMoved.end());
+    if (m_SegmentRemoved.empty()) {
+        m_SegmentRemoved.assign(m_SnapSegments.size(), false);
+    }
+    auto remove = [this](std::size_t position) {
+        if (!m_SegmentRemoved[position]) {
+            m_SegmentRemoved[position] = true;
+            m_SegmentRemovedCount++;
+        }
+    };
+    auto road_changed = [this](int road) {
+        return std::binary_search(m_SegmentRoadsChanged.begin(), m_SegmentRoadsChanged.end(), road);
+    };
+
+    m_SegmentsAdded.erase(std::remove_if(m_SegmentsAdded.begin(), m_SegmentsAdded.end(),
+                                         [&](const auto &added) { return road_changed(added.first); }),
+                          m_SegmentsAdded.end());
+    for (int road : m_SegmentRoadsChanged) {
+        const auto first = std::lower_bound(m_SnapSegments.begin(), m_SnapSegments.end(), std::make_pair(road, 0));
+        for (auto it = first; it != m_SnapSegments.end() && it->first == road; ++it) {
+            remove(it - m_SnapSegments.begin());
+        }
+        if (IsRoutable(Roads()[road])) {
+            for (int i = 0; i + 1 < (int)Ways()[Roads()[road].way].nodes.size(); i++) {
+                m_SegmentsAdded.emplace_back(road, i);
+            }
+        }
+    }
+    for (const auto &moved : m_SegmentsMoved) {
+        if (road_changed(moved.first)) {
+            continue;
+        }
+        const auto it = std::lower_bound(m_SnapSegments.begin(), m_SnapSegments.end(), moved);
+        if (it != m_SnapSegments.end() && *it == moved) {
+            remove(it - m_SnapSegments.begin());
+        }
+        if (std::find(m_SegmentsAdded.begin(), m_SegmentsAdded.end(), moved) == m_SegmentsAdded.end()) {
+            m_SegmentsAdded.push_back(moved);
+        }
+    }
+    m_SegmentRoadsChanged.clear();
+    m_SegmentsMoved.clear();
+    if (m_SegmentsAdded.size() + m_SegmentRemovedCount > kMaxSnapChanges) {
+        BuildSegmentIndex();
+    }
+}
+
+
+// A node that moved or left the roads leaves the tree; one that moved or joined the roads is
+// checked besides it, at its current position.
+void RouteModel::UpdateNodeSnapIndex() {
+    std::sort(m_SnapChanged.begin(), m_SnapChanged.end());
+    m_SnapChanged.erase(std::unique(m_SnapChanged.begin(), m_SnapChanged.end()), m_SnapChanged.end());
+    std::sort(m_SnapMoved.begin(), m_SnapMoved.end());
+    if (m_SnapPositions.empty()) {
+        m_SnapPositions.assign(m_SnapNodes.empty() ? 0 : *std::max_element(m_SnapNodes.begin(), m_SnapNodes.end()) + 1, -1);
+        for (int i = 0; i < (int)m_SnapNodes.size(); i++) {
+            m_SnapPositions[m_SnapNodes[i]] = i;
+        }
+        m_SnapRemoved.assign(m_SnapNodes.size(), false);
+    }
+    for (int node : m_SnapChanged) {
+        const bool on_road = !RoadsOf(node).empty();
+        const bool moved = std::binary_search(m_SnapMoved.begin(), m_SnapMoved.end(), node);
+        const int position = node < (int)m_SnapPositions.size() ? m_SnapPositions[node] : -1;
+        const bool in_tree = position >= 0 && !m_SnapRemoved[position];
+        if (in_tree && on_road && !moved) {
+            continue;
+        }
+        if (in_tree) {
+            m_SnapRemoved[position] = true;
+            m_SnapRemovedCount++;
+        }
+        const auto added = std::find(m_SnapAdded.begin(), m_SnapAdded.end(), node);
+        if (!on_road && added != m_SnapAdded.end()) {
+            m_SnapAdded.erase(added);
+        } else if (on_road && added == m_SnapAdded.end()) {
+            m_SnapAdded.push_back(node);
+        }
+    }
+    m_SnapChanged.clear();
+    m_SnapMoved.clear();
+    if (m_SnapAdded.size() + m_SnapRemovedCount > kMaxSnapChanges) {
+        BuildNodeSnapIndex();
+    }
+}
+
+
+// Changed roads and moved nodes change the candidates of every node on the affected ways.
+void RouteModel::MarkAdjacencyStale(Span<int> nodes) {
+    m_StaleAdjacency.insert(m_StaleAdjacency.end(), nodes.begin(), nodes.end());
+}
+
+
+void RouteModel::OnChangeApplied() {
+    if (GetProfile() == LoadOptions::Profile::Render) {
+        return;
+    }
+    std::sort(m_StaleAdjacency.begin(), m_StaleAdjacency.end());
+    m_StaleAdjacency.erase(std::unique(m_StaleAdjacency.begin(), m_StaleAdjacency.end()), m_StaleAdjacency.end());
+    for (int node : m_StaleAdjacency) {
+        Adjacency adjacency;
+        AddAdjacency(node, adjacency);
+        m_ChangedAdjacency[node] = std::move(adjacency);
+    }
+    m_StaleAdjacency.clear();
+
+    if (!m_SnapChanged.empty()) {
+        UpdateNodeSnapIndex();
+    }
+    if (!m_SegmentRoadsChanged.empty() || !m_SegmentsMoved.empty()) {
+        UpdateSegmentIndex();
+    }
+}
+
+
+void RouteModel::AddMemoryUsage(LoadStats &stats) const {
+    Model::AddMemoryUsage(stats);
+
+
+    stats.containers.push_back({"node-to-road index", node_to_road.Size(), node_to_road.MemoryUsage()});
+    std::size_t road_bytes = 0;
+    for (const auto &[node, roads] : node_to_road_changes) {
+        road_bytes += roads.capacity() * sizeof(int);
+    }
+    stats.AddHashMap("node-to-road changes", node_to_road_changes, road_bytes);
+
+    const auto adjacency_bytes = m_Adjacency.ways.Offsets().size() * sizeof(std::uint32_t) +
+                                 m_Adjacency.ways.Values().size() * sizeof(int) +
+                                 m_Adjacency.candidates.Offsets().size() * sizeof(std::uint32_t) +
+                                 m_Adjacency.candidates.Values().size() * sizeof(Neighbor);
+    stats.containers.push_back({"adjacency", m_Adjacency.ways.Values().size(), adjacency_bytes});
+    stats.containers.push_back({"snap index", m_SnapIndex.Size() + m_SnapAdded.size(),
+                                m_SnapIndex.MemoryUsage() + m_SnapNodes.capacity() * sizeof(int) +
+                                m_SnapPositions.capacity() * sizeof(int) + m_SnapRemoved.capacity() / 8 +
+                                m_SnapAdded.capacity() * sizeof(int)});
+    stats.containers.push_back({"segment index", m_SegmentIndex.Size() + m_SegmentsAdded.size(),
+                                m_SegmentIndex.MemoryUsage() +
+                                (m_SnapSegments.capacity() + m_SegmentsAdded.capacity()) * sizeof(std::pair<int, int>) +
+                                m_SegmentRemoved.capacity() / 8});
+}
+
+
+// Two passes over the roads: one counts each node's roads to size the rows, the other fills
+// them in, so each node lists its roads in Roads() order, once per occurrence in the way.
+void RouteModel::CreateNodeToRoadIndex() {
+    std::vector<std::uint32_t> offsets(Nodes().size() + 1, 0);
     for (const Model::Road &road : Roads()) {
-        if (road.type != Model::Road::Type::Footway) {
+        if (IsRoutable(road)) {
             for (int node_idx : Ways()[road.way].nodes) {
-                if (node_to_road.find(node_idx) == node_to_road.end()) {
-                    node_to_road[node_idx] = std::vector<const Model::Road *> ();
+                offsets[node_idx + 1]++;
+            }
+        }
+    }
+    for (std::size_t i = 1; i < offsets.size(); i++) {
+        if (offsets[i] > std::numeric_limits<std::uint32_t>::max() - offsets[i - 1]) {
+            throw std::length_error("too many values for a compressed list");
+        }
+        offsets[i] += offsets[i - 1];
+    }
+
+    std::vector<int> roads(offsets.back());
+    std::vector<std::uint32_t> next(offsets.begin(), offsets.end() - 1);
+    for (int road = 0; road < (int)Roads().size(); road++) {
+        if (IsRoutable(Roads()[road])) {
+            for (int node_idx : Ways()[Roads()[road].way].nodes) {
+                roads[next[node_idx]++] = road;
+            }
+        }
+    }
+    node_to_road = Csr<int>(std::move(offsets), std::move(roads));
+}
+
+
+Span<int> RouteModel::RoadsOf(int node) const {
+    if (!node_to_road_changes.empty()) {
+        if (auto it = node_to_road_changes.find(node); it != node_to_road_changes.end()) {
+            return {it->second.data(), it->second.data() + it->second.size()};
+        }
+    }
+    if (node < (int)node_to_road.Size()) {
+        return node_to_road[node];
+    }
+    return {};
+}
+
+
+// The node's roads, moved into node_to_road_changes for editing.
+std::vector<int> &RouteModel::ChangedRoadsOf(int node) {
+    auto [it, inserted] = node_to_road_changes.try_emplace(node);
+    if (inserted && node < (int)node_to_road.Size()) {
+        it->second.assign(node_to_road[node].begin(), node_to_road[node].end());
+    }
+    return it->second;
+}
+
+
+void RouteModel::IndexRoad(int road) {
+    const Model::Road &r = Roads()[road];
+    if (IsRoutable(r)) {
+        for (int node_idx : Ways()[r.way].nodes) {
+            ChangedRoadsOf(node_idx).push_back(road);
+        }
+    }
+}
+
+
+void RouteModel::OnNodeChanged(int node) {
+    if (GetProfile() == LoadOptions::Profile::Render) {
+        return;
+    }
+    MarkAdjacencyStale({&node, &node + 1});
+    m_SnapChanged.push_back(node);
+    m_SnapMoved.push_back(node);
+    for (int road : RoadsOf(node)) {
+        const auto way_nodes = Ways()[Roads()[road].way].nodes;
+        MarkAdjacencyStale(way_nodes);
+        for (int i = 0; i < (int)way_nodes.size(); i++) {
+            if (way_nodes[i] == node) {
+                if (i > 0) {
+                    m_SegmentsMoved.emplace_back(road, i - 1);
+                }
+                if (i + 1 < (int)way_nodes.size()) {
+                    m_SegmentsMoved.emplace_back(road, i);
                 }
-                node_to_road[node_idx].push_back(&road);
             }
         }
     }
 }
 
 
-RouteModel::Node *RouteModel::Node::FindNeighbor(std::vector<int> node_indices){
-    Node *closest_node = nullptr;
-    Node node;
+void RouteModel::OnRoadChanged(int road, int old_way) {
+    if (GetProfile() == LoadOptions::Profile::Render) {
+        return;
+    }
+    if (old_way >= 0) {
+        for (int node_idx : Ways()[old_way].nodes) {
+            auto &roads = ChangedRoadsOf(node_idx);
+            roads.erase(std::remove(roads.begin(), roads.end(), road), roads.end());
+        }
+        MarkAdjacencyStale(Ways()[old_way].nodes);
+        m_SnapChanged.insert(m_SnapChanged.end(), Ways()[old_way].nodes.begin(), Ways()[old_way].nodes.end());
+    }
+    IndexRoad(road);
+    const auto way_nodes = Ways()[Roads()[road].way].nodes;
+    m_SnapChanged.insert(m_SnapChanged.end(), way_nodes.begin(), way_nodes.end());
+    m_SegmentRoadsChanged.push_back(road);
+    if (Roads()[road].type != Model::Road::Type::Invalid) {
+        MarkAdjacencyStale(Ways()[Roads()[road].way].nodes);
+    }
+}
+
+
+// The node-to-road index is stored as, per node, an offset into a list of indices into Roads(),
+// and the adjacency graph and the snap indices in their own layouts, with the precision of the
+// coordinates they were computed from. Render models have none to store; loading their maps
+// builds them.
+void RouteModel::WriteSections(BinaryMap::Writer &writer) const {
+    Model::WriteSections(writer);
+    if (GetProfile() == LoadOptions::Profile::Render) {
+        return;
+    }
+
+    std::vector<std::uint32_t> offsets{0};
+    std::vector<int> roads;
+    for (int node_idx = 0; node_idx < (int)Nodes().size(); node_idx++) {
+        const auto node_roads = RoadsOf(node_idx);
+        roads.insert(roads.end(), node_roads.begin(), node_roads.end());
+        offsets.push_back((std::uint32_t)roads.size());
+    }
+    writer.BeginSection(kNodeToRoadSection);
+    writer.Array(std::move(offsets));
+    writer.Array(std::move(roads));
+
+    static_assert(std::is_trivially_copyable_v<Neighbor>);
+    writer.BeginSection(kAdjacencySection);
+    writer.Array(std::vector<std::uint32_t>{(std::uint32_t)GetPrecision()});
+    if (m_ChangedAdjacency.empty() && m_Adjacency.ways.Size() == Nodes().size()) {
+        writer.Array(m_Adjacency.ways.Offsets());
+        writer.Array(m_Adjacency.ways.Values());
+        writer.Array(m_Adjacency.candidates.Offsets());
+        writer.Array(m_Adjacency.candidates.Values());
+    } else {
+        // Changes leave rows of the graph in m_ChangedAdjacency, and nodes they added past its end.
+        Adjacency merged;
+        for (int node_idx = 0; node_idx < (int)Nodes().size(); node_idx++) {
+            const Adjacency *from = &m_Adjacency;
+            std::size_t row = node_idx;
+            if (auto it = m_ChangedAdjacency.find(node_idx); it != m_ChangedAdjacency.end()) {
+                from = &it->second;
+                row = 0;
+            } else if (row >= m_Adjacency.ways.Size()) {
+                merged.ways.AddRow();
+                continue;
+            }
+            const auto ways = from->ways[row];
+            merged.ways.AddRow(ways.begin(), ways.end());
+            for (std::size_t i = 0; i < ways.size(); i++) {
+                const auto candidates = from->candidates[from->ways.Offsets()[row] + i];
+                merged.candidates.AddRow(candidates.begin(), candidates.end());
+            }
+        }
+        auto [way_offsets, ways] = std::move(merged.ways).Release();
+        auto [candidate_offsets, candidates] = std::move(merged.candidates).Release();
+        writer.Array(std::move(way_offsets));
+        writer.Array(std::move(ways));
+        writer.Array(std::move(candidate_offsets));
+        writer.Array(std::move(candidates));
+    }
+
+    // Snap indices that changes left nodes or segments beside are left out; loading builds them.
+    if (m_SnapRemovedCount > 0 || !m_SnapAdded.empty() || m_SegmentRemovedCount > 0 || !m_SegmentsAdded.empty()) {
+        return;
+    }
+    std::vector<int> segment_roads, segment_positions;
+    for (const auto &[road, segment] : m_SnapSegments) {
+        segment_roads.push_back(road);
+        segment_positions.push_back(segment);
+    }
+    writer.BeginSection(kSnapIndexSection);
+    writer.Array(std::vector<std::uint32_t>{(std::uint32_t)GetPrecision()});
+    writer.Array(m_SnapNodes);
+    m_SnapIndex.Write(writer);
+    writer.Array(std::move(segment_roads));
+    writer.Array(std::move(segment_positions));
+    m_SegmentIndex.Write(writer);
+}
+
+
+// The section is stored in the layout of node_to_road, so it's adopted as is.
+void RouteModel::LoadNodeToRoadIndex(const BinaryMap::Reader &reader) {
+    std::vector<std::uint32_t> offsets;
+    std::vector<int> roads;
+    auto cursor = reader.Section(kNodeToRoadSection);
+    cursor.Array(offsets);
+    cursor.Array(roads);
+    Csr<int> index(std::move(offsets), std::move(roads));
+    if (!index.Valid() || index.Size() != Nodes().size()) {
+        throw std::logic_error("the compiled map file is corrupted");
+    }
+    for (int road : index.Values()) {
+        if (road < 0 || road >= (int)Roads().size()) {
+            throw std::logic_error("the compiled map file is corrupted");
+        }
+    }
+    node_to_road = std::move(index);
+}
+
+
+static bool SamePrecision(BinaryMap::Reader::Cursor &cursor, CoordStore::Precision precision) {
+    std::vector<std::uint32_t> stored;
+    cursor.Array(stored);
+    if (stored.size() != 1) {
+        throw std::logic_error("the compiled map file is corrupted");
+    }
+    return stored[0] == (std::uint32_t)precision;
+}
+
+
+// Adopted as is, like the node-to-road index, unless the map was compiled with double
+// coordinates and loaded at a lower precision, which moves the nodes the distances are from.
+bool RouteModel::LoadAdjacency(const BinaryMap::Reader &reader) {
+    if (!reader.Has(kAdjacencySection)) {
+        return false;
+    }
+    auto cursor = reader.Section(kAdjacencySection);
+    if (!SamePrecision(cursor, GetPrecision())) {
+        return false;
+    }
+    std::vector<std::uint32_t> way_offsets, candidate_offsets;
+    std::vector<int> ways;
+    std::vector<Neighbor> candidates;
+    cursor.Array(way_offsets);
+    cursor.Array(ways);
+    cursor.Array(candidate_offsets);
+    cursor.Array(candidates);
+    Adjacency adjacency{Csr<int>(std::move(way_offsets), std::move(ways)),
+                        Csr<Neighbor>(std::move(candidate_offsets), std::move(candidates))};
+    if (!adjacency.ways.Valid() || !adjacency.candidates.Valid() || adjacency.ways.Size() != Nodes().size() ||
+        adjacency.candidates.Size() != adjacency.ways.Values().size()) {
+        throw std::logic_error("the compiled map file is corrupted");
+    }
+    for (int way : adjacency.ways.Values()) {
+        if (way < 0 || way >= (int)Ways().size()) {
+            throw std::logic_error("the compiled map file is corrupted");
+        }
+    }
+    for (const Neighbor &candidate : adjacency.candidates.Values()) {
+        if (candidate.node < 0 || candidate.node >= (int)Nodes().size()) {
+            throw std::logic_error("the compiled map file is corrupted");
+        }
+    }
+    m_Adjacency = std::move(adjacency);
+    return true;
+}
+
+
+bool RouteModel::LoadSnapIndex(const BinaryMap::Reader &reader) {
+    if (!reader.Has(kSnapIndexSection)) {
+        return false;
+    }
+    auto cursor = reader.Section(kSnapIndexSection);
+    if (!SamePrecision(cursor, GetPrecision())) {
+        return false;
+    }
+    std::vector<int> segment_roads, segment_positions;
+    cursor.Array(m_SnapNodes);
+    m_SnapIndex.Read(cursor);
+    cursor.Array(segment_roads);
+    cursor.Array(segment_positions);
+    m_SegmentIndex.Read(cursor);
+
+    bool valid = m_SnapIndex.Size() == m_SnapNodes.size() && segment_roads.size() == segment_positions.size() &&
+                 m_SegmentIndex.Size() == segment_roads.size();
+    for (int node : m_SnapNodes) {
+        valid = valid && node >= 0 && node < (int)Nodes().size();
+    }
+    m_SnapSegments.clear();
+    for (std::size_t i = 0; valid && i < segment_roads.size(); i++) {
+        const int road = segment_roads[i], segment = segment_positions[i];
+        valid = road >= 0 && road < (int)Roads().size() && segment >= 0 &&
+                segment + 1 < (int)Ways()[Roads()[road].way].nodes.size();
+        m_SnapSegments.emplace_back(road, segment);
+    }
+    if (!valid) {
+        throw std::logic_error("the compiled map file is corrupted");
+    }
+    return true;
+}
+
+
+// The index of the nearest unvisited node, or -1 if all are visited.
+int RouteModel::FindNeighbor(const Node &node, Span<int> node_indices, const SearchState &state) const {
+    const auto nodes = SNodes();
+    int closest_idx = -1;
+    float closest_dist = 0;
 
     for (int node_index : node_indices) {
-        node = parent_model->SNodes()[node_index];
-        if (this->distance(node) != 0 && !node.visited) {
-            if (closest_node == nullptr || this->distance(node) < this->distance(*closest_node)) {
-                closest_node = &parent_model->SNodes()[node_index];
+        float dist = node.distance(nodes[node_index]);
+        if (dist != 0 && !state.Visited(node_index)) {
+            if (closest_idx < 0 || dist < closest_dist) {
+                closest_idx = node_index;
+                closest_dist = dist;
             }
         }
     }
-    return closest_node;
+    return closest_idx;
 }
 
 
-void RouteModel::Node::FindNeighbors() {
-    for (auto & road : parent_model->node_to_road[this->index]) {
-        RouteModel::Node *new_neighbor = this->FindNeighbor(parent_model->Ways()[road->way].nodes);
-        if (new_neighbor) {
-            this->neighbors.emplace_back(new_neighbor);
+// The nearest unvisited node of each road through the node: the first unvisited candidate,
+// or, if a full candidate list is all visited, whichever FindNeighbor() finds in the whole way.
+void RouteModel::FindNeighbors(const Node &node, SearchState &state) const {
+    const Adjacency *adjacency = &m_Adjacency;
+    std::size_t row = node.Index();
+    if (!m_ChangedAdjacency.empty()) {
+        if (auto it = m_ChangedAdjacency.find(node.Index()); it != m_ChangedAdjacency.end()) {
+            adjacency = &it->second;
+            row = 0;
+        }
+    }
+
+    const auto ways = adjacency->ways[row];
+    const auto first = adjacency->ways.Offsets()[row];
+    for (std::size_t i = 0; i < ways.size(); i++) {
+        const auto candidates = adjacency->candidates[first + i];
+        int new_neighbor = -1;
+        float new_distance = 0;
+        for (const Neighbor &candidate : candidates) {
+            if (!state.Visited(candidate.node)) {
+                new_neighbor = candidate.node;
+                new_distance = candidate.distance;
+                break;
+            }
+        }
+        if (new_neighbor < 0 && candidates.size() == kNeighborCandidates) {
+            new_neighbor = FindNeighbor(node, Ways()[ways[i]].nodes, state);
+            new_distance = new_neighbor >= 0 ? node.distance(SNodes()[new_neighbor]) : 0;
+        }
+        if (new_neighbor >= 0) {
+            state.AddNeighbor(node.Index(), new_neighbor, new_distance);
         }
     }
 }
 
 
-RouteModel::Node &RouteModel::FindClosestNode(float x, float y) {
-    Node input;
-    input.x = x;
-    input.y = y;
+RouteModel::Node RouteModel::FindClosestNode(float x, float y) const {
+    if (GetProfile() == LoadOptions::Profile::Render) {
+        throw std::logic_error("the map was loaded without routing data");
+    }
 
-    float min_dist = std::numeric_limits<float>::max();
-    float dist;
-    int closest_idx;
+    int closest = NearestSnapNode(x, y);
+    if (closest < 0) {
+        throw std::logic_error("the map has no roads to route on");
+    }
+    return SNodes()[closest];
+}
 
-    for (const Model::Road &road : Roads()) {
-        if (road.type != Model::Road::Type::Footway) {
-            for (int node_idx : Ways()[road.way].nodes) {
-                dist = input.distance(SNodes()[node_idx]);
-                if (dist < min_dist) {
-                    closest_idx = node_idx;
-                    min_dist = dist;
-                }
+
+std::vector<RouteModel::Node> RouteModel::FindClosestNodes(float x, float y, std::size_t count) const {
+    if (GetProfile() == LoadOptions::Profile::Render) {
+        throw std::logic_error("the map was loaded without routing data");
+    }
+
+    std::vector<Node> closest;
+    for (int node_idx : NearestSnapNodes(x, y, count)) {
+        closest.push_back(SNodes()[node_idx]);
+    }
+    return closest;
+}
+
+
+int RouteModel::NearestSnapNode(double x, double y) const {
+    if (m_SnapRemovedCount == 0 && m_SnapAdded.empty()) {
+        const int position = m_SnapIndex.Nearest(x, y);
+        return position < 0 ? -1 : m_SnapNodes[position];
+    }
+    const auto nearest = NearestSnapNodes(x, y, 1);
+    return nearest.empty() ? -1 : nearest.front();
+}
+
+
+// The tree's nearest nodes that no change removed, merged with the nodes changes added. Of
+// equally close nodes, those in the tree come first, in its order, then the added ones.
+std::vector<int> RouteModel::NearestSnapNodes(double x, double y, std::size_t count) const {
+    const auto nodes = SNodes();
+    auto distance = [&](int node_idx) { return KdTree::Distance(x, y, nodes[node_idx].x, nodes[node_idx].y); };
+    std::vector<std::pair<float, std::size_t>> found;    // distance, then position in the tree or after it
+    // Removed nodes may be among the tree's nearest; ask for more until enough are left.
+    for (std::size_t k = count; k > 0; k = std::min(2 * k, count + m_SnapRemovedCount)) {
+        const auto positions = m_SnapIndex.Nearest(x, y, k);
+        found.clear();
+        for (int position : positions) {
+            if (m_SnapRemoved.empty() || !m_SnapRemoved[position]) {
+                found.emplace_back(distance(m_SnapNodes[position]), position);
             }
         }
+        if (found.size() >= count || positions.size() < k || k == count + m_SnapRemovedCount) {
+            break;
+        }
+    }
+    for (std::size_t i = 0; i < m_SnapAdded.size(); i++) {
+        found.emplace_back(distance(m_SnapAdded[i]), m_SnapIndex.Size() + i);
     }
+    const auto kept = std::min(count, found.size());
+    std::partial_sort(found.begin(), found.begin() + kept, found.end());
 
-    return SNodes()[closest_idx];
-}
\ No newline at end of file
+    std::vector<int> nearest;
+    for (std::size_t i = 0; i < kept; i++) {
+        const auto position = found[i].second;
+        nearest.push_back(position < m_SnapIndex.Size() ? m_SnapNodes[position] : m_SnapAdded[position - m_SnapIndex.Size()]);
+    }
+    return nearest;
+}
+
+
+// Each thread converts its chunk of points to map coordinates, then snaps them as one batch.
+void RouteModel::SnapToNodes(const double *x, const double *y, std::size_t count, Units units, int *nodes,
+                             std::size_t threads) const {
+    if (GetProfile() == LoadOptions::Profile::Render) {
+        throw std::logic_error("the map was loaded without routing data");
+    }
+    if (count > 0 && m_SnapIndex.Size() == m_SnapRemovedCount && m_SnapAdded.empty()) {
+        throw std::logic_error("the map has no roads to route on");
+    }
+
+    const auto chunks = std::max<std::size_t>(1, std::min(WorkerCount(threads), count / kMinSnapChunk));
+    RunInParallel(chunks, [&](std::size_t chunk) {
+        const auto begin = count * chunk / chunks;
+        const auto end = count * (chunk + 1) / chunks;
+        std::vector<double> xs(x + begin, x + end), ys(y + begin, y + end);
+        for (std::size_t i = 0; i < xs.size(); i++) {
+            if (units == Units::Percent) {
+                float px = xs[i], py = ys[i];
+                px *= 0.01;
+                py *= 0.01;
+                xs[i] = px;
+                ys[i] = py;
+            }
+            else {
+                xs[i] = (float)(xs[i] / MetricScale());
+                ys[i] = (float)(ys[i] / MetricScale());
+            }
+        }
+        if (m_SnapRemovedCount > 0 || !m_SnapAdded.empty()) {
+            for (auto i = begin; i < end; i++) {
+                nodes[i] = NearestSnapNode(xs[i - begin], ys[i - begin]);
+            }
+            return;
+        }
+        m_SnapIndex.Nearest(xs.data(), ys.data(), xs.size(), nodes + begin);
+        for (auto i = begin; i < end; i++) {
+            nodes[i] = m_SnapNodes[nodes[i]];
+        }
+    });
+}
+
+
+RouteModel::SegmentSnap RouteModel::SnapToSegment(float x, float y) const {
+    if (GetProfile() == LoadOptions::Profile::Render) {
+        throw std::logic_error("the map was loaded without routing data");
+    }
+
+    // Of equally close segments, those in the index come first, then those changes added.
+    std::optional<SegmentSnap> best;
+    const auto nearest = m_SegmentIndex.Find(x, y, m_SegmentRemoved.empty() ? nullptr : &m_SegmentRemoved);
+    if (nearest.segment >= 0) {
+        const auto [road, segment] = m_SnapSegments[nearest.segment];
+        best = SegmentSnap{road, segment, nearest.offset, {nearest.x, nearest.y}, nearest.distance};
+    }
+    for (const auto &[road, segment] : m_SegmentsAdded) {
+        const auto found = SegmentIndex::Closest(SegmentAt(road, segment), x, y);
+        if (!best || found.distance < best->distance) {
+            best = SegmentSnap{road, segment, found.offset, {found.x, found.y}, found.distance};
+        }
+    }
+    if (!best) {
+        throw std::logic_error("the map has no roads to route on");
+    }
+    return *best;
+}
+
+
+SegmentIndex::Segment RouteModel::SegmentAt(int road, int segment) const {
+    const auto way_nodes = Ways()[Roads()[road].way].nodes;
+    const auto from = Nodes()[way_nodes[segment]], to = Nodes()[way_nodes[segment + 1]];
+    return {from.x, from.y, to.x, to.y};
+}
@@ -4,43 +4,152 @@
 #include <limits>
 #include <cmath>
 #include <unordered_map>
+#include "kd_tree.h"
 #include "model.h"
+#include "search_state.h"
+#include "segment_index.h"
 #include <iostream>
 
 class RouteModel : public Model {
 
   public:
+    // A node of the graph, read from Model's coordinates with its index. What a query learns
+    // about it is kept in a SearchState.
     class Node : public Model::Node {
       public:
-        Node * parent = nullptr;
-        float h_value = std::numeric_limits<float>::max();
-        float g_value = 0.0;
-        bool visited = false;
-        std::vector<Node *> neighbors;
-
-        void FindNeighbors();
-        float distance(Node other) const {
+        float distance(const Node &other) const {
             return std::sqrt(std::pow((x - other.x), 2) + std::pow((y - other.y), 2));
         }
+        int Index() const { return index; }
 
         Node(){}
-        Node(int idx, RouteModel * search_model, Model::Node node) : Model::Node(node), parent_model(search_model), index(idx) {}
+        Node(int idx, Model::Node node) : Model::Node(node), index(idx) {}
 
       private:
-        int index;
-        RouteModel::Node *FindNeighbor(std::vector<int> node_indices);
-        RouteModel * parent_model = nullptr;
+        int index = -1;
+    };
+
+    // Reads Nodes() back as RouteModel nodes; there is no second copy of the coordinates.
+    class NodeList {
+      public:
+        explicit NodeList(Model::NodeList nodes) : m_Nodes(nodes) {}
+        Node operator[](std::size_t i) const { return Node((int)i, m_Nodes[i]); }
+        std::size_t size() const { return m_Nodes.size(); }
+
+      private:
+        Model::NodeList m_Nodes;
+    };
+
+    // A node of a way, seen from another node of the same way.
+    struct Neighbor {
+        int node;
+        float distance;
+    };
+
+    // The point of the road network closest to some position: on the segment of a road's way
+    // from nodes[segment] to nodes[segment + 1], at `offset` of the segment's length from the
+    // first.
+    struct SegmentSnap {
+        int road;
+        int segment;
+        double offset;
+        Model::Node point;
+        double distance;    // from the position to point
     };
 
     RouteModel(const std::vector<std::byte> &xml);
-    Node &FindClosestNode(float x, float y);
-    auto &SNodes() { return m_Nodes; }
-    std::vector<Node> path;
-    
+    RouteModel(const std::vector<std::byte> &xml, const LoadOptions &options);
+    RouteModel(const std::byte *data, std::size_t size, const LoadOptions &options = {});
+    // The node of a road other than a footway closest to (x, y); of equally close nodes, the
+    // one on the first road, though nodes ApplyChange() moved or put on a road come last.
+    // FindClosestNodes() lists the `count` closest, closest first.
+    Node FindClosestNode(float x, float y) const;
+    std::vector<Node> FindClosestNodes(float x, float y, std::size_t count) const;
+    // Snaps to the closest point of a road other than a footway, which may lie between nodes.
+    SegmentSnap SnapToSegment(float x, float y) const;
+    // FindClosestNode() for `count` points at once, on up to `threads` threads (0 means one per
+    // core), writing the index of each point's node to `nodes`. Percent is the 0-100 range the
+    // planner takes, rounded as the planner rounds it; Meters are distances from the map's
+    // south-west corner in the units of MetricScale().
+    enum class Units { Percent, Meters };
+    void SnapToNodes(const double *x, const double *y, std::size_t count, Units units, int *nodes,
+                     std::size_t threads = 0) const;
+    NodeList SNodes() const { return NodeList{Nodes()}; }
+    // Adds to the node's neighbors in the state the nearest node not yet visited in this query on
+    // each road through the node. Doesn't change the model, so queries may run concurrently.
+    void FindNeighbors(const Node &node, SearchState &state) const;
+
+  protected:
+    void WriteSections(BinaryMap::Writer &writer) const override;
+    // Keep the nodes and the node-to-road index in step with ApplyChange(). Applying a change
+    // may move the nodes in memory, so it must not happen while a RoutePlanner is using them.
+    void OnNodeChanged(int node) override;
+    void OnRoadChanged(int road, int old_way) override;
+    void OnChangeApplied() override;
+    void AddMemoryUsage(LoadStats &stats) const override;
+
   private:
-    void CreateNodeToRoadHashmap();
-    std::unordered_map<int, std::vector<const Model::Road *>> node_to_road;
-    std::vector<Node> m_Nodes;
+    // The adjacency graph: for each node, one entry per road in RoadsOf(node), holding
+    // the road's way and the way's nodes closest to the node, nearest first. A* takes the
+    // nearest unvisited node of each road, which is almost always among these; only when a
+    // full list is all visited does it scan the whole way.
+    struct Adjacency {
+        Csr<int> ways;              // per node
+        Csr<Neighbor> candidates;   // per entry of ways
+    };
+    static constexpr std::size_t kNeighborCandidates = 4;
+
+    void CreateNodeToRoadIndex();
+    void LoadNodeToRoadIndex(const BinaryMap::Reader &reader);
+    // False if the map has no such section, or was compiled with other coordinates.
+    bool LoadAdjacency(const BinaryMap::Reader &reader);
+    bool LoadSnapIndex(const BinaryMap::Reader &reader);
+    Span<int> RoadsOf(int node) const;
+    std::vector<int> &ChangedRoadsOf(int node);
+    void IndexRoad(int road);
+    void MarkAdjacencyStale(Span<int> nodes);
+    void BuildAdjacency(std::size_t threads);
+    void BuildSnapIndex();
+    void BuildNodeSnapIndex();
+    void BuildSegmentIndex();
+    void UpdateNodeSnapIndex();
+    void UpdateSegmentIndex();
+    SegmentIndex::Segment SegmentAt(int road, int segment) const;
+    int NearestSnapNode(double x, double y) const;
+    std::vector<int> NearestSnapNodes(double x, double y, std::size_t count) const;
+    void AddAdjacency(int node, Adjacency &adjacency) const;
+    int FindNeighbor(const Node &node, Span<int> node_indices, const SearchState &state) const;
+    // Per node, indices into Roads(), which ApplyChange() may reallocate. Nodes whose roads
+    // ApplyChange() changed, or that it added, are looked up in node_to_road_changes instead.
+    Csr<int> node_to_road;
+    std::unordered_map<int, std::vector<int>> node_to_road_changes;
+    Adjacency m_Adjacency;
+    // The nodes FindClosestNode() considers, in order of their first road, and a tree over them;
+    // the same roads' segments, as road and position in its way, and an index over those.
+    std::vector<int> m_SnapNodes;
+    KdTree m_SnapIndex;
+    std::vector<std::pair<int, int>> m_SnapSegments;
+    SegmentIndex m_SegmentIndex;
+    // What ApplyChange() did to the tree's nodes since it was built: positions in m_SnapNodes of
+    // nodes that moved or left the roads, and nodes queries check besides the tree. Positions
+    // by node are only kept once there is a change. Nodes changed by the current change, and
+    // those of them that moved, wait in the last two until OnChangeApplied().
+    std::vector<int> m_SnapPositions;
+    std::vector<bool> m_SnapRemoved;
+    std::size_t m_SnapRemovedCount = 0;
+    std::vector<int> m_SnapAdded;
+    std::vector<int> m_SnapChanged;
+    std::vector<int> m_SnapMoved;
+    // Likewise for the segment index, by position in m_SnapSegments, and segments as road and
+    // position in its way; roads changed by the current change, and segments of nodes it moved.
+    std::vector<bool> m_SegmentRemoved;
+    std::size_t m_SegmentRemovedCount = 0;
+    std::vector<std::pair<int, int>> m_SegmentsAdded;
+    std::vector<int> m_SegmentRoadsChanged;
+    std::vector<std::pair<int, int>> m_SegmentsMoved;
+    // Nodes whose adjacency ApplyChange() affected, and their rebuilt adjacency.
+    std::vector<int> m_StaleAdjacency;
+    std::unordered_map<int, Adjacency> m_ChangedAdjacency;
 
 };
 
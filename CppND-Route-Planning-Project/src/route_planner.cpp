@@ -1,7 +1,22 @@
 #include "route_planner.h"
 #include <algorithm>
 
-RoutePlanner::RoutePlanner(RouteModel &model, float start_x, float start_y, float end_x, float end_y): m_Model(model) {
+// Room in the search state for the virtual start and end nodes of SnapTo::Segment.
+static constexpr std::size_t kVirtualNodes = 2;
+
+RoutePlanner::RoutePlanner(const RouteModel &model, float start_x, float start_y, float end_x, float end_y, SnapTo snap):
+    RoutePlanner(model, nullptr, start_x, start_y, end_x, end_y, snap) {}
+
+RoutePlanner::RoutePlanner(const RouteModel &model, SearchState &state, float start_x, float start_y, float end_x, float end_y,
+                           SnapTo snap):
+    RoutePlanner(model, &state, start_x, start_y, end_x, end_y, snap) {}
+
+// Without a state from the caller, the planner searches in one of its own.
+RoutePlanner::RoutePlanner(const RouteModel &model, SearchState *state, float start_x, float start_y, float end_x, float end_y,
+                           SnapTo snap):
+    m_Model(model), m_OwnState(state ? nullptr : std::make_unique<SearchState>()), m_State(state ? *state : *m_OwnState) {
+    m_State.Reset(m_Model.SNodes().size() + kVirtualNodes);
+
     // Convert inputs to percentage:
     start_x *= 0.01;
     start_y *= 0.01;
@@ -9,36 +24,56 @@ RoutePlanner::RoutePlanner(RouteModel &model, float start_x, float start_y, floa
     end_y *= 0.01;
 
     //Store the nodes you find in the RoutePlanner's start_node and end_node attributes.
-    start_node = &m_Model.FindClosestNode(start_x, start_y);
-    end_node = &m_Model.FindClosestNode(end_x, end_y);
+    if (snap == SnapTo::Segment) {
+        const int count = m_Model.SNodes().size();
+        m_StartSnap = m_Model.SnapToSegment(start_x, start_y);
+        m_EndSnap = m_Model.SnapToSegment(end_x, end_y);
+        start_node = RouteModel::Node(count, m_StartSnap->point);
+        end_node = RouteModel::Node(count + 1, m_EndSnap->point);
+    } else {
+        start_node = m_Model.FindClosestNode(start_x, start_y);
+        end_node = m_Model.FindClosestNode(end_x, end_y);
+    }
 }
 
-// Implement the CalculateHValue method.
-// Use distance to the end_node for the h value. distance method is in route_model.h.
-// Basically, find the distance to another node. (use the distance to the end_node for the h value.)
-float RoutePlanner::CalculateHValue(RouteModel::Node const *node) {
-    return node->distance(*end_node);
+
+RouteModel::Node RoutePlanner::NodeAt(int index) const {
+    if (index >= (int)m_Model.SNodes().size()) {
+        return index == start_node.Index() ? start_node : end_node;
+    }
+    return m_Model.SNodes()[index];
 }
 
-// AddNeighbors method to expand the current node by adding all unvisited neighbors to the open list.
-void RoutePlanner::AddNeighbors(RouteModel::Node *current_node) {
-    current_node->visited = true;
-    current_node->FindNeighbors();
-    
-    for (RouteModel::Node* neighbor : current_node->neighbors){
-        neighbor->parent = current_node;
-        neighbor->g_value = current_node->g_value + current_node->distance(*neighbor);
-        neighbor->h_value = CalculateHValue(neighbor);
 
-        //Mark as visited once that neighbor is pushed into openlist.
-        neighbor->visited = true;
-
-        //Add the neibor to open_list and set the node's visited attribute to true.
-        open_list.push_back(neighbor);
-        
+// The virtual start leads to the ends of its segment, and the ends of the end's segment lead to
+// the virtual end; on a shared segment, the start also leads straight to the end.
+void RoutePlanner::AddVirtualNeighbors(const RouteModel::Node &node) {
+    const auto segment_ends = [this](const RouteModel::SegmentSnap &snap) {
+        const auto way_nodes = m_Model.Ways()[m_Model.Roads()[snap.road].way].nodes;
+        return std::make_pair(way_nodes[snap.segment], way_nodes[snap.segment + 1]);
+    };
+    const auto [end_a, end_b] = segment_ends(*m_EndSnap);
+
+    if (node.Index() == start_node.Index()) {
+        const auto [start_a, start_b] = segment_ends(*m_StartSnap);
+        for (int end : {start_a, start_b}) {
+            m_State.AddNeighbor(node.Index(), end, node.distance(m_Model.SNodes()[end]));
+        }
+        if (m_StartSnap->road == m_EndSnap->road && m_StartSnap->segment == m_EndSnap->segment) {
+            m_State.AddNeighbor(node.Index(), end_node.Index(), node.distance(end_node));
+        }
+    } else if ((node.Index() == end_a || node.Index() == end_b) && !m_State.Visited(end_node.Index())) {
+        m_State.AddNeighbor(node.Index(), end_node.Index(), node.distance(end_node));
     }
 }
 
+// Implement the CalculateHValue method.
+// Use distance to the end_node for the h value. distance method is in route_model.h.
+// Basically, find the distance to another node. (use the distance to the end_node for the h value.)
+float RoutePlanner::CalculateHValue(RouteModel::Node const *node) {
+    return node->distance(end_node);
+}
+
 // Just helper function for compare and sum up the h value and g value
 // Use a same syntax from A* search lecture
 // --------------------------------------------------------
@@ -47,25 +82,57 @@ void RoutePlanner::AddNeighbors(RouteModel::Node *current_node) {
 // int f2 = b[2] + b[3] //f2 = g2 + h2
 // return f1 > f2;}
 // --------------------------------------------------------
-// Then this function will be used for NextNode like CellSort() function in A* Search Lecture
-bool CompareFvals(const RouteModel::Node* node_a, const RouteModel::Node* node_b){
-    float f1 = node_a->g_value + node_a->h_value;
-    float f2 = node_b->g_value + node_b->h_value;
-    return f1 > f2;
+// Then this function keeps the open list a heap with the lowest f value at its front.
+static bool CompareFvals(const RoutePlanner::OpenEntry &entry_a, const RoutePlanner::OpenEntry &entry_b){
+    return entry_a.f_value > entry_b.f_value;
 }
 
-// NextNode method to sort the open list and return the next node.
-RouteModel::Node *RoutePlanner::NextNode() {
-    //Sort the open_list according to the sum of the h vaue and g value by using helper function
-    std::sort(this->open_list.begin(), this->open_list.end(), CompareFvals);
-
-    //Create a pointer to the node in the list with the lowest sum
-    RouteModel::Node *lowest = open_list.back();
-    open_list.pop_back();
-    //remove that node from the open_list
-    //this->open_list.pop_back();
-    //Return pointer
-    return lowest;
+// AddNeighbors method to expand the current node by adding all unvisited neighbors to the open list.
+void RoutePlanner::AddNeighbors(const RouteModel::Node *current_node) {
+    SearchState::NodeState &current = m_State[current_node->Index()];
+    current.visited = true;
+    if (current_node->Index() < (int)m_Model.SNodes().size()) {
+        m_Model.FindNeighbors(*current_node, m_State);
+    }
+    if (m_StartSnap) {
+        AddVirtualNeighbors(*current_node);
+    }
+    
+    const auto neighbors = m_State.Neighbors(current_node->Index());
+    const auto neighbor_distances = m_State.NeighborDistances(current_node->Index());
+    for (std::size_t i = 0; i < neighbors.size(); i++){
+        const RouteModel::Node neighbor_node = NodeAt(neighbors[i]);
+        SearchState::NodeState &neighbor = m_State[neighbor_node.Index()];
+        neighbor.parent = current_node->Index();
+        neighbor.g_value = current.g_value + neighbor_distances[i];
+        neighbor.h_value = CalculateHValue(&neighbor_node);
+
+        //Mark as visited once that neighbor is pushed into openlist.
+        neighbor.visited = true;
+
+        //Add the neibor to open_list and set the node's visited attribute to true.
+        neighbor.sequence = ++open_sequence;
+        open_list.push_back({neighbor.g_value + neighbor.h_value, neighbor_node.Index(), neighbor.sequence});
+        std::push_heap(open_list.begin(), open_list.end(), CompareFvals);
+
+    }
+}
+
+// NextNode method to take the node with the lowest f value off the open list and return it.
+std::optional<RouteModel::Node> RoutePlanner::NextNode() {
+    //Take the node in the list with the lowest sum, skipping entries of nodes that were added
+    //again since.
+    while (!open_list.empty()) {
+        std::pop_heap(open_list.begin(), open_list.end(), CompareFvals);
+        const OpenEntry lowest = open_list.back();
+        //remove that node from the open_list
+        open_list.pop_back();
+        if (lowest.sequence == m_State[lowest.node].sequence) {
+            //Return the node
+            return NodeAt(lowest.node);
+        }
+    }
+    return std::nullopt;
 }
 
 
@@ -75,25 +142,26 @@ RouteModel::Node *RoutePlanner::NextNode() {
 // - The returned vector should be in the correct order: the start node should be the first element
 //   of the vector, the end node should be the last element.
 
-std::vector<RouteModel::Node> RoutePlanner::ConstructFinalPath(RouteModel::Node *current_node) {
+std::vector<RouteModel::Node> RoutePlanner::ConstructFinalPath(const RouteModel::Node *current_node) {
     // Create path_found vector
     std::vector<RouteModel::Node> path_found;
-    RouteModel::Node *current = current_node;
+    RouteModel::Node current = *current_node;
     distance = 0.0f;
 
     //If the current node(parent) is empty or null
-    while(current != start_node){
+    while(current.Index() != start_node.Index()){
        
         //Add the current node to the parent. 
-        path_found.push_back(*current);
+        path_found.push_back(current);
 
         //add distance component to its parent.
-        distance += current->distance(*current->parent);
+        const RouteModel::Node parent = NodeAt(m_State[current.Index()].parent);
+        distance += current.distance(parent);
         //Then update the current node.
-        current = current->parent;
+        current = parent;
     }
     
-    path_found.push_back(*current);
+    path_found.push_back(current);
 
     std::reverse(path_found.begin(), path_found.end());
 
@@ -104,16 +172,22 @@ std::vector<RouteModel::Node> RoutePlanner::ConstructFinalPath(RouteModel::Node
 // - Use the AddNeighbors method to add all of the neighbors of the current node to the open_list.
 // - Use the NextNode() method to sort the open_list and return the next node.
 // - When the search has reached the end_node, use the ConstructFinalPath method to return the final path that was found.
-// - Store the final path in the m_Model.path attribute before the method exits. This path will then be displayed on the map tile.
+// - Store the final path in the path attribute before the method exits. This path will then be displayed on the map tile.
 
 void RoutePlanner::AStarSearch() {
-    RouteModel::Node *current_node = nullptr;
-    current_node = start_node;
+    RouteModel::Node current_node = start_node;
 
     // Use the NextNode() method to sort the open_list and return the next node.
-    while( current_node != end_node){
-        AddNeighbors(current_node);
-        current_node = NextNode();
+    while( current_node.Index() != end_node.Index()){
+        AddNeighbors(&current_node);
+        const auto next = NextNode();
+        if (!next) {
+            //The end is unreachable.
+            path.clear();
+            distance = 0.0f;
+            return;
+        }
+        current_node = *next;
     }
-    m_Model.path = ConstructFinalPath(current_node);
+    path = ConstructFinalPath(&current_node);
 }
\ No newline at end of file
@@ -1,34 +1,70 @@
 #ifndef ROUTE_PLANNER_H
 #define ROUTE_PLANNER_H
 
+#include <cstdint>
 #include <iostream>
+#include <memory>
+#include <optional>
 #include <vector>
 #include <string>
 #include "route_model.h"
+#include "search_state.h"
 
 
 class RoutePlanner {
   public:
-    RoutePlanner(RouteModel &model, float start_x, float start_y, float end_x, float end_y);
+    // Start and end either at the closest nodes, or at the closest points of the roads, which on
+    // long roads with few nodes may be much closer.
+    enum class SnapTo { Node, Segment };
+
+    RoutePlanner(const RouteModel &model, float start_x, float start_y, float end_x, float end_y, SnapTo snap = SnapTo::Node);
+    // Searches in a state that outlives the planner, so that consecutive queries reuse its memory.
+    RoutePlanner(const RouteModel &model, SearchState &state, float start_x, float start_y, float end_x, float end_y,
+                 SnapTo snap = SnapTo::Node);
     // Add public variables or methods declarations here.
     float GetDistance() const {return distance;}
+    const std::vector<RouteModel::Node> &GetPath() const {return path;}
+    // Leaves the path empty, and the distance 0, if the end can't be reached from the start.
     void AStarSearch();
     
-    void AddNeighbors(RouteModel::Node *current_node);
+    void AddNeighbors(const RouteModel::Node *current_node);
     float CalculateHValue(RouteModel::Node const *node);
-    std::vector<RouteModel::Node> ConstructFinalPath(RouteModel::Node *current_node);
-    RouteModel::Node *NextNode();
+    std::vector<RouteModel::Node> ConstructFinalPath(const RouteModel::Node *current_node);
+    // The open node with the lowest f value, or none once the open list runs out.
+    std::optional<RouteModel::Node> NextNode();
+
+    // A node on the open list, with its f value when it was added, and the number of the addition.
+    struct OpenEntry {
+        float f_value;
+        int node;
+        std::uint32_t sequence;
+    };
     
     
   private:
     // Add private variables or methods declarations here.
+    RoutePlanner(const RouteModel &model, SearchState *state, float start_x, float start_y, float end_x, float end_y, SnapTo snap);
+    RouteModel::Node NodeAt(int index) const;
+    void AddVirtualNeighbors(const RouteModel::Node &node);
     
-    RouteModel::Node *start_node;
-    RouteModel::Node *end_node;
-    std::vector<RouteModel::Node*> open_list;
+    // With SnapTo::Segment, start_node and end_node are virtual nodes at these points, numbered
+    // after the model's nodes.
+    std::optional<RouteModel::SegmentSnap> m_StartSnap;
+    std::optional<RouteModel::SegmentSnap> m_EndSnap;
+
+    RouteModel::Node start_node;
+    RouteModel::Node end_node;
+    // A binary min-heap of nodes to expand by f value, as it was when they were added. Adding a
+    // node again with new values leaves its old entry behind, which NextNode() then skips, as its
+    // sequence number is no longer the node's.
+    std::vector<OpenEntry> open_list;
+    std::uint32_t open_sequence = 0;
+    std::vector<RouteModel::Node> path;
     float distance = 0.0f;
     
-    RouteModel &m_Model;
+    const RouteModel &m_Model;
+    std::unique_ptr<SearchState> m_OwnState;
+    SearchState &m_State;
 };
 
 #endif
\ No newline at end of file
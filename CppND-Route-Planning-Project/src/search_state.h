@@ -0,0 +1,96 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <vector>
+#include "csr.h"
+
+// What A* keeps per node during one query, kept apart from the model so that one model can
+// answer many queries, from several threads if each has its own state. A state is meant to be
+// reused: Reset() forgets the previous query in O(1) by bumping a generation counter, and a
+// node's entry is only reinitialized when the new query first touches it. The neighbors found
+// for each node share one arena, which is also kept from query to query.
+class SearchState
+{
+public:
+    struct NodeState {
+        int parent = -1;    // index of the node it was reached from
+        float g_value = 0.f;
+        float h_value = std::numeric_limits<float>::max();
+        bool visited = false;
+        std::uint32_t sequence = 0;    // of its latest entry on the open list
+        // The node's neighbors, [neighbors_begin, neighbors_end) in the arena.
+        std::uint32_t neighbors_begin = 0;
+        std::uint32_t neighbors_end = 0;
+    };
+
+    // Starts a new query over a model with `node_count` nodes.
+    void Reset( std::size_t node_count )
+    {
+        if( m_Generations.size() != node_count ) {
+            m_Generations.assign(node_count, 0);
+            m_Nodes.resize(node_count);
+            m_Generation = 0;
+        }
+        if( ++m_Generation == 0 ) {
+            std::fill(m_Generations.begin(), m_Generations.end(), 0);
+            m_Generation = 1;
+        }
+        m_Neighbors.clear();
+        m_NeighborDistances.clear();
+    }
+
+    // The node's state in this query; defaults until the query sets it.
+    NodeState &operator[]( int node ) noexcept
+    {
+        if( m_Generations[node] != m_Generation ) {
+            m_Generations[node] = m_Generation;
+            m_Nodes[node] = NodeState{};
+        }
+        return m_Nodes[node];
+    }
+
+    bool Visited( int node ) const noexcept
+    {
+        return m_Generations[node] == m_Generation && m_Nodes[node].visited;
+    }
+
+    // A node expanded again keeps the neighbors it found before, as A* visits them again too.
+    void AddNeighbor( int node, int neighbor, float distance )
+    {
+        auto &state = (*this)[node];
+        if( state.neighbors_end != m_Neighbors.size() ) {
+            const auto begin = (std::uint32_t)m_Neighbors.size();
+            for( auto i = state.neighbors_begin; i < state.neighbors_end; ++i ) {
+                m_Neighbors.push_back(m_Neighbors[i]);
+                m_NeighborDistances.push_back(m_NeighborDistances[i]);
+            }
+            state.neighbors_begin = begin;
+            state.neighbors_end = (std::uint32_t)m_Neighbors.size();
+        }
+        m_Neighbors.push_back(neighbor);
+        m_NeighborDistances.push_back(distance);
+        ++state.neighbors_end;
+    }
+
+    // The node's neighbors and the distance to each; valid until the next AddNeighbor().
+    Span<int> Neighbors( int node ) noexcept
+    {
+        const auto &state = (*this)[node];
+        return {m_Neighbors.data() + state.neighbors_begin, m_Neighbors.data() + state.neighbors_end};
+    }
+    Span<float> NeighborDistances( int node ) noexcept
+    {
+        const auto &state = (*this)[node];
+        return {m_NeighborDistances.data() + state.neighbors_begin, m_NeighborDistances.data() + state.neighbors_end};
+    }
+
+private:
+    std::vector<NodeState> m_Nodes;
+    std::vector<std::uint32_t> m_Generations;
+    std::uint32_t m_Generation = 0;
+    std::vector<int> m_Neighbors;
+    std::vector<float> m_NeighborDistances;
+};
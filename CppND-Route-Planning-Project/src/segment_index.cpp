@@ -0,0 +1,187 @@
+#include "segment_index.h"
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <numeric>
+#include <stdexcept>
+#include <tuple>
+
+SegmentIndex::SegmentIndex( std::vector<Segment> segments )
+{
+    if( segments.size() > (std::size_t)std::numeric_limits<int>::max() )
+        throw std::length_error("too many segments for a segment index");
+
+    // Sort-tile-recursive: vertical slices of about sqrt(leaves) leaves each, sorted by x,
+    // then each slice sorted by y and cut into leaves.
+    const auto count = segments.size();
+    const auto leaves = (count + kFanout - 1) / kFanout;
+    const auto slice = kFanout * (std::size_t)std::ceil(std::sqrt((double)leaves));
+    const auto center_x = [&](int i) { return segments[i].x0 + segments[i].x1; };
+    const auto center_y = [&](int i) { return segments[i].y0 + segments[i].y1; };
+    m_Positions.resize(count);
+    std::iota(m_Positions.begin(), m_Positions.end(), 0);
+    std::sort(m_Positions.begin(), m_Positions.end(), [&](int a, int b) { return center_x(a) < center_x(b); });
+    for( std::size_t begin = 0; begin < count; begin += slice ) {
+        const auto end = std::min(begin + slice, count);
+        std::sort(m_Positions.begin() + begin, m_Positions.begin() + end,
+                  [&](int a, int b) { return center_y(a) < center_y(b); });
+    }
+
+    m_Segments.reserve(count);
+    for( int position: m_Positions )
+        m_Segments.push_back(segments[position]);
+
+    std::vector<Box> level;
+    for( std::size_t i = 0; i < count; ++i ) {
+        const auto box = Bounds(m_Segments[i]);
+        if( i % kFanout == 0 ) {
+            level.push_back(box);
+            continue;
+        }
+        auto &group = level.back();
+        group.min_x = std::min(group.min_x, box.min_x);
+        group.min_y = std::min(group.min_y, box.min_y);
+        group.max_x = std::max(group.max_x, box.max_x);
+        group.max_y = std::max(group.max_y, box.max_y);
+    }
+    while( !level.empty() ) {
+        m_Levels.push_back(std::move(level));
+        const auto &below = m_Levels.back();
+        if( below.size() == 1 )
+            break;
+        level.clear();
+        for( std::size_t i = 0; i < below.size(); ++i ) {
+            if( i % kFanout == 0 ) {
+                level.push_back(below[i]);
+                continue;
+            }
+            auto &group = level.back();
+            group.min_x = std::min(group.min_x, below[i].min_x);
+            group.min_y = std::min(group.min_y, below[i].min_y);
+            group.max_x = std::max(group.max_x, below[i].max_x);
+            group.max_y = std::max(group.max_y, below[i].max_y);
+        }
+    }
+}
+
+SegmentIndex::Box SegmentIndex::Bounds( const Segment &segment ) noexcept
+{
+    return {std::min(segment.x0, segment.x1), std::min(segment.y0, segment.y1),
+            std::max(segment.x0, segment.x1), std::max(segment.y0, segment.y1)};
+}
+
+double SegmentIndex::Distance( const Box &box, double x, double y ) noexcept
+{
+    const double dx = std::max({box.min_x - x, 0., x - box.max_x});
+    const double dy = std::max({box.min_y - y, 0., y - box.max_y});
+    return std::sqrt(dx * dx + dy * dy);
+}
+
+// The projected point is clamped to the segment's box: rounding could otherwise put it just
+// outside, closer to the query than the box is, and pruning by box distance would be wrong.
+SegmentIndex::Nearest SegmentIndex::Closest( const Segment &s, double x, double y ) noexcept
+{
+    const double dx = s.x1 - s.x0;
+    const double dy = s.y1 - s.y0;
+    const double length2 = dx * dx + dy * dy;
+    const double offset = length2 > 0. ? std::clamp(((x - s.x0) * dx + (y - s.y0) * dy) / length2, 0., 1.) : 0.;
+
+    const auto box = Bounds(s);
+    const double px = std::clamp(s.x0 + offset * dx, box.min_x, box.max_x);
+    const double py = std::clamp(s.y0 + offset * dy, box.min_y, box.max_y);
+    return {-1, offset, px, py, std::sqrt((x - px) * (x - px) + (y - py) * (y - py))};
+}
+
+// Best first: a heap of boxes by distance. Boxes exactly as far as the best segment are still
+// opened, for a segment added earlier.
+SegmentIndex::Nearest SegmentIndex::Find( double x, double y, const std::vector<bool> *removed ) const
+{
+    Nearest best;
+    if( m_Levels.empty() )
+        return best;
+    best.distance = std::numeric_limits<double>::infinity();
+
+    using Entry = std::tuple<double, std::size_t, std::size_t>;     // distance, level, box
+    std::vector<Entry> heap;
+    heap.reserve(4 * kFanout);
+    const auto top = m_Levels.size() - 1;
+    heap.emplace_back(Distance(m_Levels[top][0], x, y), top, 0);
+
+    while( !heap.empty() ) {
+        std::pop_heap(heap.begin(), heap.end(), std::greater<>{});
+        const auto [distance, level, box] = heap.back();
+        heap.pop_back();
+        if( distance > best.distance )
+            break;
+
+        if( level == 0 ) {
+            const auto end = std::min((box + 1) * kFanout, m_Segments.size());
+            for( auto i = box * kFanout; i < end; ++i ) {
+                if( removed && (*removed)[m_Positions[i]] )
+                    continue;
+                auto found = Closest(m_Segments[i], x, y);
+                found.segment = m_Positions[i];
+                if( found.distance < best.distance ||
+                    (found.distance == best.distance && found.segment < best.segment) )
+                    best = found;
+            }
+            continue;
+        }
+
+        const auto &below = m_Levels[level - 1];
+        const auto end = std::min((box + 1) * kFanout, below.size());
+        for( auto i = box * kFanout; i < end; ++i ) {
+            const double d = Distance(below[i], x, y);
+            if( d <= best.distance ) {
+                heap.emplace_back(d, level - 1, i);
+                std::push_heap(heap.begin(), heap.end(), std::greater<>{});
+            }
+        }
+    }
+    return best;
+}
+
+std::size_t SegmentIndex::MemoryUsage() const noexcept
+{
+    std::size_t bytes = m_Segments.capacity() * sizeof(Segment) + m_Positions.capacity() * sizeof(int);
+    for( const auto &level: m_Levels )
+        bytes += level.capacity() * sizeof(Box);
+    return bytes;
+}
+
+void SegmentIndex::Write( BinaryMap::Writer &writer ) const
+{
+    writer.Array(m_Segments);
+    writer.Array(m_Positions);
+    writer.Array(std::vector<std::uint64_t>{m_Levels.size()});
+    for( const auto &level: m_Levels )
+        writer.Array(level);
+}
+
+// Each level must have the boxes the constructor would give it, so that queries stay within
+// the level below.
+void SegmentIndex::Read( BinaryMap::Reader::Cursor &cursor )
+{
+    auto check = [](bool valid) {
+        if( !valid )
+            throw std::logic_error("the compiled map file is corrupted");
+    };
+    std::vector<std::uint64_t> levels;
+    *this = SegmentIndex{};
+    cursor.Array(m_Segments);
+    cursor.Array(m_Positions);
+    cursor.Array(levels);
+    const auto count = m_Segments.size();
+    check( m_Positions.size() == count && count <= (std::size_t)std::numeric_limits<int>::max() && levels.size() == 1 );
+    for( auto position: m_Positions )
+        check( position >= 0 && (std::size_t)position < count );
+
+    auto boxes = count;
+    while( boxes > 1 || (boxes == 1 && m_Levels.empty()) ) {
+        boxes = (boxes + kFanout - 1) / kFanout;
+        check( m_Levels.size() < levels[0] );
+        cursor.Array(m_Levels.emplace_back());
+        check( m_Levels.back().size() == boxes );
+    }
+    check( m_Levels.size() == levels[0] );
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "binary_map.h"
+
+// A static R-tree over line segments, for finding the segment closest to a point.
+//
+// The tree is bulk-loaded once: segments are sorted into leaves of kFanout by the
+// sort-tile-recursive method, and each level above groups kFanout consecutive boxes of the
+// level below, so the tree is a few flat arrays without pointers. Queries visit boxes
+// nearest first and stop once the nearest remaining box is farther than the best segment.
+// Of equally close segments, the one added first is returned.
+class SegmentIndex
+{
+public:
+    struct Segment {
+        double x0, y0;
+        double x1, y1;
+    };
+
+    struct Nearest {
+        int segment = -1;       // position in the input; -1 if the index is empty
+        double offset = 0.;     // fraction of the segment from (x0, y0) to the closest point
+        double x = 0., y = 0.;  // the closest point
+        double distance = 0.;
+    };
+
+    SegmentIndex() = default;
+    explicit SegmentIndex( std::vector<Segment> segments );
+
+    std::size_t Size() const noexcept { return m_Segments.size(); }
+
+    // Segments whose input position is set in `removed` are skipped.
+    Nearest Find( double x, double y, const std::vector<bool> *removed = nullptr ) const;
+
+    // The closest point of one segment, with its position left at -1.
+    static Nearest Closest( const Segment &segment, double x, double y ) noexcept;
+
+    std::size_t MemoryUsage() const noexcept;
+
+    void Write( BinaryMap::Writer &writer ) const;
+    // Throws std::logic_error if the arrays don't describe a tree over their segments.
+    void Read( BinaryMap::Reader::Cursor &cursor );
+
+private:
+    static constexpr std::size_t kFanout = 16;
+
+    struct Box {
+        double min_x, min_y;
+        double max_x, max_y;
+    };
+
+    static Box Bounds( const Segment &segment ) noexcept;
+    static double Distance( const Box &box, double x, double y ) noexcept;
+
+    std::vector<Segment> m_Segments;        // in leaf order
+    std::vector<int> m_Positions;           // input position of each of m_Segments
+    std::vector<std::vector<Box>> m_Levels; // m_Levels[0] bounds kFanout segments per box
+};
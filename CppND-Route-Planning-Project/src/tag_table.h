@@ -0,0 +1,150 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <string_view>
+
+// One row of a TagTable: a key=value pair, or key=* to match any value of that key.
+template <typename T>
+struct TagEntry {
+    std::string_view key;
+    std::string_view value;
+    T data;
+};
+
+// Maps OSM (key, value) tags to data through perfect hashes built at compile time: the
+// constructor searches for seeds under which no two keys, and no two key=value entries,
+// share a slot. A lookup first probes the keys, which settles the common case of a key the
+// table doesn't know with one hash, one slot probe and one string comparison; only known
+// keys go on to probe their values. A table that can't be hashed (e.g. because of a
+// duplicate entry) fails to compile when declared constexpr.
+template <typename T, std::size_t N>
+class TagTable
+{
+public:
+    constexpr TagTable( const TagEntry<T> (&entries)[N] )
+    {
+        static_assert( N < 255 );
+        for( std::size_t i = 0; i < N; ++i ) {
+            m_Entries[i] = entries[i];
+            auto &key = AddKey(entries[i].key);
+            if( entries[i].value != "*" )
+                key.values = true;
+            else if( key.wildcard )
+                throw std::logic_error("duplicate wildcard entry in the tag table");
+            else
+                key.wildcard = (std::uint8_t)(i + 1);
+        }
+        if( !FindSeed(&TagTable::TryKeySeed) || !FindSeed(&TagTable::TrySeed) )
+            throw std::logic_error("no perfect hash seed for the tag table");
+    }
+
+    // The entry for exactly key=value, else the one for key=*, else nullptr.
+    constexpr const T *Find( std::string_view key, std::string_view value ) const noexcept
+    {
+        const auto key_slot = m_KeySlots[Hash(key, {}, m_KeySeed) & (Slots() - 1)];
+        if( !key_slot || m_Keys[key_slot - 1].key != key )
+            return nullptr;
+        const auto &known = m_Keys[key_slot - 1];
+        if( known.values )
+            if( auto entry = Probe(key, value) )
+                return entry;
+        return known.wildcard ? &m_Entries[known.wildcard - 1].data : nullptr;
+    }
+
+private:
+    struct Key {
+        std::string_view key;
+        std::uint8_t wildcard = 0;  // entry index + 1 of key=*, or 0
+        bool values = false;        // whether there are entries for specific values
+    };
+
+    static constexpr std::size_t Slots()
+    {
+        std::size_t slots = 1;
+        while( slots < 4 * N )
+            slots *= 2;
+        return slots;
+    }
+
+    static constexpr std::uint32_t Hash( std::string_view key, std::string_view value, std::uint32_t seed ) noexcept
+    {
+        auto h = 2166136261u ^ seed;
+        for( auto c: key )
+            h = (h ^ (unsigned char)c) * 16777619u;
+        h = (h ^ '=') * 16777619u;
+        for( auto c: value )
+            h = (h ^ (unsigned char)c) * 16777619u;
+        h ^= h >> 16;
+        h *= 0x7feb352du;
+        h ^= h >> 15;
+        return h;
+    }
+
+    constexpr Key &AddKey( std::string_view key )
+    {
+        for( std::size_t i = 0; i < m_KeyCount; ++i )
+            if( m_Keys[i].key == key )
+                return m_Keys[i];
+        m_Keys[m_KeyCount].key = key;
+        return m_Keys[m_KeyCount++];
+    }
+
+    constexpr bool FindSeed( bool (TagTable::*try_seed)( std::uint32_t ) )
+    {
+        for( std::uint32_t seed = 0; seed < 100000; ++seed )
+            if( (this->*try_seed)(seed) )
+                return true;
+        return false;
+    }
+
+    constexpr bool TryKeySeed( std::uint32_t seed )
+    {
+        for( auto &slot: m_KeySlots )
+            slot = 0;
+        for( std::size_t i = 0; i < m_KeyCount; ++i ) {
+            auto &slot = m_KeySlots[Hash(m_Keys[i].key, {}, seed) & (Slots() - 1)];
+            if( slot )
+                return false;
+            slot = (std::uint8_t)(i + 1);
+        }
+        m_KeySeed = seed;
+        return true;
+    }
+
+    // Only entries for specific values go in the value slots.
+    constexpr bool TrySeed( std::uint32_t seed )
+    {
+        for( auto &slot: m_Slots )
+            slot = 0;
+        for( std::size_t i = 0; i < N; ++i ) {
+            if( m_Entries[i].value == "*" )
+                continue;
+            auto &slot = m_Slots[Hash(m_Entries[i].key, m_Entries[i].value, seed) & (Slots() - 1)];
+            if( slot )
+                return false;
+            slot = (std::uint8_t)(i + 1);
+        }
+        m_Seed = seed;
+        return true;
+    }
+
+    constexpr const T *Probe( std::string_view key, std::string_view value ) const noexcept
+    {
+        const auto slot = m_Slots[Hash(key, value, m_Seed) & (Slots() - 1)];
+        if( !slot )
+            return nullptr;
+        const auto &entry = m_Entries[slot - 1];
+        return entry.key == key && entry.value == value ? &entry.data : nullptr;
+    }
+
+    std::array<TagEntry<T>, N> m_Entries{};
+    std::array<Key, N> m_Keys{};
+    std::size_t m_KeyCount = 0;
+    std::array<std::uint8_t, Slots()> m_KeySlots{};     // key index + 1, or 0 when empty
+    std::array<std::uint8_t, Slots()> m_Slots{};        // entry index + 1, or 0 when empty
+    std::uint32_t m_KeySeed = 0;
+    std::uint32_t m_Seed = 0;
+};
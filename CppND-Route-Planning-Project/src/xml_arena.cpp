@@ -0,0 +1,145 @@
+#include "xml_arena.h"
+#include "pugixml.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+#if !defined(_WIN32)
+#include <sys/mman.h>
+#endif
+
+namespace {
+
+thread_local XmlArena *t_Arena = nullptr;
+
+std::atomic<std::size_t> g_Allocations{0};
+std::atomic<std::size_t> g_Deallocations{0};
+std::atomic<std::size_t> g_Bytes{0};
+std::atomic<std::size_t> g_SystemAllocations{0};
+
+constexpr std::size_t kAlignment = alignof(std::max_align_t);
+constexpr std::size_t kMinRegion = 1 << 20;
+constexpr std::size_t kHugePage = 2 << 20;
+
+}
+
+// pugixml's default functions are malloc and free, so whatever it allocated before can be
+// freed by Deallocate() as well.
+void XmlArena::Install()
+{
+    static const bool installed = [] {
+        pugi::set_memory_management_functions(Allocate, Deallocate);
+        return true;
+    }();
+    (void)installed;
+}
+
+XmlArena::XmlArena( std::size_t expected_size, bool huge_pages ) :
+    // pugixml keeps a copy of the buffer, plus a few dozen bytes per element.
+    m_NextSize(std::max(kMinRegion, 2 * expected_size)),
+    m_HugePages(huge_pages),
+    m_Previous(t_Arena)
+{
+    Install();
+    t_Arena = this;
+}
+
+XmlArena::~XmlArena()
+{
+    t_Arena = m_Previous;
+    for( auto &region: m_Regions ) {
+#if !defined(_WIN32)
+        if( region.mapped ) {
+            munmap(region.data, region.size);
+            continue;
+        }
+#endif
+        std::free(region.data);
+    }
+}
+
+XmlArena::Stats XmlArena::Totals() noexcept
+{
+    Stats stats;
+    stats.allocations = g_Allocations.load(std::memory_order_relaxed);
+    stats.deallocations = g_Deallocations.load(std::memory_order_relaxed);
+    stats.bytes = g_Bytes.load(std::memory_order_relaxed);
+    stats.system_allocations = g_SystemAllocations.load(std::memory_order_relaxed);
+    return stats;
+}
+
+void *XmlArena::Allocate( std::size_t size )
+{
+    g_Allocations.fetch_add(1, std::memory_order_relaxed);
+    g_Bytes.fetch_add(size, std::memory_order_relaxed);
+    if( t_Arena )
+        return t_Arena->Bump(size);
+    g_SystemAllocations.fetch_add(1, std::memory_order_relaxed);
+    return std::malloc(size);
+}
+
+// A document may outlive inner arenas created after it, so look through all of them.
+void XmlArena::Deallocate( void *ptr )
+{
+    g_Deallocations.fetch_add(1, std::memory_order_relaxed);
+    for( auto arena = t_Arena; arena; arena = arena->m_Previous )
+        if( arena->Owns(ptr) )
+            return;
+    std::free(ptr);
+}
+
+void *XmlArena::Bump( std::size_t size )
+{
+    size = (size + kAlignment - 1) / kAlignment * kAlignment;
+    if( (m_Regions.empty() || m_Regions.back().size - m_Used < size) && !AddRegion(size) )
+        return nullptr;     // pugixml reports out of memory
+    auto ptr = m_Regions.back().data + m_Used;
+    m_Used += size;
+    return ptr;
+}
+
+bool XmlArena::Owns( const void *ptr ) const noexcept
+{
+    auto p = static_cast<const std::byte *>(ptr);
+    return std::any_of(m_Regions.begin(), m_Regions.end(), [p](const Region &region) {
+        return p >= region.data && p < region.data + region.size;
+    });
+}
+
+// Regions double in size, so a document takes a handful of them whatever the file size.
+bool XmlArena::AddRegion( std::size_t min_size )
+{
+    auto size = std::max(m_NextSize, min_size);
+    if( m_HugePages )
+        size = (size + kHugePage - 1) / kHugePage * kHugePage;
+    Region region{nullptr, size, false};
+#if !defined(_WIN32)
+    if( m_HugePages ) {
+        void *addr = MAP_FAILED;
+#if defined(MAP_HUGETLB)
+        addr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+#endif
+        // Without reserved huge pages, ask for transparent ones instead.
+        if( addr == MAP_FAILED ) {
+            addr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+#if defined(MADV_HUGEPAGE)
+            if( addr != MAP_FAILED )
+                madvise(addr, size, MADV_HUGEPAGE);
+#endif
+        }
+        if( addr != MAP_FAILED )
+            region = {static_cast<std::byte *>(addr), size, true};
+    }
+#endif
+    if( !region.data )
+        region.data = static_cast<std::byte *>(std::malloc(size));
+    if( !region.data )
+        return false;
+
+    g_SystemAllocations.fetch_add(1, std::memory_order_relaxed);
+    m_Regions.emplace_back(region);
+    m_Used = 0;
+    m_NextSize = 2 * size;
+    return true;
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+// While alive, serves pugixml's allocations on the constructing thread from a few large
+// regions and ignores its frees; the regions are released in one go when the arena is
+// destroyed. A document is built once and dropped whole, so allocating and freeing it page
+// by page is pure overhead. Documents must be destroyed before the arena that holds them.
+//
+// pugixml's memory functions are process-wide: Install() replaces them with ones that fall
+// back to malloc and free on threads without an arena. Creating an arena installs them.
+class XmlArena
+{
+public:
+    // `expected_size` sizes the first region, e.g. from the size of the file to parse.
+    // With `huge_pages`, regions are backed by huge pages where the system provides them.
+    explicit XmlArena( std::size_t expected_size, bool huge_pages = false );
+    ~XmlArena();
+    XmlArena( const XmlArena & ) = delete;
+    XmlArena &operator=( const XmlArena & ) = delete;
+
+    // Routes pugixml's allocations through the arenas and the counters below from now on.
+    // Only the first call has an effect; documents allocated before it may still be freed.
+    static void Install();
+
+    // Counters over all of pugixml's allocations since Install(), with an arena or without.
+    struct Stats {
+        std::size_t allocations = 0;
+        std::size_t deallocations = 0;
+        std::size_t bytes = 0;              // requested by pugixml
+        std::size_t system_allocations = 0; // calls that reached malloc or mmap
+    };
+    static Stats Totals() noexcept;
+
+private:
+    struct Region {
+        std::byte *data;
+        std::size_t size;
+        bool mapped;
+    };
+
+    static void *Allocate( std::size_t size );
+    static void Deallocate( void *ptr );
+
+    void *Bump( std::size_t size );
+    bool Owns( const void *ptr ) const noexcept;
+    bool AddRegion( std::size_t min_size );
+
+    std::vector<Region> m_Regions;
+    std::size_t m_Used = 0;         // in the last region
+    std::size_t m_NextSize;
+    const bool m_HugePages;
+    XmlArena *m_Previous;
+};
@@ -0,0 +1,145 @@
+#include "gtest/gtest.h"
+#include <algorithm>
+#include <cstdint>
+#include <map>
+#include <random>
+#include <vector>
+#include "../src/id_index.h"
+
+
+// Checks every id the index holds, and the ids on either side of each, against the map it
+// was built from; Find() must miss any id the map doesn't have.
+static void ExpectFinds(const IdIndex &index, const std::map<std::int64_t, int> &expected) {
+    for (const auto &[id, num] : expected) {
+        EXPECT_EQ(index.Find(id), num) << "id " << id;
+        for (auto near : {id - 1, id + 1}) {
+            const auto it = expected.find(near);
+            EXPECT_EQ(index.Find(near), it == expected.end() ? -1 : it->second) << "id " << near;
+        }
+    }
+    if (!expected.empty()) {
+        EXPECT_EQ(index.Find(expected.begin()->first - 1000), -1);
+        EXPECT_EQ(index.Find(expected.rbegin()->first + 1000), -1);
+    }
+}
+
+
+// Memory for the index's entries, without the spare capacity of vectors grown one Add() at a
+// time: appended to an empty index, which reserves exactly the ids it appends.
+static std::size_t EntryBytes(const IdIndex &index) {
+    IdIndex copy;
+    copy.Append(index, 0);
+    return copy.MemoryUsage();
+}
+
+
+// Ids as OSM lists them: ascending, mostly dense, with a few runs far apart, so that
+// interpolating between the ends lands well off the answer.
+static std::vector<std::int64_t> SkewedIds(std::size_t count, std::mt19937 &rng) {
+    std::uniform_int_distribution<int> gap{1, 3};
+    std::vector<std::int64_t> ids;
+    std::int64_t id = 17;
+    for (std::size_t i = 0; i < count; i++) {
+        id += i % 997 == 996 ? 1000000007LL * (1 + i % 5) : gap(rng);
+        ids.push_back(id);
+    }
+    return ids;
+}
+
+
+TEST(IdIndexTest, TestAscendingIdsStoreOnlyIds) {
+    std::mt19937 rng{1};
+    for (std::size_t count : {0, 1, 2, 33, 5000}) {
+        IdIndex index;
+        std::map<std::int64_t, int> expected;
+        const auto ids = SkewedIds(count, rng);
+        for (int i = 0; i < ids.size(); i++) {
+            index.Add(ids[i], i);
+            expected[ids[i]] = i;
+        }
+        index.Finalize();
+        EXPECT_EQ(index.Size(), count);
+        EXPECT_EQ(EntryBytes(index), ids.size() * sizeof(std::int64_t)) << count << " ids";
+        ExpectFinds(index, expected);
+        EXPECT_EQ(index.Find(0), -1);
+    }
+}
+
+
+TEST(IdIndexTest, TestOutOfOrderIdsUseTable) {
+    std::mt19937 rng{2};
+    auto ids = SkewedIds(5000, rng);
+    std::shuffle(ids.begin(), ids.end(), rng);
+    IdIndex index;
+    std::map<std::int64_t, int> expected;
+    for (int i = 0; i < ids.size(); i++) {
+        index.Add(ids[i], i);
+        expected[ids[i]] = i;
+    }
+    index.Finalize();
+    EXPECT_GE(EntryBytes(index), ids.size() * (sizeof(std::int64_t) + sizeof(int)));
+    ExpectFinds(index, expected);
+
+    // Ascending ids numbered other than by position need the table too.
+    IdIndex renumbered;
+    std::map<std::int64_t, int> expected_renumbered;
+    const auto sorted = SkewedIds(3000, rng);
+    for (int i = 0; i < sorted.size(); i++) {
+        renumbered.Add(sorted[i], 2 * i + 5);
+        expected_renumbered[sorted[i]] = 2 * i + 5;
+    }
+    renumbered.Finalize();
+    EXPECT_GE(EntryBytes(renumbered), sorted.size() * (sizeof(std::int64_t) + sizeof(int)));
+    ExpectFinds(renumbered, expected_renumbered);
+}
+
+
+TEST(IdIndexTest, TestDuplicatedIdsResolveToLast) {
+    // In order, a repeated id follows its first element directly.
+    IdIndex ascending;
+    const std::int64_t in_order[] = {3, 5, 5, 5, 8, 13, 13};
+    for (int i = 0; i < 7; i++) {
+        ascending.Add(in_order[i], i);
+    }
+    ascending.Finalize();
+    EXPECT_EQ(ascending.Find(5), 3);
+    EXPECT_EQ(ascending.Find(13), 6);
+    EXPECT_EQ(ascending.Find(3), 0);
+    EXPECT_EQ(ascending.Find(4), -1);
+
+    // Out of order, the elements of a repeated id are anywhere, and many enough that Find()
+    // interpolates before it searches.
+    std::mt19937 rng{3};
+    auto ids = SkewedIds(2000, rng);
+    const auto repeats = ids;
+    ids.insert(ids.end(), repeats.begin(), repeats.begin() + 500);
+    std::shuffle(ids.begin(), ids.end(), rng);
+    IdIndex shuffled;
+    std::map<std::int64_t, int> expected;
+    for (int i = 0; i < ids.size(); i++) {
+        shuffled.Add(ids[i], i);
+        expected[ids[i]] = i;
+    }
+    shuffled.Finalize();
+    ExpectFinds(shuffled, expected);
+}
+
+
+TEST(IdIndexTest, TestAppendOffsetsNumbers) {
+    std::mt19937 rng{4};
+    const auto ids = SkewedIds(4000, rng);
+    IdIndex first, second;
+    std::map<std::int64_t, int> expected;
+    for (int i = 0; i < 1500; i++) {
+        first.Add(ids[i], i);
+        expected[ids[i]] = i;
+    }
+    for (int i = 1500; i < ids.size(); i++) {
+        second.Add(ids[i], i - 1500);
+        expected[ids[i]] = i;
+    }
+    first.Append(second, 1500);
+    first.Finalize();
+    EXPECT_EQ(EntryBytes(first), ids.size() * sizeof(std::int64_t));
+    ExpectFinds(first, expected);
+}
@@ -0,0 +1,83 @@
+#include "gtest/gtest.h"
+#include <algorithm>
+#include <cmath>
+#include <numeric>
+#include <random>
+#include <vector>
+#include "../src/kd_tree.h"
+
+
+// What the tree must agree with: the first strict minimum of a linear scan.
+static int LinearNearest(const std::vector<KdTree::Point> &points, double x, double y) {
+    int closest = -1;
+    float min_dist = 0;
+    for (int i = 0; i < points.size(); i++) {
+        float dist = KdTree::Distance(x, y, points[i].x, points[i].y);
+        if (closest < 0 || dist < min_dist) {
+            closest = i;
+            min_dist = dist;
+        }
+    }
+    return closest;
+}
+
+
+// Points on a coarse grid, with repeats, so that many are equally close to a query.
+static std::vector<KdTree::Point> GridPoints(std::size_t count, std::mt19937 &rng) {
+    std::uniform_int_distribution<int> cell{0, 40};
+    std::vector<KdTree::Point> points;
+    for (std::size_t i = 0; i < count; i++) {
+        points.push_back({cell(rng) * 0.025, cell(rng) * 0.025});
+    }
+    return points;
+}
+
+
+TEST(KdTreeTest, TestNearestMatchesLinearScan) {
+    std::mt19937 rng{7};
+    std::uniform_real_distribution<double> coordinate{-0.1, 1.1};
+    for (std::size_t count : {1, 5, 16, 17, 1000, 20000}) {
+        auto points = GridPoints(count, rng);
+        KdTree tree{points};
+        ASSERT_EQ(tree.Size(), count);
+        for (int query = 0; query < 500; query++) {
+            // Half the queries sit on grid points or halfway between them, where ties are likely.
+            double x = coordinate(rng), y = coordinate(rng);
+            if (query % 2) {
+                x = std::round(x * 80) / 80;
+                y = std::round(y * 80) / 80;
+            }
+            EXPECT_EQ(tree.Nearest(x, y), LinearNearest(points, x, y)) << count << " points, at " << x << ", " << y;
+        }
+    }
+}
+
+
+TEST(KdTreeTest, TestKNearestMatchesSort) {
+    std::mt19937 rng{11};
+    std::uniform_real_distribution<double> coordinate{0., 1.};
+    auto points = GridPoints(5000, rng);
+    KdTree tree{points};
+    for (int query = 0; query < 100; query++) {
+        double x = coordinate(rng), y = coordinate(rng);
+        std::vector<int> expected(points.size());
+        std::iota(expected.begin(), expected.end(), 0);
+        std::stable_sort(expected.begin(), expected.end(), [&](int a, int b) {
+            return KdTree::Distance(x, y, points[a].x, points[a].y) < KdTree::Distance(x, y, points[b].x, points[b].y);
+        });
+        for (std::size_t k : {1, 2, 10, 64}) {
+            EXPECT_EQ(tree.Nearest(x, y, k), std::vector<int>(expected.begin(), expected.begin() + k));
+        }
+    }
+}
+
+
+TEST(KdTreeTest, TestEmptyAndSmall) {
+    KdTree empty;
+    EXPECT_EQ(empty.Nearest(0., 0.), -1);
+    EXPECT_TRUE(empty.Nearest(0., 0., 3).empty());
+
+    KdTree two{{{0., 0.}, {1., 1.}}};
+    EXPECT_EQ(two.Nearest(0.9, 0.9, 5), (std::vector<int>{1, 0}));
+    EXPECT_TRUE(two.Nearest(0.9, 0.9, 0).empty());
+}
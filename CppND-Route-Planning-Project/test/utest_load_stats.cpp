@@ -0,0 +1,232 @@
+#include "gtest/gtest.h"
+#include <algorithm>
+#include <cctype>
+#include <cstddef>
+#include <limits>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+#include "../src/load_stats.h"
+#include "../src/route_model.h"
+
+
+static std::vector<std::byte> Bytes(const std::string &text) {
+    const auto data = reinterpret_cast<const std::byte *>(text.data());
+    return std::vector<std::byte>(data, data + text.size());
+}
+
+
+// A strict reader of JSON text, as far as telling whether it is well-formed; the strings it
+// reads are collected, so that tests can look for names.
+class JsonChecker {
+  public:
+    explicit JsonChecker(std::string text) : text(std::move(text)) {}
+
+    bool WellFormed() {
+        pos = 0;
+        strings.clear();
+        if (!Value()) {
+            return false;
+        }
+        Space();
+        return pos == text.size();
+    }
+
+    std::vector<std::string> strings;
+
+  private:
+    void Space() {
+        while (pos < text.size() && std::isspace((unsigned char)text[pos])) {
+            pos++;
+        }
+    }
+
+    bool Literal(const std::string &word) {
+        if (text.compare(pos, word.size(), word) != 0) {
+            return false;
+        }
+        pos += word.size();
+        return true;
+    }
+
+    bool Value() {
+        Space();
+        if (pos == text.size()) {
+            return false;
+        }
+        switch (text[pos]) {
+            case '{': return Composite('}', true);
+            case '[': return Composite(']', false);
+            case '"': return String();
+            case 't': return Literal("true");
+            case 'f': return Literal("false");
+            case 'n': return Literal("null");
+            default: return Number();
+        }
+    }
+
+    // An object or array: values, or "name": value pairs, separated by commas.
+    bool Composite(char close, bool named) {
+        pos++;
+        Space();
+        if (pos < text.size() && text[pos] == close) {
+            pos++;
+            return true;
+        }
+        while (true) {
+            if (named) {
+                Space();
+                if (pos == text.size() || text[pos] != '"' || !String()) {
+                    return false;
+                }
+                Space();
+                if (!Literal(":")) {
+                    return false;
+                }
+            }
+            if (!Value()) {
+                return false;
+            }
+            Space();
+            if (Literal(",")) {
+                continue;
+            }
+            return Literal(std::string(1, close));
+        }
+    }
+
+    bool String() {
+        std::string value;
+        for (pos++; pos < text.size(); pos++) {
+            const char c = text[pos];
+            if (c == '"') {
+                pos++;
+                strings.push_back(value);
+                return true;
+            }
+            if ((unsigned char)c < 0x20) {
+                return false;
+            }
+            if (c == '\\') {
+                if (++pos == text.size() || std::string("\"\\/bfnrtu").find(text[pos]) == std::string::npos) {
+                    return false;
+                }
+            }
+            value += c;
+        }
+        return false;
+    }
+
+    bool Number() {
+        const auto start = pos;
+        Literal("-");
+        if (Literal("0")) {
+        } else if (!Digits()) {
+            return false;
+        }
+        if (Literal(".") && !Digits()) {
+            return false;
+        }
+        if (pos < text.size() && (text[pos] == 'e' || text[pos] == 'E')) {
+            pos++;
+            if (!Literal("+")) {
+                Literal("-");
+            }
+            if (!Digits()) {
+                return false;
+            }
+        }
+        return pos > start;
+    }
+
+    bool Digits() {
+        const auto start = pos;
+        while (pos < text.size() && std::isdigit((unsigned char)text[pos])) {
+            pos++;
+        }
+        return pos > start;
+    }
+
+    std::string text;
+    std::size_t pos = 0;
+};
+
+
+static const RouteModel &StatsModel() {
+    static const RouteModel model{Bytes(
+        "<osm>\n <bounds minlat=\"47.0\" minlon=\"8.0\" maxlat=\"47.1\" maxlon=\"8.1\"/>\n"
+        " <node id=\"1\" lat=\"47.01\" lon=\"8.01\"/>\n <node id=\"2\" lat=\"47.02\" lon=\"8.02\"/>\n"
+        " <node id=\"3\" lat=\"47.03\" lon=\"8.02\"/>\n"
+        " <way id=\"1\">\n  <nd ref=\"1\"/>\n  <nd ref=\"2\"/>\n  <nd ref=\"3\"/>\n"
+        "  <tag k=\"highway\" v=\"primary\"/>\n </way>\n</osm>\n")};
+    return model;
+}
+
+
+template <typename Entry>
+static std::vector<std::string> Names(const std::vector<Entry> &entries) {
+    std::vector<std::string> names;
+    for (const auto &entry : entries) {
+        names.push_back(entry.name);
+    }
+    return names;
+}
+
+
+TEST(LoadStatsTest, TestLoadReportsPhasesAndContainers) {
+    const auto stats = StatsModel().GetLoadStats();
+    EXPECT_EQ(Names(stats.phases), (std::vector<std::string>{"parse", "nodes", "ways", "projection", "compaction",
+                                                             "quantization", "road sort", "node-to-road index",
+                                                             "adjacency", "snap indices"}));
+    for (const auto &phase : stats.phases) {
+        EXPECT_GE(phase.milliseconds, 0.) << phase.name;
+    }
+
+    const auto containers = Names(stats.containers);
+    for (const auto *name : {"nodes", "ways", "roads", "railways", "buildings", "leisures", "waters", "landuses",
+                             "node-to-road index", "adjacency", "snap index", "segment index"}) {
+        EXPECT_NE(std::find(containers.begin(), containers.end(), name), containers.end()) << name;
+    }
+    auto container = [&](const std::string &name) {
+        return stats.containers[std::find(containers.begin(), containers.end(), name) - containers.begin()];
+    };
+    EXPECT_EQ(container("nodes").count, 3u);
+    EXPECT_EQ(container("ways").count, 1u);
+    EXPECT_EQ(container("roads").count, 1u);
+    EXPECT_EQ(container("segment index").count, 2u);
+    EXPECT_GT(container("adjacency").bytes, 0u);
+
+    EXPECT_EQ(Names(stats.counters), (std::vector<std::string>{"node id bytes/node", "way id bytes/way"}));
+}
+
+
+TEST(LoadStatsTest, TestPrintedStatsAreComplete) {
+    auto stats = StatsModel().GetLoadStats();
+    std::ostringstream table;
+    stats.PrintTable(table);
+    for (const auto &name : Names(stats.phases)) {
+        EXPECT_NE(table.str().find("\n" + name + " "), std::string::npos) << name;
+    }
+    for (const auto &name : Names(stats.containers)) {
+        EXPECT_NE(table.str().find("\n" + name + " "), std::string::npos) << name;
+    }
+
+    // Counters that aren't finite too, as JSON has no way to write them as numbers.
+    stats.counters.push_back({"not a number", std::numeric_limits<double>::quiet_NaN()});
+    stats.counters.push_back({"infinite", std::numeric_limits<double>::infinity()});
+    std::ostringstream json;
+    stats.PrintJson(json);
+    JsonChecker checker{json.str()};
+    ASSERT_TRUE(checker.WellFormed()) << json.str();
+    for (const auto &names : {Names(stats.phases), Names(stats.containers), Names(stats.counters)}) {
+        for (const auto &name : names) {
+            EXPECT_NE(std::find(checker.strings.begin(), checker.strings.end(), name), checker.strings.end()) << name;
+        }
+    }
+
+    // The checker itself rejects what isn't JSON.
+    for (const auto *text : {"{\"a\": nan}", "{\"a\": 1,}", "[1 2]", "{\"a\" 1}", "{\"a\": 1} x", "{\"a\": .5}"}) {
+        EXPECT_FALSE(JsonChecker{text}.WellFormed()) << text;
+    }
+}
@@ -0,0 +1,191 @@
+#include "gtest/gtest.h"
+#include <cstddef>
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "../src/route_model.h"
+#include "../src/route_planner.h"
+
+
+static std::vector<std::byte> Bytes(const std::string &text) {
+    const auto data = reinterpret_cast<const std::byte *>(text.data());
+    return std::vector<std::byte>(data, data + text.size());
+}
+
+
+// A map as elements by id, to write out before and after a change. Coordinates are in
+// millionths of a degree, so that both files describe exactly the same doubles.
+struct ElementMap {
+    struct Node { int lat, lon; };
+    struct Way {
+        std::vector<long long> refs;
+        std::string key, value;
+    };
+    std::map<long long, Node> nodes;
+    std::map<long long, Way> ways;
+};
+
+
+static std::string Degrees(int millionths) {
+    return std::to_string(millionths / 1000000) + "." + std::to_string(1000000 + millionths % 1000000).substr(1);
+}
+
+
+static std::string NodeXml(long long id, const ElementMap::Node &node) {
+    return "  <node id=\"" + std::to_string(id) + "\" lat=\"" + Degrees(node.lat) + "\" lon=\"" + Degrees(node.lon) + "\"/>\n";
+}
+
+
+static std::string WayXml(long long id, const ElementMap::Way &way) {
+    std::string xml = "  <way id=\"" + std::to_string(id) + "\">\n";
+    for (auto ref : way.refs) {
+        xml += "   <nd ref=\"" + std::to_string(ref) + "\"/>\n";
+    }
+    return xml + "   <tag k=\"" + way.key + "\" v=\"" + way.value + "\"/>\n  </way>\n";
+}
+
+
+static std::string ToOsm(const ElementMap &map) {
+    std::string osm = "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n<osm version=\"0.6\">\n";
+    osm += " <bounds minlat=\"47.000000\" minlon=\"8.000000\" maxlat=\"47.100000\" maxlon=\"8.100000\"/>\n";
+    for (const auto &[id, node] : map.nodes) {
+        osm += NodeXml(id, node);
+    }
+    for (const auto &[id, way] : map.ways) {
+        osm += WayXml(id, way);
+    }
+    return osm + "</osm>\n";
+}
+
+
+static long long GridNode(int row, int col) {
+    return 100 + 8 * row + col;
+}
+
+
+// An 8 x 8 grid of nodes, slightly out of line so that no two routes tie, with a residential
+// road along every row and column, and a service road off to one side.
+static ElementMap GridMap() {
+    ElementMap map;
+    for (int row = 0; row < 8; row++) {
+        for (int col = 0; col < 8; col++) {
+            const int jitter = (row * 7 + col * 13) % 11 * 300;
+            map.nodes[GridNode(row, col)] = {47010000 + 11000 * row + jitter, 8010000 + 11000 * col - jitter};
+        }
+    }
+    for (int i = 0; i < 8; i++) {
+        map.ways[1 + i] = {{}, "highway", "residential"};
+        map.ways[11 + i] = {{}, "highway", "residential"};
+        for (int j = 0; j < 8; j++) {
+            map.ways[1 + i].refs.push_back(GridNode(i, j));
+            map.ways[11 + i].refs.push_back(GridNode(j, i));
+        }
+    }
+    map.nodes[800] = {47040000, 8095000};
+    map.nodes[801] = {47060000, 8095000};
+    map.ways[30] = {{GridNode(3, 7), 800, 801, GridNode(5, 7)}, "highway", "service"};
+    return map;
+}
+
+
+TEST(OsmChangeTest, TestChangedMapMatchesFreshLoad) {
+    const auto base = GridMap();
+    auto edited = base;
+    std::string created, modified, deleted;
+
+    // A primary road across the grid through two new nodes.
+    edited.nodes[900] = {47030000, 8040000};
+    edited.nodes[901] = {47055000, 8062000};
+    edited.ways[50] = {{GridNode(1, 1), 900, 901, GridNode(6, 6)}, "highway", "primary"};
+    created += NodeXml(900, edited.nodes[900]) + NodeXml(901, edited.nodes[901]) + WayXml(50, edited.ways[50]);
+
+    // A node moved, a road cut short, and a road that is no longer one.
+    edited.nodes[GridNode(3, 3)].lat += 4000;
+    edited.ways[4].refs.resize(5);
+    edited.ways[15] = {edited.ways[15].refs, "name", "Old Lane"};
+    modified += NodeXml(GridNode(3, 3), edited.nodes[GridNode(3, 3)]) + WayXml(4, edited.ways[4]) +
+                WayXml(15, edited.ways[15]);
+
+    // A road gone, and the service road gone with its nodes.
+    deleted += WayXml(7, edited.ways[7]) + WayXml(30, edited.ways[30]) + NodeXml(800, edited.nodes[800]) +
+               NodeXml(801, edited.nodes[801]);
+    edited.ways.erase(7);
+    edited.ways.erase(30);
+    edited.nodes.erase(800);
+    edited.nodes.erase(801);
+
+    const auto osc = "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n<osmChange version=\"0.6\">\n <create>\n" + created +
+                     " </create>\n <modify>\n" + modified + " </modify>\n <delete>\n" + deleted +
+                     " </delete>\n</osmChange>\n";
+
+    RouteModel::LoadOptions options;
+    options.updatable = true;
+    const auto base_osm = Bytes(ToOsm(base));
+    RouteModel updated{base_osm.data(), base_osm.size(), options};
+    const auto change = Bytes(osc);
+    updated.ApplyChange(change.data(), change.size());
+    const RouteModel fresh{Bytes(ToOsm(edited))};
+
+    for (float x = 2.f; x < 100.f; x += 7.f) {
+        for (float y = 3.f; y < 100.f; y += 7.f) {
+            const auto a = updated.FindClosestNode(x / 100.f, y / 100.f);
+            const auto b = fresh.FindClosestNode(x / 100.f, y / 100.f);
+            EXPECT_FLOAT_EQ(a.x, b.x) << x << ", " << y;
+            EXPECT_FLOAT_EQ(a.y, b.y) << x << ", " << y;
+            const auto near_a = updated.FindClosestNodes(x / 100.f, y / 100.f, 6);
+            const auto near_b = fresh.FindClosestNodes(x / 100.f, y / 100.f, 6);
+            ASSERT_EQ(near_a.size(), near_b.size());
+            for (std::size_t i = 0; i < near_a.size(); i++) {
+                EXPECT_FLOAT_EQ(near_a[i].x, near_b[i].x) << x << ", " << y << " #" << i;
+                EXPECT_FLOAT_EQ(near_a[i].y, near_b[i].y) << x << ", " << y << " #" << i;
+            }
+            const double px = x, py = y;
+            int node = -1;
+            updated.SnapToNodes(&px, &py, 1, RouteModel::Units::Percent, &node);
+            EXPECT_EQ(node, a.Index());
+            const auto on_a = updated.SnapToSegment(x / 100.f, y / 100.f);
+            const auto on_b = fresh.SnapToSegment(x / 100.f, y / 100.f);
+            EXPECT_FLOAT_EQ(on_a.distance, on_b.distance) << x << ", " << y;
+            EXPECT_FLOAT_EQ(on_a.point.x, on_b.point.x) << x << ", " << y;
+            EXPECT_FLOAT_EQ(on_a.point.y, on_b.point.y) << x << ", " << y;
+        }
+    }
+
+    const float queries[][4] = {{12, 12, 88, 82}, {20, 90, 85, 15}, {5, 40, 95, 45}, {45, 5, 48, 95}, {40, 40, 70, 60}};
+    for (const auto snap : {RoutePlanner::SnapTo::Node, RoutePlanner::SnapTo::Segment}) {
+        for (const auto &q : queries) {
+            RoutePlanner a{updated, q[0], q[1], q[2], q[3], snap};
+            a.AStarSearch();
+            RoutePlanner b{fresh, q[0], q[1], q[2], q[3], snap};
+            b.AStarSearch();
+            EXPECT_FLOAT_EQ(a.GetDistance(), b.GetDistance());
+            ASSERT_EQ(a.GetPath().size(), b.GetPath().size());
+            for (std::size_t i = 0; i < a.GetPath().size(); i++) {
+                EXPECT_FLOAT_EQ(a.GetPath()[i].x, b.GetPath()[i].x);
+                EXPECT_FLOAT_EQ(a.GetPath()[i].y, b.GetPath()[i].y);
+            }
+        }
+    }
+}
+
+
+// Only a document whose root is <osmChange> is a change, whatever its text mentions.
+TEST(OsmChangeTest, TestOtherDocumentsAreRejected) {
+    RouteModel::LoadOptions options;
+    options.updatable = true;
+    const auto base_osm = Bytes(ToOsm(GridMap()));
+    RouteModel model{base_osm.data(), base_osm.size(), options};
+
+    const auto osm = Bytes("<osm version=\"0.6\">\n <way id=\"1\">\n  <tag k=\"note\" v=\"&lt;osmChange\"/>\n"
+                           "  <tag k=\"fixme\" v=\"<osmChange>\"/>\n </way>\n</osm>\n");
+    EXPECT_THROW(model.ApplyChange(osm.data(), osm.size()), std::logic_error);
+    // The failed change is timed up to its error, not into whatever phase starts next.
+    ASSERT_FALSE(model.GetLoadStats().phases.empty());
+    EXPECT_EQ(model.GetLoadStats().phases.back().name, "change");
+    const auto empty = Bytes("<?xml version=\"1.0\"?>\n<!-- <osmChange> -->\n");
+    EXPECT_THROW(model.ApplyChange(empty.data(), empty.size()), std::logic_error);
+
+    const auto no_op = Bytes("<?xml version=\"1.0\"?>\n<!-- daily diff -->\n<osmChange version=\"0.6\"/>\n");
+    EXPECT_NO_THROW(model.ApplyChange(no_op.data(), no_op.size()));
+}
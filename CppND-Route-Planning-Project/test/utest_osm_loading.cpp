@@ -0,0 +1,780 @@
+#include "gtest/gtest.h"
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iterator>
+#include <map>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <zlib.h>
+#include "../src/model.h"
+#include "../src/osm_parser.h"
+#include "../src/route_model.h"
+#include "../src/route_planner.h"
+#include "../src/xml_arena.h"
+
+
+static std::vector<std::byte> Bytes(const std::string &text) {
+    const auto data = reinterpret_cast<const std::byte *>(text.data());
+    return std::vector<std::byte>(data, data + text.size());
+}
+
+
+// A map to write out in the formats under test. Coordinates are in millionths of a degree, so
+// that XML text and PBF integers describe exactly the same doubles.
+struct TestMap {
+    struct Node { long long id; int lat, lon; };
+    struct Element {
+        long long id;
+        std::vector<long long> refs;                    // node ids, or way ids of members
+        std::vector<std::string> roles;                 // relations only
+        std::vector<std::pair<std::string, std::string>> tags;
+    };
+    int min_lat, min_lon, max_lat, max_lon;
+    std::vector<Node> nodes;
+    std::vector<Element> ways, relations;
+};
+
+
+// A grid of size x size nodes with sparse ids, a residential road along every row and a
+// footway along every column, and a lake relation whose outer ring is split over two ways.
+static TestMap GridMap(int size) {
+    auto node_id = [size](int row, int col) { return 1000 + 3 * (row * size + col); };
+    TestMap map{47000000, 8000000, 47100000, 8100000};
+    for (int row = 0; row < size; row++) {
+        for (int col = 0; col < size; col++) {
+            map.nodes.push_back({node_id(row, col), 47000000 + 100000 * row / size, 8000000 + 100000 * col / size});
+        }
+    }
+    for (int row = 0; row < size; row++) {
+        TestMap::Element way{(long long)map.ways.size() + 1, {}, {}, {{"highway", "residential"}}};
+        for (int col = 0; col < size; col++) {
+            way.refs.push_back(node_id(row, col));
+        }
+        map.ways.push_back(way);
+    }
+    for (int col = 0; col < size; col++) {
+        TestMap::Element way{(long long)map.ways.size() + 1, {}, {}, {{"highway", "footway"}}};
+        for (int row = 0; row < size; row++) {
+            way.refs.push_back(node_id(row, col));
+        }
+        map.ways.push_back(way);
+    }
+    const long long half = map.ways.size() + 1;
+    map.ways.push_back({half, {node_id(1, 1), node_id(1, 2), node_id(2, 2)}, {}, {{"source", "survey"}}});
+    map.ways.push_back({half + 1, {node_id(2, 2), node_id(2, 1), node_id(1, 1)}, {}, {{"source", "survey"}}});
+    map.relations.push_back({1, {half, half + 1}, {"outer", "outer"}, {{"natural", "water"}}});
+    return map;
+}
+
+
+static std::string Degrees(int millionths) {
+    char text[32];
+    std::snprintf(text, sizeof(text), "%s%d.%06d", millionths < 0 ? "-" : "", std::abs(millionths) / 1000000,
+                  std::abs(millionths) % 1000000);
+    return text;
+}
+
+
+static std::string ToOsm(const TestMap &map) {
+    std::string osm = "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n<osm version=\"0.6\">\n";
+    osm += " <bounds minlat=\"" + Degrees(map.min_lat) + "\" minlon=\"" + Degrees(map.min_lon) + "\" maxlat=\"" +
+           Degrees(map.max_lat) + "\" maxlon=\"" + Degrees(map.max_lon) + "\"/>\n";
+    for (std::size_t i = 0; i < map.nodes.size(); i++) {
+        const auto &node = map.nodes[i];
+        osm += " <node id=\"" + std::to_string(node.id) + "\" lat=\"" + Degrees(node.lat) + "\" lon=\"" +
+               Degrees(node.lon) + "\"";
+        // Some nodes have tags, so not every node is a single element.
+        osm += i % 7 ? "/>\n" : ">\n  <tag k=\"highway\" v=\"crossing\"/>\n </node>\n";
+    }
+    auto add_tags = [&](const TestMap::Element &element) {
+        for (const auto &[key, value] : element.tags) {
+            osm += "  <tag k=\"" + key + "\" v=\"" + value + "\"/>\n";
+        }
+    };
+    for (const auto &way : map.ways) {
+        osm += " <way id=\"" + std::to_string(way.id) + "\">\n";
+        for (auto ref : way.refs) {
+            osm += "  <nd ref=\"" + std::to_string(ref) + "\"/>\n";
+        }
+        add_tags(way);
+        osm += " </way>\n";
+    }
+    for (const auto &relation : map.relations) {
+        osm += " <relation id=\"" + std::to_string(relation.id) + "\">\n";
+        for (std::size_t i = 0; i < relation.refs.size(); i++) {
+            osm += "  <member type=\"way\" ref=\"" + std::to_string(relation.refs[i]) + "\" role=\"" +
+                   relation.roles[i] + "\"/>\n";
+        }
+        add_tags(relation);
+        osm += " </relation>\n";
+    }
+    return osm + "</osm>\n";
+}
+
+
+// Protobuf wire format, as far as the PBF writer below needs it.
+static void Varint(std::string &out, unsigned long long value) {
+    for (; value >= 0x80; value >>= 7) {
+        out += (char)((value & 0x7f) | 0x80);
+    }
+    out += (char)value;
+}
+
+static unsigned long long Zigzag(long long value) {
+    return (unsigned long long)value << 1 ^ (unsigned long long)(value >> 63);
+}
+
+static void Field(std::string &out, int field, unsigned long long value) {
+    Varint(out, (unsigned long long)field << 3);
+    Varint(out, value);
+}
+
+static void Field(std::string &out, int field, const std::string &bytes) {
+    Varint(out, (unsigned long long)field << 3 | 2);
+    Varint(out, bytes.size());
+    out += bytes;
+}
+
+template <typename T, typename Encode>
+static std::string Packed(const std::vector<T> &values, Encode encode) {
+    std::string packed;
+    for (const auto &value : values) {
+        Varint(packed, encode(value));
+    }
+    return packed;
+}
+
+static std::string Zlib(const std::string &data) {
+    std::string compressed(compressBound(data.size()), '\0');
+    auto size = (uLongf)compressed.size();
+    compress(reinterpret_cast<Bytef *>(&compressed[0]), &size, reinterpret_cast<const Bytef *>(data.data()), data.size());
+    compressed.resize(size);
+    return compressed;
+}
+
+// A file frame: the big-endian size of the BlobHeader, the BlobHeader, and the Blob.
+static std::string Frame(const std::string &type, const std::string &blob) {
+    std::string header;
+    Field(header, 1, type);
+    Field(header, 3, blob.size());
+    std::string frame;
+    for (int shift = 24; shift >= 0; shift -= 8) {
+        frame += (char)(header.size() >> shift & 0xff);
+    }
+    return frame + header + blob;
+}
+
+static std::string Blob(const std::string &data, bool compressed) {
+    std::string blob;
+    if (compressed) {
+        Field(blob, 2, data.size());
+        Field(blob, 3, Zlib(data));
+    } else {
+        Field(blob, 1, data);
+    }
+    return blob;
+}
+
+struct PbfFile {
+    std::string bytes;
+    std::vector<std::size_t> frame_ends;
+
+    void Add(const std::string &frame) {
+        bytes += frame;
+        frame_ends.push_back(bytes.size());
+    }
+};
+
+// Writes the map as an .osm.pbf with dense nodes, `nodes_per_block` to a block, then a block of
+// ways and one of relations. Every other data block is compressed.
+static PbfFile ToPbf(const TestMap &map, std::size_t nodes_per_block) {
+    PbfFile file;
+    std::string header, bbox;
+    Field(bbox, 1, Zigzag(map.min_lon * 1000LL));
+    Field(bbox, 2, Zigzag(map.max_lon * 1000LL));
+    Field(bbox, 3, Zigzag(map.max_lat * 1000LL));
+    Field(bbox, 4, Zigzag(map.min_lat * 1000LL));
+    Field(header, 1, bbox);
+    Field(header, 4, std::string{"OsmSchema-V0.6"});
+    Field(header, 4, std::string{"DenseNodes"});
+    file.Add(Frame("OSMHeader", Blob(header, false)));
+
+    bool compressed = true;
+    auto add_block = [&](const std::vector<std::string> &strings, const std::string &group) {
+        std::string table, block;
+        for (const auto &string : strings) {
+            Field(table, 1, string);
+        }
+        Field(block, 1, table);
+        Field(block, 2, group);
+        file.Add(Frame("OSMData", Blob(block, compressed)));
+        compressed = !compressed;
+    };
+
+    // Coordinates are in the default granularity of 100 nanodegrees.
+    for (std::size_t begin = 0; begin < map.nodes.size(); begin += nodes_per_block) {
+        const auto end = std::min(begin + nodes_per_block, map.nodes.size());
+        std::vector<long long> ids, lats, lons;
+        for (auto i = begin; i < end; i++) {
+            const auto &node = map.nodes[i];
+            const auto &previous = map.nodes[i == begin ? i : i - 1];
+            ids.push_back(node.id - (i == begin ? 0 : previous.id));
+            lats.push_back((node.lat - (i == begin ? 0 : previous.lat)) * 10LL);
+            lons.push_back((node.lon - (i == begin ? 0 : previous.lon)) * 10LL);
+        }
+        std::string dense, group;
+        Field(dense, 1, Packed(ids, Zigzag));
+        Field(dense, 8, Packed(lats, Zigzag));
+        Field(dense, 9, Packed(lons, Zigzag));
+        Field(group, 2, dense);
+        add_block({""}, group);
+    }
+
+    std::vector<std::string> strings{""};
+    auto string_index = [&](const std::string &string) {
+        const auto it = std::find(strings.begin(), strings.end(), string);
+        if (it != strings.end()) {
+            return (unsigned long long)(it - strings.begin());
+        }
+        strings.push_back(string);
+        return (unsigned long long)strings.size() - 1;
+    };
+    auto add_tags = [&](std::string &message, const TestMap::Element &element) {
+        std::vector<unsigned long long> keys, values;
+        for (const auto &[key, value] : element.tags) {
+            keys.push_back(string_index(key));
+            values.push_back(string_index(value));
+        }
+        Field(message, 2, Packed(keys, [](auto v) { return v; }));
+        Field(message, 3, Packed(values, [](auto v) { return v; }));
+    };
+    auto deltas = [](const std::vector<long long> &refs) {
+        std::vector<long long> deltas;
+        for (std::size_t i = 0; i < refs.size(); i++) {
+            deltas.push_back(refs[i] - (i ? refs[i - 1] : 0));
+        }
+        return deltas;
+    };
+
+    std::string ways;
+    for (const auto &way : map.ways) {
+        std::string message;
+        Field(message, 1, way.id);
+        add_tags(message, way);
+        Field(message, 8, Packed(deltas(way.refs), Zigzag));
+        Field(ways, 3, message);
+    }
+    add_block(strings, ways);
+
+    strings.assign(1, "");
+    std::string relations;
+    for (const auto &relation : map.relations) {
+        std::string message;
+        std::vector<unsigned long long> roles, types(relation.refs.size(), 1);
+        for (const auto &role : relation.roles) {
+            roles.push_back(string_index(role));
+        }
+        Field(message, 1, relation.id);
+        add_tags(message, relation);
+        Field(message, 8, Packed(roles, [](auto v) { return v; }));
+        Field(message, 9, Packed(deltas(relation.refs), Zigzag));
+        Field(message, 10, Packed(types, [](auto v) { return v; }));
+        Field(relations, 4, message);
+    }
+    add_block(strings, relations);
+    return file;
+}
+
+
+static void ExpectSameModel(const Model &expected, const Model &actual) {
+    EXPECT_EQ(expected.MetricScale(), actual.MetricScale());
+    ASSERT_EQ(expected.Nodes().size(), actual.Nodes().size());
+    for (std::size_t i = 0; i < expected.Nodes().size(); i++) {
+        EXPECT_EQ(expected.Nodes()[i].x, actual.Nodes()[i].x) << "node " << i;
+        EXPECT_EQ(expected.Nodes()[i].y, actual.Nodes()[i].y) << "node " << i;
+    }
+    ASSERT_EQ(expected.Ways().size(), actual.Ways().size());
+    for (std::size_t i = 0; i < expected.Ways().size(); i++) {
+        const auto a = expected.Ways()[i].nodes, b = actual.Ways()[i].nodes;
+        EXPECT_EQ(std::vector<int>(a.begin(), a.end()), std::vector<int>(b.begin(), b.end())) << "way " << i;
+    }
+    ASSERT_EQ(expected.Roads().size(), actual.Roads().size());
+    for (std::size_t i = 0; i < expected.Roads().size(); i++) {
+        EXPECT_EQ(expected.Roads()[i].way, actual.Roads()[i].way);
+        EXPECT_EQ(expected.Roads()[i].type, actual.Roads()[i].type);
+    }
+    ASSERT_EQ(expected.Waters().size(), actual.Waters().size());
+    for (std::size_t i = 0; i < expected.Waters().size(); i++) {
+        EXPECT_EQ(expected.Waters()[i].outer, actual.Waters()[i].outer);
+        EXPECT_EQ(expected.Waters()[i].inner, actual.Waters()[i].inner);
+    }
+}
+
+
+// The parallel parser splits the node and way sections into chunks; appending the chunks must
+// number nodes and ways as a single pass does.
+TEST(OsmLoadingTest, TestParallelParseMatchesSequential) {
+    const auto osm = Bytes(ToOsm(GridMap(240)));
+    const auto sections = FindOsmSections(osm.data(), osm.size());
+    ASSERT_TRUE(sections);
+    ASSERT_EQ(SplitOsmSection(osm.data(), sections->nodes, sections->ways, "node", 4).size(), 5);
+    ASSERT_GT(osm.size(), 4u << 20);
+
+    Model::LoadOptions sequential;
+    sequential.threads = 1;
+    Model::LoadOptions parallel;
+    parallel.threads = 4;
+    const Model expected{osm, sequential};
+    const Model actual{osm, parallel};
+    EXPECT_EQ(expected.Nodes().size(), 240 * 240);
+    EXPECT_EQ(expected.Roads().size(), 2 * 240);
+    EXPECT_EQ(expected.Waters().size(), 1);
+    ExpectSameModel(expected, actual);
+}
+
+
+TEST(OsmLoadingTest, TestPbfMatchesOsm) {
+    const auto map = GridMap(12);
+    const auto pbf = ToPbf(map, 50);
+    const Model expected{Bytes(ToOsm(map))};
+    Model::LoadOptions options;
+    options.threads = 2;
+    const Model actual{reinterpret_cast<const std::byte *>(pbf.bytes.data()), pbf.bytes.size(), options};
+    EXPECT_EQ(expected.Nodes().size(), 12 * 12);
+    EXPECT_EQ(expected.Ways().size(), 2 * 12 + 3);    // and the water's assembled ring
+    EXPECT_EQ(expected.Roads().size(), 2 * 12);
+    ExpectSameModel(expected, actual);
+}
+
+
+// A file cut anywhere but between frames must be rejected, not read past its end.
+TEST(OsmLoadingTest, TestTruncatedPbfThrows) {
+    const auto pbf = ToPbf(GridMap(6), 10);
+    for (std::size_t size = 1; size < pbf.bytes.size(); size++) {
+        if (std::find(pbf.frame_ends.begin(), pbf.frame_ends.end(), size) != pbf.frame_ends.end()) {
+            continue;
+        }
+        const auto data = Bytes(pbf.bytes.substr(0, size));
+        EXPECT_THROW(Model(data.data(), data.size(), {}), std::logic_error) << "cut at " << size;
+    }
+}
+
+
+TEST(OsmLoadingTest, TestCorruptPbfThrows) {
+    const auto map = GridMap(4);
+    const auto header = ToPbf(map, 100).bytes.substr(0, ToPbf(map, 100).frame_ends[0]);
+    std::string nodes, group, dense;
+    Field(dense, 1, Packed(std::vector<long long>{1}, Zigzag));
+    Field(dense, 8, Packed(std::vector<long long>{470000000}, Zigzag));
+    Field(dense, 9, Packed(std::vector<long long>{80000000}, Zigzag));
+    Field(group, 2, dense);
+    std::string table;
+    Field(table, 1, std::string{});
+    Field(nodes, 1, table);
+    Field(nodes, 2, group);
+    auto load = [&](const std::string &blob) {
+        const auto data = Bytes(header + Frame("OSMData", blob));
+        return Model(data.data(), data.size(), {});
+    };
+    EXPECT_NO_THROW(load(Blob(nodes, true)));
+
+    // Sizes that don't match the data, or that no block may have.
+    std::string blob;
+    Field(blob, 2, nodes.size() + 1);
+    Field(blob, 3, Zlib(nodes));
+    EXPECT_THROW(load(blob), std::logic_error);
+    blob.clear();
+    Field(blob, 2, 1ULL << 40);
+    Field(blob, 3, Zlib(nodes));
+    EXPECT_THROW(load(blob), std::logic_error);
+    blob.clear();
+    Field(blob, 2, nodes.size());
+    Field(blob, 3, std::string{"not zlib data"});
+    EXPECT_THROW(load(blob), std::logic_error);
+
+    // A message longer than its block, and a tag naming a string past the table.
+    EXPECT_THROW(load(Blob(nodes.substr(0, nodes.size() - 1), false)), std::logic_error);
+    std::string way, ways, block = nodes.substr(0, nodes.find(group) - 2);
+    Field(way, 1, 1ULL);
+    Field(way, 2, Packed(std::vector<int>{7}, [](auto v) { return v; }));
+    Field(way, 3, Packed(std::vector<int>{0}, [](auto v) { return v; }));
+    Field(ways, 3, way);
+    Field(block, 2, ways);
+    EXPECT_THROW(load(Blob(block, false)), std::logic_error);
+}
+
+
+// Bytes changed at random may give another valid file, but never a crash or a read past the
+// buffer; whatever is rejected is rejected with std::logic_error.
+TEST(OsmLoadingTest, TestDamagedPbfIsRejectedOrRead) {
+    const auto pbf = ToPbf(GridMap(6), 10).bytes;
+    std::mt19937 rng{5};
+    for (int attempt = 0; attempt < 2000; attempt++) {
+        auto damaged = pbf;
+        damaged[rng() % damaged.size()] = (char)rng();
+        const auto data = Bytes(damaged);
+        try {
+            Model model{data.data(), data.size(), {}};
+        } catch (const std::logic_error &) {
+        }
+    }
+}
+
+
+// A way that leaves the bounding box and comes back is split where it leaves, not joined across
+// the part outside.
+TEST(OsmLoadingTest, TestBoundingBoxSplitsWaysAtItsEdge) {
+    TestMap map{47000000, 8000000, 47500000, 8500000};
+    map.nodes = {{1, 47010000, 8010000}, {2, 47020000, 8020000}, {3, 47200000, 8020000},
+                 {4, 47030000, 8030000}, {5, 47040000, 8030000}, {6, 47300000, 8300000}};
+    map.ways.push_back({1, {1, 2, 3, 4, 5, 6}, {}, {{"highway", "residential"}}});
+    map.ways.push_back({2, {6, 1, 3, 5, 6}, {}, {{"natural", "water"}}});
+    map.ways.push_back({3, {3, 6}, {}, {{"highway", "primary"}}});
+    const auto pbf = ToPbf(map, 4);
+
+    Model::LoadOptions options;
+    options.bbox = Model::LoadOptions::BoundingBox{47.01, 8.01, 47.02, 8.02};
+    options.margin = 0.;
+    const Model model{Bytes(ToOsm(map)), options};
+    ASSERT_EQ(model.Nodes().size(), 4);
+    ASSERT_EQ(model.Ways().size(), 4);
+    const std::vector<std::vector<int>> ways{{0, 1}, {2, 3}, {0}, {3}};
+    for (std::size_t i = 0; i < ways.size(); i++) {
+        const auto way = model.Ways()[i].nodes;
+        EXPECT_EQ(std::vector<int>(way.begin(), way.end()), ways[i]) << "way " << i;
+    }
+    ASSERT_EQ(model.Roads().size(), 2);
+    EXPECT_EQ(model.Roads()[0].way, 0);
+    EXPECT_EQ(model.Roads()[1].way, 1);
+    ASSERT_EQ(model.Waters().size(), 1);
+    EXPECT_EQ(model.Waters()[0].outer, (std::vector<int>{2, 3}));
+
+    options.parser = Model::LoadOptions::Parser::Dom;
+    ExpectSameModel(model, Model{Bytes(ToOsm(map)), options});
+    ExpectSameModel(model, Model{reinterpret_cast<const std::byte *>(pbf.bytes.data()), pbf.bytes.size(), options});
+
+    options.updatable = true;
+    EXPECT_THROW(Model(Bytes(ToOsm(map)), options), std::logic_error);
+}
+
+
+// The model as a compiled map file.
+static std::vector<std::byte> Compile(const Model &model) {
+    const std::string path = "compiled_map_test.bin";
+    model.SaveBinary(path);
+    std::ifstream file{path, std::ios::binary};
+    const auto compiled = Bytes(std::string{std::istreambuf_iterator<char>(file), {}});
+    std::remove(path.c_str());
+    return compiled;
+}
+
+
+// A compiled map carries the routing graph and snap indices, which must answer as the ones built
+// from the source do; loaded at a lower precision than compiled, they are built again.
+TEST(OsmLoadingTest, TestCompiledMapRoutesAsSource) {
+    auto map = GridMap(30);
+    for (auto &way : map.ways) {
+        if (way.tags.front().second == "footway") {
+            way.tags.front().second = "service";
+        }
+    }
+    const auto osm = Bytes(ToOsm(map));
+    const RouteModel source{osm};
+    const auto compiled = Compile(source);
+
+    auto expect_same_answers = [](const RouteModel &expected, const RouteModel &actual) {
+        for (float x = 1.f; x < 100.f; x += 9.f) {
+            for (float y = 4.f; y < 100.f; y += 9.f) {
+                EXPECT_EQ(expected.FindClosestNode(x / 100.f, y / 100.f).Index(),
+                          actual.FindClosestNode(x / 100.f, y / 100.f).Index());
+                const auto a = expected.SnapToSegment(x / 100.f, y / 100.f);
+                const auto b = actual.SnapToSegment(x / 100.f, y / 100.f);
+                EXPECT_EQ(a.road, b.road);
+                EXPECT_EQ(a.segment, b.segment);
+                EXPECT_EQ(a.offset, b.offset);
+            }
+        }
+        for (auto snap : {RoutePlanner::SnapTo::Node, RoutePlanner::SnapTo::Segment}) {
+            RoutePlanner a{expected, 10, 15, 85, 90, snap};
+            a.AStarSearch();
+            RoutePlanner b{actual, 10, 15, 85, 90, snap};
+            b.AStarSearch();
+            EXPECT_EQ(a.GetDistance(), b.GetDistance());
+            ASSERT_EQ(a.GetPath().size(), b.GetPath().size());
+            for (std::size_t i = 0; i < a.GetPath().size(); i++) {
+                EXPECT_EQ(a.GetPath()[i].Index(), b.GetPath()[i].Index());
+            }
+        }
+    };
+    expect_same_answers(source, RouteModel{compiled});
+
+    Model::LoadOptions options;
+    options.precision = CoordStore::Precision::Float;
+    expect_same_answers(RouteModel{osm, options}, RouteModel{compiled, options});
+}
+
+
+// The grid's rows are only joined by footways, which the planner doesn't use, so a route between
+// two rows has to end with no path rather than run the search off its open list.
+TEST(OsmLoadingTest, TestDisconnectedRoadsHaveNoRoute) {
+    const RouteModel model{Bytes(ToOsm(GridMap(30)))};
+    for (auto snap : {RoutePlanner::SnapTo::Node, RoutePlanner::SnapTo::Segment}) {
+        RoutePlanner across{model, 50, 5, 50, 95, snap};
+        across.AStarSearch();
+        EXPECT_TRUE(across.GetPath().empty());
+        EXPECT_EQ(across.GetDistance(), 0.f);
+
+        RoutePlanner along{model, 10, 50, 90, 50, snap};
+        along.AStarSearch();
+        EXPECT_GT(along.GetPath().size(), 2);
+        EXPECT_GT(along.GetDistance(), 0.f);
+    }
+}
+
+
+// GridMap() with its columns as service roads, so that every node can be routed to, and its
+// nodes slightly out of line, so that no two routes or closest nodes tie.
+static TestMap RoutableGridMap(int size) {
+    auto map = GridMap(size);
+    for (auto &node : map.nodes) {
+        const int jitter = (int)(node.id * 7919 % 13) * 100000 / size / 40;
+        node.lat += jitter;
+        node.lon -= jitter;
+    }
+    for (auto &way : map.ways) {
+        if (way.tags.front().second == "footway") {
+            way.tags.front().second = "service";
+        }
+    }
+    return map;
+}
+
+
+// Hilbert order only renumbers the nodes: the ways and routes are the File-order ones, and
+// nodes that no way uses are dropped in both orders.
+TEST(OsmLoadingTest, TestHilbertOrderRenumbersNodes) {
+    auto map = RoutableGridMap(20);
+    const auto used = map.nodes.size();
+    for (int i = 0; i < 30; i++) {
+        map.nodes.push_back({100000 + i, 47001000 + 3000 * i, 8002000 + 2000 * i});
+    }
+    std::swap(map.nodes[3], map.nodes[used + 3]);
+    const auto osm = Bytes(ToOsm(map));
+    Model::LoadOptions options;
+    const RouteModel file_order{osm, options};
+    options.node_order = Model::LoadOptions::NodeOrder::Hilbert;
+    const RouteModel hilbert{osm, options};
+    EXPECT_EQ(file_order.Nodes().size(), used);
+    ASSERT_EQ(hilbert.Nodes().size(), used);
+
+    // The File-order node at each Hilbert-order node's position.
+    std::map<std::pair<double, double>, int> by_position;
+    for (std::size_t i = 0; i < file_order.Nodes().size(); i++) {
+        by_position[{file_order.Nodes()[i].x, file_order.Nodes()[i].y}] = (int)i;
+    }
+    ASSERT_EQ(by_position.size(), used);
+    std::vector<int> renumbered(used);
+    for (std::size_t i = 0; i < used; i++) {
+        const auto it = by_position.find({hilbert.Nodes()[i].x, hilbert.Nodes()[i].y});
+        ASSERT_NE(it, by_position.end()) << "node " << i;
+        renumbered[i] = it->second;
+    }
+    EXPECT_FALSE(std::is_sorted(renumbered.begin(), renumbered.end()));
+
+    ASSERT_EQ(file_order.Ways().size(), hilbert.Ways().size());
+    for (std::size_t i = 0; i < file_order.Ways().size(); i++) {
+        const auto a = file_order.Ways()[i].nodes, b = hilbert.Ways()[i].nodes;
+        ASSERT_EQ(a.size(), b.size()) << "way " << i;
+        for (std::size_t j = 0; j < a.size(); j++) {
+            EXPECT_EQ(a[j], renumbered[b[j]]) << "way " << i << ", node " << j;
+        }
+    }
+
+    for (auto snap : {RoutePlanner::SnapTo::Node, RoutePlanner::SnapTo::Segment}) {
+        for (float from : {5.f, 30.f, 60.f}) {
+            RoutePlanner a{file_order, from, 10, 95 - from, 85, snap};
+            a.AStarSearch();
+            RoutePlanner b{hilbert, from, 10, 95 - from, 85, snap};
+            b.AStarSearch();
+            EXPECT_EQ(a.GetDistance(), b.GetDistance());
+            ASSERT_EQ(a.GetPath().size(), b.GetPath().size());
+            for (std::size_t i = 0; i < a.GetPath().size(); i++) {
+                EXPECT_EQ(a.GetPath()[i].x, b.GetPath()[i].x);
+                EXPECT_EQ(a.GetPath()[i].y, b.GetPath()[i].y);
+            }
+        }
+    }
+}
+
+
+// A Routing load keeps only the roads the planner uses, and routes as a Full load does; a
+// Render load has no routing index at all.
+TEST(OsmLoadingTest, TestProfilesKeepTheirLayers) {
+    auto map = RoutableGridMap(16);
+    const auto node = [&map](int i) { return map.nodes[i].id; };
+    const long long next = map.ways.size() + 10;
+    map.ways.push_back({next, {node(0), node(17), node(34)}, {}, {{"highway", "footway"}}});
+    map.ways.push_back({next + 1, {node(5), node(22)}, {}, {{"highway", "steps"}}});
+    map.ways.push_back({next + 2, {node(40), node(41), node(42)}, {}, {{"railway", "rail"}}});
+    map.ways.push_back({next + 3, {node(50), node(51), node(67), node(66), node(50)}, {}, {{"building", "yes"}}});
+    map.ways.push_back({next + 4, {node(80), node(81), node(97), node(80)}, {}, {{"landuse", "grass"}}});
+    map.ways.push_back({next + 5, {node(100), node(101), node(117), node(100)}, {}, {{"leisure", "park"}}});
+    const auto osm = Bytes(ToOsm(map));
+
+    const RouteModel full{osm};
+    Model::LoadOptions options;
+    options.profile = Model::LoadOptions::Profile::Routing;
+    const RouteModel routing{osm, options};
+    EXPECT_EQ(routing.GetProfile(), Model::LoadOptions::Profile::Routing);
+
+    auto count_footways = [](const Model &model) {
+        return std::count_if(model.Roads().begin(), model.Roads().end(),
+                             [](const auto &road) { return road.type == Model::Road::Footway; });
+    };
+    EXPECT_EQ(count_footways(full), 2);
+    EXPECT_EQ(full.Railways().size(), 1);
+    EXPECT_EQ(full.Buildings().size(), 1);
+    EXPECT_EQ(full.Landuses().size(), 1);
+    EXPECT_EQ(full.Leisures().size(), 1);
+    EXPECT_EQ(full.Waters().size(), 1);
+    EXPECT_EQ(count_footways(routing), 0);
+    EXPECT_EQ(routing.Roads().size(), full.Roads().size() - 2);
+    EXPECT_TRUE(routing.Railways().empty());
+    EXPECT_TRUE(routing.Buildings().empty());
+    EXPECT_TRUE(routing.Landuses().empty());
+    EXPECT_TRUE(routing.Leisures().empty());
+    EXPECT_TRUE(routing.Waters().empty());
+    EXPECT_EQ(routing.Ways().size(), routing.Roads().size());
+
+    // The Routing load numbers nodes and ways by what it keeps, so routes compare by position.
+    for (auto snap : {RoutePlanner::SnapTo::Node, RoutePlanner::SnapTo::Segment}) {
+        for (float from : {5.f, 35.f, 70.f}) {
+            RoutePlanner a{full, from, 8, 90 - from, 92, snap};
+            a.AStarSearch();
+            RoutePlanner b{routing, from, 8, 90 - from, 92, snap};
+            b.AStarSearch();
+            EXPECT_EQ(a.GetDistance(), b.GetDistance());
+            ASSERT_EQ(a.GetPath().size(), b.GetPath().size());
+            for (std::size_t i = 0; i < a.GetPath().size(); i++) {
+                EXPECT_EQ(a.GetPath()[i].x, b.GetPath()[i].x);
+                EXPECT_EQ(a.GetPath()[i].y, b.GetPath()[i].y);
+            }
+        }
+    }
+
+    options.profile = Model::LoadOptions::Profile::Render;
+    const RouteModel render{osm, options};
+    EXPECT_EQ(render.Buildings().size(), 1);
+    EXPECT_EQ(render.Roads().size(), full.Roads().size());
+    EXPECT_THROW(render.FindClosestNode(0.5f, 0.5f), std::logic_error);
+    EXPECT_THROW(render.FindClosestNodes(0.5f, 0.5f, 3), std::logic_error);
+    EXPECT_THROW(render.SnapToSegment(0.5f, 0.5f), std::logic_error);
+    const double x = 50, y = 50;
+    int nearest = -1;
+    EXPECT_THROW(render.SnapToNodes(&x, &y, 1, RouteModel::Units::Percent, &nearest), std::logic_error);
+}
+
+
+// Float and Fixed32 coordinates move each node by at most the CoordinateError() they report,
+// in meters, from where a Double load puts it.
+TEST(OsmLoadingTest, TestQuantizedNodesStayWithinErrorBound) {
+    const auto osm = Bytes(ToOsm(RoutableGridMap(60)));
+    const Model exact{osm};
+    EXPECT_EQ(exact.CoordinateError(), 0.);
+    for (auto precision : {CoordStore::Precision::Float, CoordStore::Precision::Fixed32}) {
+        Model::LoadOptions options;
+        options.precision = precision;
+        const Model quantized{osm, options};
+        EXPECT_EQ(quantized.GetPrecision(), precision);
+        EXPECT_GT(quantized.CoordinateError(), 0.);
+        EXPECT_EQ(quantized.MetricScale(), exact.MetricScale());
+        ASSERT_EQ(quantized.Nodes().size(), exact.Nodes().size());
+        double largest = 0.;
+        for (std::size_t i = 0; i < exact.Nodes().size(); i++) {
+            const auto a = exact.Nodes()[i], b = quantized.Nodes()[i];
+            const auto moved = std::hypot(a.x - b.x, a.y - b.y) * exact.MetricScale();
+            EXPECT_LE(moved, quantized.CoordinateError()) << "node " << i;
+            largest = std::max(largest, moved);
+        }
+        EXPECT_GT(largest, 0.);
+    }
+}
+
+
+// A compiled map whose checksum is right but whose road or landuse types are out of range is
+// rejected like one whose indices are.
+TEST(OsmLoadingTest, TestCompiledMapWithBadTypesThrows) {
+    auto map = GridMap(8);
+    map.ways.push_back({100, {map.nodes[0].id, map.nodes[1].id, map.nodes[9].id, map.nodes[0].id}, {},
+                        {{"landuse", "forest"}}});
+    const auto osm = Bytes(ToOsm(map));
+    EXPECT_NO_THROW(Model{Compile(Model{osm})});
+
+    // The model isn't const, so its roads and landuses can be damaged before it is written.
+    for (int type : {-1, (int)Model::Road::Footway + 1, 1000}) {
+        Model model{osm};
+        const_cast<Model::Road &>(model.Roads().back()).type = (Model::Road::Type)type;
+        EXPECT_THROW(Model{Compile(model)}, std::logic_error) << "road type " << type;
+    }
+    for (int type : {-1, (int)Model::Landuse::Residential + 1}) {
+        Model model{osm};
+        ASSERT_EQ(model.Landuses().size(), 1);
+        const_cast<Model::Landuse &>(model.Landuses()[0]).type = (Model::Landuse::Type)type;
+        EXPECT_THROW(Model{Compile(model)}, std::logic_error) << "landuse type " << type;
+    }
+}
+
+
+// The DOM parser's document gives the same model from the arena as from the heap, with the same
+// allocations by pugixml but far fewer of them reaching the system, and all of them freed.
+TEST(OsmLoadingTest, TestDomArenaMatchesHeap) {
+    const auto osm = Bytes(ToOsm(GridMap(120)));
+    Model::LoadOptions options;
+    options.parser = Model::LoadOptions::Parser::Dom;
+
+    XmlArena::Install();
+    auto load = [&](Model::LoadOptions::DomMemory memory, XmlArena::Stats &used) {
+        options.dom_memory = memory;
+        const auto before = XmlArena::Totals();
+        Model model{osm, options};
+        const auto after = XmlArena::Totals();
+        used.allocations = after.allocations - before.allocations;
+        used.deallocations = after.deallocations - before.deallocations;
+        used.bytes = after.bytes - before.bytes;
+        used.system_allocations = after.system_allocations - before.system_allocations;
+        return model;
+    };
+    XmlArena::Stats heap_used, arena_used;
+    const auto heap = load(Model::LoadOptions::DomMemory::Heap, heap_used);
+    const auto arena = load(Model::LoadOptions::DomMemory::Arena, arena_used);
+    ExpectSameModel(heap, arena);
+    ExpectSameModel(Model{osm}, arena);
+
+    EXPECT_GT(heap_used.allocations, 100);
+    EXPECT_EQ(heap_used.allocations, arena_used.allocations);
+    EXPECT_EQ(heap_used.bytes, arena_used.bytes);
+    EXPECT_EQ(heap_used.deallocations, heap_used.allocations);
+    EXPECT_EQ(arena_used.deallocations, arena_used.allocations);
+    EXPECT_EQ(heap_used.system_allocations, heap_used.allocations);
+    EXPECT_LT(arena_used.system_allocations, heap_used.system_allocations);
+    EXPECT_LE(arena_used.system_allocations, 8);
+
+    // The load reports the same counts.
+    auto counter = [](const Model &model, const std::string &name) {
+        for (const auto &counter : model.GetLoadStats().counters) {
+            if (counter.name == name) {
+                return counter.value;
+            }
+        }
+        ADD_FAILURE() << "no counter " << name;
+        return -1.;
+    };
+    EXPECT_EQ(counter(heap, "xml allocations"), heap_used.allocations);
+    EXPECT_EQ(counter(arena, "xml system allocations"), arena_used.system_allocations);
+}
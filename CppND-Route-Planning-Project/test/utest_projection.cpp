@@ -0,0 +1,40 @@
+#include "gtest/gtest.h"
+#include <cmath>
+#include <random>
+#include <vector>
+#include "../src/projection.h"
+
+
+// The batched projection must agree with the scalar reference across the Web Mercator range.
+TEST(ProjectionTest, TestBatchMatchesReference) {
+    std::vector<double> lats{0., 1e-9, -1e-9, 37.4, -33.9, 60., 85.0511, -85.0511, 85.06, -85.06};
+    std::mt19937 rng{42};
+    std::uniform_real_distribution<double> lat_distribution{-85.06, 85.06};
+    for (int i = 0; i < 100000; i++) {
+        lats.push_back(lat_distribution(rng));
+    }
+
+    std::vector<double> ys = lats;
+    MercatorYBatch(ys.data(), ys.size());
+    for (std::size_t i = 0; i < lats.size(); i++) {
+        EXPECT_NEAR(ys[i], MercatorY(lats[i]), 1e-7) << "latitude " << lats[i];
+    }
+}
+
+
+// Sizes that are not a multiple of the kernel's block size, and latitudes out of range.
+TEST(ProjectionTest, TestBatchEdges) {
+    std::vector<double> ys(1000, 45.);
+    MercatorYBatch(ys.data(), 0);
+    EXPECT_EQ(ys[0], 45.);
+    MercatorYBatch(ys.data(), ys.size() - 1);
+    EXPECT_NEAR(ys[998], MercatorY(45.), 1e-7);
+    EXPECT_EQ(ys[999], 45.);
+
+    std::vector<double> poles{90., -90.};
+    MercatorYBatch(poles.data(), poles.size());
+    EXPECT_TRUE(std::isfinite(poles[0]));
+    EXPECT_EQ(poles[0], -poles[1]);
+    // This close to the pole tan() itself is only good to a few centimeters.
+    EXPECT_NEAR(poles[0], MercatorY(89.999999), 0.1);
+}
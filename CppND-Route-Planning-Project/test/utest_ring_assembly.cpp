@@ -0,0 +1,127 @@
+#include "gtest/gtest.h"
+#include <algorithm>
+#include <chrono>
+#include <random>
+#include <vector>
+#include "../src/ring_assembly.h"
+
+
+// A ring as its cycle of distinct nodes, rotated to start at its lowest node and turned to
+// continue with the lower of that node's neighbors, so equal rings compare equal.
+static std::vector<int> Normalize(std::vector<int> ring) {
+    ring.erase(std::unique(ring.begin(), ring.end()), ring.end());
+    if (ring.size() > 1 && ring.front() == ring.back()) {
+        ring.pop_back();
+    }
+    std::rotate(ring.begin(), std::min_element(ring.begin(), ring.end()), ring.end());
+    if (ring.size() > 2 && ring.back() < ring[1]) {
+        std::reverse(ring.begin() + 1, ring.end());
+    }
+    return ring;
+}
+
+
+struct Pieces {
+    Csr<int> ways;
+    std::vector<int> open;
+
+    void Add(std::vector<int> nodes) {
+        open.push_back((int)ways.Size());
+        ways.AddRow(nodes.begin(), nodes.end());
+    }
+};
+
+
+// Cuts the ring `first`, `first` + 1, ..., `first` + size - 1 into `cuts` ways, reversing some.
+static void AddRing(Pieces &pieces, int first, int size, int cuts, std::mt19937 &rng) {
+    std::vector<int> at{0};
+    for (int i = 1; i < cuts; i++) {
+        at.push_back(i * size / cuts);
+    }
+    at.push_back(size);
+    for (int i = 0; i < cuts; i++) {
+        std::vector<int> nodes;
+        for (int node = at[i]; node <= at[i + 1]; node++) {
+            nodes.push_back(first + node % size);
+        }
+        if (rng() % 2) {
+            std::reverse(nodes.begin(), nodes.end());
+        }
+        pieces.Add(nodes);
+    }
+}
+
+
+static std::vector<std::vector<int>> Assemble(const Pieces &pieces) {
+    std::vector<std::vector<int>> rings;
+    for (const auto &ring : AssembleRings(pieces.ways, pieces.open, std::chrono::steady_clock::now() + std::chrono::seconds(10))) {
+        EXPECT_EQ(ring.front(), ring.back());
+        rings.push_back(Normalize(ring));
+    }
+    std::sort(rings.begin(), rings.end());
+    return rings;
+}
+
+
+static std::vector<int> Cycle(int first, int size) {
+    std::vector<int> cycle;
+    for (int i = 0; i < size; i++) {
+        cycle.push_back(first + i);
+    }
+    return cycle;
+}
+
+
+TEST(RingAssemblyTest, TestShuffledPiecesMakeTheirRings) {
+    std::mt19937 rng{3};
+    for (int trial = 0; trial < 50; trial++) {
+        Pieces pieces;
+        std::vector<std::vector<int>> expected;
+        for (int ring = 0; ring < 1 + trial % 6; ring++) {
+            const int size = 4 + rng() % 20;
+            AddRing(pieces, 100 * ring, size, 2 + rng() % (size - 2), rng);
+            expected.push_back(Cycle(100 * ring, size));
+        }
+        std::shuffle(pieces.open.begin(), pieces.open.end(), rng);
+        EXPECT_EQ(Assemble(pieces), expected) << "trial " << trial;
+    }
+}
+
+
+TEST(RingAssemblyTest, TestUnclosableWaysAreDropped) {
+    std::mt19937 rng{5};
+    Pieces pieces;
+    AddRing(pieces, 0, 8, 3, rng);
+    // A chain with a gap, a way leading into a loop, and a degenerate way.
+    pieces.Add({100, 101, 102});
+    pieces.Add({103, 104});
+    pieces.Add({200, 201});
+    pieces.Add({201, 202, 203});
+    pieces.Add({203, 204, 201});
+    pieces.Add({300});
+    EXPECT_EQ(Assemble(pieces), (std::vector<std::vector<int>>{Cycle(0, 8), {201, 202, 203, 204}}));
+
+    // A relation that can't be closed at all.
+    Pieces open_only;
+    open_only.Add({1, 2, 3});
+    open_only.Add({3, 4});
+    open_only.Add({5, 1});
+    EXPECT_TRUE(Assemble(open_only).empty());
+}
+
+
+// Past the deadline, assembly stops and returns the complete rings it has.
+TEST(RingAssemblyTest, TestDeadlineEndsAssembly) {
+    std::mt19937 rng{7};
+    Pieces pieces;
+    const int count = 20000;
+    for (int ring = 0; ring < count; ring++) {
+        AddRing(pieces, 10 * ring, 6, 3, rng);
+    }
+    const auto rings = AssembleRings(pieces.ways, pieces.open, std::chrono::steady_clock::now() - std::chrono::seconds(1));
+    EXPECT_LT(rings.size(), count);
+    for (const auto &ring : rings) {
+        const auto normalized = Normalize(ring);
+        EXPECT_EQ(normalized, Cycle(normalized.front(), 6));
+    }
+}
@@ -1,92 +1,87 @@
 #include "gtest/gtest.h"
-#include <fstream>
+#include <algorithm>
 #include <iostream>
+#include <numeric>
 #include <optional>
+#include <string>
 #include <vector>
+#include "../src/mapped_file.h"
 #include "../src/route_model.h"
 #include "../src/route_planner.h"
 
 
-static std::optional<std::vector<std::byte>> ReadFile(const std::string &path)
-{   
-    std::ifstream is{path, std::ios::binary | std::ios::ate};
-    if( !is )
-        return std::nullopt;
-    
-    auto size = is.tellg();
-    std::vector<std::byte> contents(size);    
-    
-    is.seekg(0);
-    is.read((char*)contents.data(), size);
-
-    if( contents.empty() )
-        return std::nullopt;
-    return std::move(contents);
+static std::vector<std::byte> Bytes(const std::string &text) {
+    const auto data = reinterpret_cast<const std::byte *>(text.data());
+    return std::vector<std::byte>(data, data + text.size());
 }
 
-std::vector<std::byte> ReadOSMData(const std::string &path) {
-    std::vector<std::byte> osm_data;
-    auto data = ReadFile(path);
+
+MappedFile ReadOSMData(const std::string &path) {
+    auto data = MappedFile::Open(path);
     if( !data ) {
         std::cout << "Failed to read OSM data." << std::endl;
-    } else {
-        osm_data = std::move(*data);
+        throw std::runtime_error("missing " + path);
     }
-    return osm_data;
+    return std::move(*data);
 }
 
 //--------------------------------//
 //   Beginning RoutePlanner Tests.
 //--------------------------------//
 
+// The model is read-only during searches, so all tests share one.
+const RouteModel &SharedModel() {
+    static MappedFile osm_data = ReadOSMData("../map.osm");
+    static RouteModel model{osm_data.Data(), osm_data.Size()};
+    return model;
+}
+
 class RoutePlannerTest : public ::testing::Test {
   protected:
-    std::string osm_data_file = "../map.osm";
-    std::vector<std::byte> osm_data = ReadOSMData(osm_data_file);
-    RouteModel model{osm_data};
-    RoutePlanner route_planner{model, 10, 10, 90, 90};
+    const RouteModel &model = SharedModel();
+    SearchState state;
+    RoutePlanner route_planner{model, state, 10, 10, 90, 90};
     
     // Construct start_node and end_node as in the model.
     float start_x = 0.1;
     float start_y = 0.1;
     float end_x = 0.9;
     float end_y = 0.9;
-    RouteModel::Node* start_node = &model.FindClosestNode(start_x, start_y);
-    RouteModel::Node* end_node = &model.FindClosestNode(end_x, end_y);
+    RouteModel::Node start_node = model.FindClosestNode(start_x, start_y);
+    RouteModel::Node end_node = model.FindClosestNode(end_x, end_y);
 
     // Construct another node in the middle of the map for testing.
     float mid_x = 0.5;
     float mid_y = 0.5;
-    RouteModel::Node* mid_node = &model.FindClosestNode(mid_x, mid_y);
+    RouteModel::Node mid_node = model.FindClosestNode(mid_x, mid_y);
 };
 
 
 // Test the CalculateHValue method.
 TEST_F(RoutePlannerTest, TestCalculateHValue) {
-    EXPECT_FLOAT_EQ(route_planner.CalculateHValue(start_node), 1.1329799);
-    EXPECT_FLOAT_EQ(route_planner.CalculateHValue(end_node), 0.0f);
-    EXPECT_FLOAT_EQ(route_planner.CalculateHValue(mid_node), 0.58903033);
+    EXPECT_FLOAT_EQ(route_planner.CalculateHValue(&start_node), 1.1329799);
+    EXPECT_FLOAT_EQ(route_planner.CalculateHValue(&end_node), 0.0f);
+    EXPECT_FLOAT_EQ(route_planner.CalculateHValue(&mid_node), 0.58903033);
 }
 
 
 
 // Test the AddNeighbors method.
-bool NodesSame(RouteModel::Node* a, RouteModel::Node* b) { return a == b; }
 TEST_F(RoutePlannerTest, TestAddNeighbors) {
-    route_planner.AddNeighbors(start_node);
+    route_planner.AddNeighbors(&start_node);
 
     // Correct h and g values for the neighbors of start_node.
     std::vector<float> start_neighbor_g_vals{0.10671431, 0.082997195, 0.051776856, 0.055291083};
     std::vector<float> start_neighbor_h_vals{1.1828455, 1.0998145, 1.0858033, 1.1831238};
-    auto neighbors = start_node->neighbors;
+    auto neighbors = state.Neighbors(start_node.Index());
     EXPECT_EQ(neighbors.size(), 4);
 
     // Check results for each neighbor.
     for (int i = 0; i < neighbors.size(); i++) {
-        EXPECT_PRED2(NodesSame, neighbors[i]->parent, start_node);
-        EXPECT_FLOAT_EQ(neighbors[i]->g_value, start_neighbor_g_vals[i]);
-        EXPECT_FLOAT_EQ(neighbors[i]->h_value, start_neighbor_h_vals[i]);
-        EXPECT_EQ(neighbors[i]->visited, true);
+        EXPECT_EQ(state[neighbors[i]].parent, start_node.Index());
+        EXPECT_FLOAT_EQ(state[neighbors[i]].g_value, start_neighbor_g_vals[i]);
+        EXPECT_FLOAT_EQ(state[neighbors[i]].h_value, start_neighbor_h_vals[i]);
+        EXPECT_EQ(state[neighbors[i]].visited, true);
     }
 }
 
@@ -94,29 +89,246 @@ TEST_F(RoutePlannerTest, TestAddNeighbors) {
 // Test the ConstructFinalPath method.
 TEST_F(RoutePlannerTest, TestConstructFinalPath) {
     // Construct a path.
-    mid_node->parent = start_node;
-    end_node->parent = mid_node;
-    std::vector<RouteModel::Node> path = route_planner.ConstructFinalPath(end_node);
+    state[mid_node.Index()].parent = start_node.Index();
+    state[end_node.Index()].parent = mid_node.Index();
+    std::vector<RouteModel::Node> path = route_planner.ConstructFinalPath(&end_node);
 
     // Test the path.
     EXPECT_EQ(path.size(), 3);
-    EXPECT_FLOAT_EQ(start_node->x, path.front().x);
-    EXPECT_FLOAT_EQ(start_node->y, path.front().y);
-    EXPECT_FLOAT_EQ(end_node->x, path.back().x);
-    EXPECT_FLOAT_EQ(end_node->y, path.back().y);
+    EXPECT_FLOAT_EQ(start_node.x, path.front().x);
+    EXPECT_FLOAT_EQ(start_node.y, path.front().y);
+    EXPECT_FLOAT_EQ(end_node.x, path.back().x);
+    EXPECT_FLOAT_EQ(end_node.y, path.back().y);
 }
 
 
 // Test the AStarSearch method.
 TEST_F(RoutePlannerTest, TestAStarSearch) {
     route_planner.AStarSearch();
-    EXPECT_EQ(model.path.size(), 33);
-    RouteModel::Node path_start = model.path.front();
-    RouteModel::Node path_end = model.path.back();
+    EXPECT_EQ(route_planner.GetPath().size(), 33);
+    RouteModel::Node path_start = route_planner.GetPath().front();
+    RouteModel::Node path_end = route_planner.GetPath().back();
     // The start_node and end_node x, y values should be the same as in the path.
-    EXPECT_FLOAT_EQ(start_node->x, path_start.x);
-    EXPECT_FLOAT_EQ(start_node->y, path_start.y);
-    EXPECT_FLOAT_EQ(end_node->x, path_end.x);
-    EXPECT_FLOAT_EQ(end_node->y, path_end.y);
+    EXPECT_FLOAT_EQ(start_node.x, path_start.x);
+    EXPECT_FLOAT_EQ(start_node.y, path_start.y);
+    EXPECT_FLOAT_EQ(end_node.x, path_end.x);
+    EXPECT_FLOAT_EQ(end_node.y, path_end.y);
     EXPECT_FLOAT_EQ(route_planner.GetDistance(), 873.41565);
 }
+
+
+// Test that a search leaves nothing behind that changes the next one.
+TEST_F(RoutePlannerTest, TestRepeatedSearch) {
+    RoutePlanner other_planner{model, state, 90, 10, 10, 90};
+    other_planner.AStarSearch();
+
+    RoutePlanner again{model, state, 10, 10, 90, 90};
+    again.AStarSearch();
+    RoutePlanner fresh{model, 10, 10, 90, 90};
+    fresh.AStarSearch();
+    ASSERT_EQ(again.GetPath().size(), fresh.GetPath().size());
+    for (int i = 0; i < fresh.GetPath().size(); i++) {
+        EXPECT_EQ(again.GetPath()[i].Index(), fresh.GetPath()[i].Index());
+    }
+    EXPECT_FLOAT_EQ(again.GetDistance(), fresh.GetDistance());
+}
+
+
+// The closest node of a way other than the node itself that isn't visited, scanning the whole
+// way as the planner did before it kept candidate lists; the first of equally close ones.
+static int FullWayScan(const RouteModel &model, int node, int way, SearchState &state) {
+    int closest = -1;
+    float closest_distance = 0;
+    for (int other : model.Ways()[way].nodes) {
+        const float distance = model.SNodes()[node].distance(model.SNodes()[other]);
+        if (distance != 0 && !state.Visited(other) && (closest < 0 || distance < closest_distance)) {
+            closest = other;
+            closest_distance = distance;
+        }
+    }
+    return closest;
+}
+
+
+// Test that neighbors from the candidate lists are those a scan of the whole way finds, also once
+// every candidate of a long way is visited and FindNeighbors() has to scan it.
+TEST(RouteModelTest, TestNeighborsMatchFullWayScan) {
+    // A long winding way, a short way across it, and a way that passes one node twice.
+    std::string osm = "<osm>\n <bounds minlat=\"47.0\" minlon=\"8.0\" maxlat=\"47.1\" maxlon=\"8.1\"/>\n";
+    const int count = 40;
+    for (int i = 0; i < count; i++) {
+        osm += " <node id=\"" + std::to_string(i + 1) + "\" lat=\"47.0" + std::to_string(50000 + (i * 37) % 11 * 300) +
+               "\" lon=\"8.0" + std::to_string(10000 + i * 2000 + (i * 53) % 7 * 150) + "\"/>\n";
+    }
+    osm += " <node id=\"100\" lat=\"47.04\" lon=\"8.05\"/>\n <node id=\"101\" lat=\"47.06\" lon=\"8.05\"/>\n";
+    osm += " <way id=\"1\">\n";
+    for (int i = 0; i < count; i++) {
+        osm += "  <nd ref=\"" + std::to_string(i + 1) + "\"/>\n";
+    }
+    osm += "  <tag k=\"highway\" v=\"residential\"/>\n </way>\n";
+    osm += " <way id=\"2\">\n  <nd ref=\"100\"/>\n  <nd ref=\"21\"/>\n  <nd ref=\"101\"/>\n"
+           "  <tag k=\"highway\" v=\"primary\"/>\n </way>\n";
+    osm += " <way id=\"3\">\n  <nd ref=\"10\"/>\n  <nd ref=\"100\"/>\n  <nd ref=\"30\"/>\n  <nd ref=\"101\"/>\n"
+           "  <nd ref=\"10\"/>\n  <tag k=\"highway\" v=\"service\"/>\n </way>\n</osm>\n";
+    const RouteModel model{Bytes(osm)};
+    ASSERT_EQ(model.Nodes().size(), count + 2);
+
+    SearchState state;
+    for (int node = 0; node < model.Nodes().size(); node++) {
+        // Nodes visited in order of distance, so that the nearest ones, the candidates, go first.
+        std::vector<int> by_distance(model.Nodes().size());
+        std::iota(by_distance.begin(), by_distance.end(), 0);
+        std::stable_sort(by_distance.begin(), by_distance.end(), [&](int a, int b) {
+            return model.SNodes()[node].distance(model.SNodes()[a]) < model.SNodes()[node].distance(model.SNodes()[b]);
+        });
+        for (int visited = 0; visited <= by_distance.size(); visited++) {
+            state.Reset(model.Nodes().size());
+            for (int i = 0; i < visited; i++) {
+                state[by_distance[i]].visited = true;
+            }
+            std::vector<int> expected;
+            for (const auto &road : model.Roads()) {
+                for (int way_node : model.Ways()[road.way].nodes) {
+                    if (way_node == node) {
+                        if (int neighbor = FullWayScan(model, node, road.way, state); neighbor >= 0) {
+                            expected.push_back(neighbor);
+                        }
+                    }
+                }
+            }
+            model.FindNeighbors(model.SNodes()[node], state);
+            const auto found = state.Neighbors(node);
+            std::vector<int> actual(found.begin(), found.end());
+            std::sort(expected.begin(), expected.end());
+            std::sort(actual.begin(), actual.end());
+            EXPECT_EQ(actual, expected) << "node " << node << ", " << visited << " visited";
+        }
+    }
+}
+
+
+// Test that snapping a batch, on several threads, finds the nodes FindClosestNode() finds.
+TEST(RouteModelTest, TestSnapToNodes) {
+    const RouteModel &model = SharedModel();
+    std::vector<double> x, y;
+    for (int i = 0; i <= 100; i++) {
+        for (int j = 0; j <= 100; j += 5) {
+            x.push_back(i);
+            y.push_back(j + 0.5);
+        }
+    }
+    std::vector<int> nodes(x.size());
+    model.SnapToNodes(x.data(), y.data(), x.size(), RouteModel::Units::Percent, nodes.data(), 4);
+    for (int i = 0; i < x.size(); i++) {
+        float px = x[i], py = y[i];
+        px *= 0.01;
+        py *= 0.01;
+        EXPECT_EQ(nodes[i], model.FindClosestNode(px, py).Index());
+    }
+
+    // The same points in meters.
+    for (int i = 0; i < x.size(); i++) {
+        x[i] *= 0.01 * model.MetricScale();
+        y[i] *= 0.01 * model.MetricScale();
+    }
+    std::vector<int> metric(x.size());
+    model.SnapToNodes(x.data(), y.data(), x.size(), RouteModel::Units::Meters, metric.data());
+    for (int i = 0; i < x.size(); i++) {
+        EXPECT_EQ(metric[i], model.FindClosestNode(x[i] / model.MetricScale(), y[i] / model.MetricScale()).Index());
+    }
+}
+
+
+// Test that segment routes start and end at the snapped points, as virtual nodes past the model's.
+TEST(RoutePlannerSegmentTest, TestRouteEndsAtSnappedPoints) {
+    const RouteModel &model = SharedModel();
+    float start_x = 10, start_y = 10, end_x = 90, end_y = 90;
+    RoutePlanner planner{model, start_x, start_y, end_x, end_y, RoutePlanner::SnapTo::Segment};
+    planner.AStarSearch();
+    start_x *= 0.01;
+    start_y *= 0.01;
+    end_x *= 0.01;
+    end_y *= 0.01;
+    const auto start = model.SnapToSegment(start_x, start_y);
+    const auto end = model.SnapToSegment(end_x, end_y);
+
+    const auto &path = planner.GetPath();
+    ASSERT_GT(path.size(), 2);
+    EXPECT_EQ(path.front().Index(), model.SNodes().size());
+    EXPECT_EQ(path.back().Index(), model.SNodes().size() + 1);
+    EXPECT_FLOAT_EQ(path.front().x, start.point.x);
+    EXPECT_FLOAT_EQ(path.front().y, start.point.y);
+    EXPECT_FLOAT_EQ(path.back().x, end.point.x);
+    EXPECT_FLOAT_EQ(path.back().y, end.point.y);
+    // The first and last nodes in between are the ends of the snapped segments.
+    const auto start_way = model.Ways()[model.Roads()[start.road].way].nodes;
+    const auto end_way = model.Ways()[model.Roads()[end.road].way].nodes;
+    EXPECT_TRUE(path[1].Index() == start_way[start.segment] || path[1].Index() == start_way[start.segment + 1]);
+    const int last = path[path.size() - 2].Index();
+    EXPECT_TRUE(last == end_way[end.segment] || last == end_way[end.segment + 1]);
+
+    float distance = 0;
+    for (int i = 1; i < path.size(); i++) {
+        distance += path[i].distance(path[i - 1]);
+    }
+    EXPECT_FLOAT_EQ(planner.GetDistance(), distance * model.MetricScale());
+}
+
+
+// Test that a route between two points of one segment goes straight along it.
+TEST(RoutePlannerSegmentTest, TestSharedSegmentIsDirect) {
+    const RouteModel &model = SharedModel();
+    const auto snap = model.SnapToSegment(0.5f, 0.5f);
+    const auto way_nodes = model.Ways()[model.Roads()[snap.road].way].nodes;
+    const auto a = model.SNodes()[way_nodes[snap.segment]], b = model.SNodes()[way_nodes[snap.segment + 1]];
+    const auto along = [&](float t) { return Model::Node{a.x + (b.x - a.x) * t, a.y + (b.y - a.y) * t}; };
+    const auto from = along(0.3f), to = along(0.7f);
+
+    RoutePlanner planner{model, float(from.x * 100), float(from.y * 100), float(to.x * 100), float(to.y * 100),
+                         RoutePlanner::SnapTo::Segment};
+    planner.AStarSearch();
+    const auto &path = planner.GetPath();
+    ASSERT_EQ(path.size(), 2);
+    EXPECT_EQ(path.front().Index(), model.SNodes().size());
+    EXPECT_EQ(path.back().Index(), model.SNodes().size() + 1);
+    EXPECT_NEAR(planner.GetDistance(), 0.4 * a.distance(b) * model.MetricScale(), 0.01);
+}
+
+
+// Test that a node the open list holds twice, as two roads lead to it from the same node, is
+// expanded once, and that the route through it is the direct one.
+TEST(RoutePlannerOpenListTest, TestNodeOnTwoRoadsIsExpandedOnce) {
+    const RouteModel model{Bytes(
+        "<osm>\n <bounds minlat=\"47.0\" minlon=\"8.0\" maxlat=\"47.1\" maxlon=\"8.1\"/>\n"
+        " <node id=\"1\" lat=\"47.05\" lon=\"8.01\"/>\n <node id=\"2\" lat=\"47.05\" lon=\"8.03\"/>\n"
+        " <node id=\"3\" lat=\"47.051\" lon=\"8.05\"/>\n <node id=\"4\" lat=\"47.07\" lon=\"8.031\"/>\n"
+        " <way id=\"1\">\n  <nd ref=\"1\"/>\n  <nd ref=\"2\"/>\n  <nd ref=\"3\"/>\n"
+        "  <tag k=\"highway\" v=\"residential\"/>\n </way>\n"
+        " <way id=\"2\">\n  <nd ref=\"1\"/>\n  <nd ref=\"2\"/>\n  <nd ref=\"4\"/>\n"
+        "  <tag k=\"highway\" v=\"service\"/>\n </way>\n</osm>\n")};
+    ASSERT_EQ(model.Nodes().size(), 4);
+    const auto start = model.SNodes()[0], shared = model.SNodes()[1], end = model.SNodes()[2];
+    const float start_x = start.x * 100, start_y = start.y * 100, end_x = end.x * 100, end_y = end.y * 100;
+
+    SearchState state;
+    RoutePlanner planner{model, state, start_x, start_y, end_x, end_y};
+    planner.AddNeighbors(&start);
+    const auto first = planner.NextNode();
+    ASSERT_TRUE(first);
+    EXPECT_EQ(first->Index(), shared.Index());
+    planner.AddNeighbors(&*first);
+    std::vector<int> expanded;
+    while (const auto next = planner.NextNode()) {
+        expanded.push_back(next->Index());
+    }
+    std::sort(expanded.begin(), expanded.end());
+    EXPECT_EQ(expanded, (std::vector<int>{2, 3}));
+
+    RoutePlanner search{model, start_x, start_y, end_x, end_y};
+    search.AStarSearch();
+    ASSERT_EQ(search.GetPath().size(), 3);
+    EXPECT_EQ(search.GetPath()[0].Index(), 0);
+    EXPECT_EQ(search.GetPath()[1].Index(), 1);
+    EXPECT_EQ(search.GetPath()[2].Index(), 2);
+    EXPECT_FLOAT_EQ(search.GetDistance(), (start.distance(shared) + shared.distance(end)) * model.MetricScale());
+}
@@ -0,0 +1,77 @@
+#include "gtest/gtest.h"
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <random>
+#include <vector>
+#include "../src/segment_index.h"
+
+
+// Distance from (x, y) to a segment, computed directly.
+static double SegmentDistance(const SegmentIndex::Segment &s, double x, double y) {
+    double dx = s.x1 - s.x0, dy = s.y1 - s.y0;
+    double length2 = dx * dx + dy * dy;
+    double t = length2 > 0 ? std::clamp(((x - s.x0) * dx + (y - s.y0) * dy) / length2, 0., 1.) : 0.;
+    return std::hypot(x - (s.x0 + t * dx), y - (s.y0 + t * dy));
+}
+
+
+// Short random segments, some of them degenerate, like the pieces of a road network.
+static std::vector<SegmentIndex::Segment> RandomSegments(std::size_t count, std::mt19937 &rng) {
+    std::uniform_real_distribution<double> coordinate{0., 1.};
+    std::uniform_real_distribution<double> step{-0.02, 0.02};
+    std::vector<SegmentIndex::Segment> segments;
+    for (std::size_t i = 0; i < count; i++) {
+        double x = coordinate(rng), y = coordinate(rng);
+        if (i % 50 == 0) {
+            segments.push_back({x, y, x, y});
+        } else {
+            segments.push_back({x, y, x + step(rng), y + step(rng)});
+        }
+    }
+    return segments;
+}
+
+
+TEST(SegmentIndexTest, TestFindMatchesLinearScan) {
+    std::mt19937 rng{3};
+    std::uniform_real_distribution<double> coordinate{-0.1, 1.1};
+    for (std::size_t count : {1, 15, 16, 17, 300, 20000}) {
+        auto segments = RandomSegments(count, rng);
+        SegmentIndex index{segments};
+        ASSERT_EQ(index.Size(), count);
+        for (int query = 0; query < 300; query++) {
+            double x = coordinate(rng), y = coordinate(rng);
+            double best = std::numeric_limits<double>::max();
+            for (const auto &s : segments) {
+                best = std::min(best, SegmentDistance(s, x, y));
+            }
+
+            const auto found = index.Find(x, y);
+            ASSERT_GE(found.segment, 0);
+            EXPECT_NEAR(found.distance, best, 1e-12);
+            EXPECT_NEAR(SegmentDistance(segments[found.segment], x, y), best, 1e-12);
+            EXPECT_NEAR(std::hypot(found.x - x, found.y - y), found.distance, 1e-12);
+            EXPECT_GE(found.offset, 0.);
+            EXPECT_LE(found.offset, 1.);
+        }
+    }
+}
+
+
+TEST(SegmentIndexTest, TestProjection) {
+    SegmentIndex index{{{0., 0., 1., 0.}, {0., 1., 1., 1.}}};
+    auto found = index.Find(0.25, 0.1);
+    EXPECT_EQ(found.segment, 0);
+    EXPECT_DOUBLE_EQ(found.offset, 0.25);
+    EXPECT_DOUBLE_EQ(found.x, 0.25);
+    EXPECT_DOUBLE_EQ(found.y, 0.);
+    EXPECT_DOUBLE_EQ(found.distance, 0.1);
+
+    // Past the end of a segment, the closest point is its end; halfway, the first segment wins.
+    found = index.Find(2., 0.5);
+    EXPECT_EQ(found.segment, 0);
+    EXPECT_DOUBLE_EQ(found.offset, 1.);
+
+    EXPECT_EQ(SegmentIndex{}.Find(0., 0.).segment, -1);
+}
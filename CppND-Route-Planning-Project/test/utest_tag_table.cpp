@@ -0,0 +1,108 @@
+#include "gtest/gtest.h"
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "../src/osm_tags.h"
+
+
+// How ways were classified before the tag table: an if-ladder over each tag.
+static std::optional<TagClass> ClassifyByLadder(std::string_view category, std::string_view type) {
+    if (category == "highway") {
+        if (type == "motorway") return TagClass{TagClass::Road, Model::Road::Motorway};
+        if (type == "trunk") return TagClass{TagClass::Road, Model::Road::Trunk};
+        if (type == "primary") return TagClass{TagClass::Road, Model::Road::Primary};
+        if (type == "secondary") return TagClass{TagClass::Road, Model::Road::Secondary};
+        if (type == "tertiary") return TagClass{TagClass::Road, Model::Road::Tertiary};
+        if (type == "residential") return TagClass{TagClass::Road, Model::Road::Residential};
+        if (type == "living_street") return TagClass{TagClass::Road, Model::Road::Residential};
+        if (type == "service") return TagClass{TagClass::Road, Model::Road::Service};
+        if (type == "unclassified") return TagClass{TagClass::Road, Model::Road::Unclassified};
+        if (type == "footway") return TagClass{TagClass::Road, Model::Road::Footway};
+        if (type == "bridleway") return TagClass{TagClass::Road, Model::Road::Footway};
+        if (type == "steps") return TagClass{TagClass::Road, Model::Road::Footway};
+        if (type == "path") return TagClass{TagClass::Road, Model::Road::Footway};
+        if (type == "pedestrian") return TagClass{TagClass::Road, Model::Road::Footway};
+        return std::nullopt;
+    }
+    if (category == "railway") return TagClass{TagClass::Railway};
+    if (category == "building") return TagClass{TagClass::Building};
+    if (category == "leisure" ||
+        (category == "natural" && (type == "wood" || type == "tree_row" || type == "scrub" || type == "grassland")) ||
+        (category == "landcover" && type == "grass")) {
+        return TagClass{TagClass::Leisure};
+    }
+    if (category == "natural" && type == "water") return TagClass{TagClass::Water};
+    if (category == "landuse") {
+        if (type == "commercial") return TagClass{TagClass::Landuse, Model::Landuse::Commercial};
+        if (type == "construction") return TagClass{TagClass::Landuse, Model::Landuse::Construction};
+        if (type == "grass") return TagClass{TagClass::Landuse, Model::Landuse::Grass};
+        if (type == "forest") return TagClass{TagClass::Landuse, Model::Landuse::Forest};
+        if (type == "industrial") return TagClass{TagClass::Landuse, Model::Landuse::Industrial};
+        if (type == "railway") return TagClass{TagClass::Landuse, Model::Landuse::Railway};
+        if (type == "residential") return TagClass{TagClass::Landuse, Model::Landuse::Residential};
+        return TagClass{TagClass::Landuse, Model::Landuse::Invalid};
+    }
+    return std::nullopt;
+}
+
+
+static void ExpectSameClass(std::string_view key, std::string_view value) {
+    const auto *found = kTags.Find(key, value);
+    const auto expected = ClassifyByLadder(key, value);
+    ASSERT_EQ(found != nullptr, expected.has_value()) << key << "=" << value;
+    if (found) {
+        EXPECT_EQ(found->kind, expected->kind) << key << "=" << value;
+        EXPECT_EQ(found->type, expected->type) << key << "=" << value;
+    }
+}
+
+
+TEST(TagTableTest, TestEveryEntryMatchesLadder) {
+    for (const auto &entry : kTagEntries) {
+        const auto *found = kTags.Find(entry.key, entry.value);
+        ASSERT_NE(found, nullptr) << entry.key << "=" << entry.value;
+        EXPECT_EQ(found->kind, entry.data.kind) << entry.key << "=" << entry.value;
+        EXPECT_EQ(found->type, entry.data.type) << entry.key << "=" << entry.value;
+        if (entry.value != "*") {
+            ExpectSameClass(entry.key, entry.value);
+        }
+    }
+
+    // Every known key with every known value, so that a value of one key never classifies
+    // another, and wildcard keys with values the table doesn't list.
+    std::vector<std::string_view> keys, values{"*", "yes", "motorway_link", "beach"};
+    for (const auto &entry : kTagEntries) {
+        keys.push_back(entry.key);
+        values.push_back(entry.value);
+    }
+    for (auto key : keys) {
+        for (auto value : values) {
+            ExpectSameClass(key, value);
+        }
+    }
+}
+
+
+TEST(TagTableTest, TestUnknownTagsMiss) {
+    EXPECT_EQ(kTags.Find("amenity", "parking"), nullptr);
+    EXPECT_EQ(kTags.Find("name", "motorway"), nullptr);
+    EXPECT_EQ(kTags.Find("highway", "motorway_link"), nullptr);
+    EXPECT_EQ(kTags.Find("highway", "Motorway"), nullptr);
+    EXPECT_EQ(kTags.Find("natural", "beach"), nullptr);
+    EXPECT_EQ(kTags.Find("landcover", "trees"), nullptr);
+    EXPECT_EQ(kTags.Find("", ""), nullptr);
+    EXPECT_EQ(kTags.Find("", "motorway"), nullptr);
+    EXPECT_EQ(kTags.Find("highway", ""), nullptr);
+    EXPECT_EQ(kTags.Find("highway ", "motorway"), nullptr);
+    // Keys that differ from known ones in one character, or are prefixes of them.
+    for (const auto &entry : kTagEntries) {
+        std::string longer{entry.key};
+        longer += 's';
+        EXPECT_EQ(kTags.Find(longer, entry.value), nullptr) << longer;
+        EXPECT_EQ(kTags.Find(entry.key.substr(0, entry.key.size() - 1), entry.value), nullptr) << entry.key;
+    }
+    // Wildcard keys match any value, even none.
+    ASSERT_NE(kTags.Find("building", ""), nullptr);
+    EXPECT_EQ(kTags.Find("building", "")->kind, TagClass::Building);
+}